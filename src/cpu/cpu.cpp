@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cpu.h"
+#include <string.h>
+#include <stdlib.h>
+
+
+/**
+ * @file cpu.cpp
+ * @brief Runtime selection of the instruction set of the hot kernels
+ *
+ * The binary is built for the baseline x86-64; the kernels that profit from wider vectors are
+ * compiled once per instruction set and the widest one the processor supports is taken at run
+ * time. For testing the choice can be forced with CPU_Select, which the -s option of the
+ * programs calls, or with the MEANSHIFT_ISA environment variable (scalar, avx2, avx512 or auto).
+ * A request for an instruction set the processor lacks falls back to the widest it has.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+static int cpu_supported = -1;     // detected instruction set, -1 before the detection
+static int cpu_forced = -1;        // instruction set of CPU_Select, -1 if none
+
+
+/*! \brief Function CPU_Supported returns the widest instruction set of the processor, with cpuid
+*
+*  \return instruction set
+*/
+CpuIsa CPU_Supported()
+{
+    if(cpu_supported < 0)
+    {
+        // also checks that the operating system saves the vector registers
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+            cpu_supported = CPU_ISA_AVX512;
+        else if(__builtin_cpu_supports("avx2"))
+            cpu_supported = CPU_ISA_AVX2;
+        else
+            cpu_supported = CPU_ISA_SCALAR;
+    }
+    return (CpuIsa)cpu_supported;
+}
+
+/*! \brief Function CPU_Select forces the instruction set of the kernels
+*
+*  \param isa instruction set, narrowed to the one of the processor
+*/
+void CPU_Select(CpuIsa isa)
+{
+    cpu_forced = isa < CPU_Supported() ? isa : CPU_Supported();
+}
+
+/*! \brief Function CPU_Selected returns the instruction set of the kernels
+*
+*  \return the one of CPU_Select, else the one of MEANSHIFT_ISA, else the widest supported
+*/
+CpuIsa CPU_Selected()
+{
+    if(cpu_forced < 0)
+    {
+        const char *name = getenv("MEANSHIFT_ISA");
+        CpuIsa isa;
+
+        if(name && CPU_ParseIsa(name, &isa))
+            CPU_Select(isa);
+        else
+            cpu_forced = CPU_Supported();
+    }
+    return (CpuIsa)cpu_forced;
+}
+
+/*! \brief Function CPU_ParseIsa parses the name of an instruction set
+*
+*  \param name scalar, avx2, avx512 or auto for the widest supported
+*  \param isa parsed instruction set
+*  \return false if the name is unknown
+*/
+bool CPU_ParseIsa(const char *name, CpuIsa *isa)
+{
+    if(strcmp(name, "auto") == 0)
+        *isa = CPU_Supported();
+    else if(strcmp(name, "scalar") == 0)
+        *isa = CPU_ISA_SCALAR;
+    else if(strcmp(name, "avx2") == 0)
+        *isa = CPU_ISA_AVX2;
+    else if(strcmp(name, "avx512") == 0)
+        *isa = CPU_ISA_AVX512;
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Function CPU_IsaName returns the name of an instruction set
+*
+*  \param isa instruction set
+*  \return name as parsed by CPU_ParseIsa
+*/
+const char *CPU_IsaName(CpuIsa isa)
+{
+    switch(isa)
+    {
+    case CPU_ISA_AVX512:
+        return "avx512";
+    case CPU_ISA_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+/*! \brief Function CPU_Kernels returns the kernels of an instruction set
+*
+*  \param isa instruction set, narrowed to the one of the processor
+*  \return table of the kernels
+*/
+const CPUKernels &CPU_Kernels(CpuIsa isa)
+{
+    isa = isa < CPU_Supported() ? isa : CPU_Supported();
+    if(isa == CPU_ISA_AVX512)
+        return CPU_KernelsAVX512;
+    if(isa == CPU_ISA_AVX2)
+        return CPU_KernelsAVX2;
+    return CPU_KernelsScalar;
+}
+
+/*! \brief Function CPU_Kernels returns the kernels of the selected instruction set
+*
+*  \return table of the kernels
+*/
+const CPUKernels &CPU_Kernels()
+{
+    return CPU_Kernels(CPU_Selected());
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+
+#include "../image/AlignedImage.h"
+
+
+/*Enumeration CpuIsa lists the instruction sets the hot kernels are compiled for, narrowest first */
+enum CpuIsa
+{
+    CPU_ISA_SCALAR,
+    CPU_ISA_AVX2,
+    CPU_ISA_AVX512      // AVX-512 F, BW and VL
+};
+
+/*Structure CPUKernels is the table of the kernels of one instruction set, see kernels.cpp */
+struct CPUKernels
+{
+    // n pixels of planar RGB to L*u*v, black pixels are left unchanged, the planes must not overlap
+    void (*rgb2luv)(const uchar *r, const uchar *g, const uchar *b, uchar *l, uchar *u, uchar *v, int n);
+
+    // n pixels of planar L*u*v to RGB, the planes must not overlap
+    void (*luv2rgb)(const uchar *l, const uchar *u, const uchar *v, uchar *r, uchar *g, uchar *b, int n);
+
+    // labels[k] = map[labels[k]] for n labels
+    void (*relabel)(int *labels, int n, const int *map);
+};
+
+// the widest instruction set of the processor, detected once
+CpuIsa CPU_Supported();
+
+// force an instruction set, narrowed to CPU_Supported()
+void CPU_Select(CpuIsa isa);
+
+// the forced instruction set, else the one of MEANSHIFT_ISA, else CPU_Supported()
+CpuIsa CPU_Selected();
+
+bool CPU_ParseIsa(const char *name, CpuIsa *isa);
+const char *CPU_IsaName(CpuIsa isa);
+
+// kernels of the instruction set, CPU_Selected() by default
+const CPUKernels &CPU_Kernels();
+const CPUKernels &CPU_Kernels(CpuIsa isa);
+
+// the variants of kernels.cpp
+extern const CPUKernels CPU_KernelsScalar;
+extern const CPUKernels CPU_KernelsAVX2;
+extern const CPUKernels CPU_KernelsAVX512;
+
+
+#endif /* CPU_H */
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cpu.h"
+#include "../image/colorspace.h"
+
+
+/**
+ * @file kernels.cpp
+ * @brief Kernels compiled once per instruction set
+ *
+ * The Makefile compiles this file three times, with CPU_ISA set to Scalar, AVX2 or AVX512 and
+ * the matching -m flags, into the tables CPU_KernelsScalar, CPU_KernelsAVX2 and CPU_KernelsAVX512.
+ * The loops are plain C++ vectorized by the compiler. Floating point contraction is disabled,
+ * so every variant computes the results of the scalar one bit for bit.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+#ifndef CPU_ISA
+#define CPU_ISA Scalar
+#endif
+
+#define CPU_NAME2(name, isa) name##isa
+#define CPU_NAME1(name, isa) CPU_NAME2(name, isa)
+#define CPU_NAME(name) CPU_NAME1(name, CPU_ISA)
+
+#define CPU_BLOCK 256                           // pixels of a vectorized loop and its scalar fix-up
+#define CPU_CUBE_ROOT_MARGIN 9.094947017729282e-13   // 2^-40, relative error bound of the fast L
+
+
+/*! \brief Function CubeRoot returns the cube root of y in (216 / 24389, 1] to two units in the last
+*  place of a double: y^(1/4) is within 4% of it, three Halley steps triple the correct digits
+*
+*  \param y argument
+*  \return cube root of y
+*/
+static inline double CPU_NAME(CubeRoot)(double y)
+{
+    double c = sqrt(sqrt(y));
+
+    for(int i = 0; i < 3; i++)
+    {
+        const double c3 = c * c * c;
+        c = c * (c3 + 2.0 * y) / (2.0 * c3 + y);
+    }
+    return c;
+}
+
+/*! \brief Function RGB2LUVBlock converts n pixels as RGB2LUV in colorspace.h, with the constants hoisted
+*  and pow replaced by CubeRoot, so that the loop has no call and no branch and is vectorized. L is
+*  the only value that can differ: pow and CubeRoot differ by a few units in the last place of a
+*  double, which changes the float L only if it lies within CPU_CUBE_ROOT_MARGIN of the middle of
+*  two floats. Those pixels are marked for RGB2LUV.
+*
+*  \param r, g, b planes of the RGB image
+*  \param l, u, v planes of the converted image, black pixels are left unchanged
+*  \param recheck set to 1 for the pixels whose L may differ, else to 0
+*  \param n number of pixels
+*/
+static __attribute__((noinline)) void CPU_NAME(RGB2LUVBlock)(const uchar *__restrict__ r, const uchar *__restrict__ g, const uchar *__restrict__ b,
+                                          uchar *__restrict__ l, uchar *__restrict__ u, uchar *__restrict__ v,
+                                          uchar *__restrict__ recheck, int n)
+{
+    const float eps = 216.0 / 24389.0;
+    const float k = 24389.0 / 27.0;
+    const float Xr = 0.964221;
+    const float Yr = 1.0;
+    const float Zr = 0.825211;
+    const float ur2 = 4.0 * Xr / (Xr + 15.0 * Yr + 3.0 * Zr);
+    const float vr2 = 9.0 * Yr / (Xr + 15.0 * Yr + 3.0 * Zr);
+
+    for(int i = 0; i < n; i++)
+    {
+        const int R = r[i], G = g[i], B = b[i];
+        float X = 0.412453 * R + 0.357580 * G + 0.180423 * B;
+        float Y = 0.212671 * R + 0.715160 * G + 0.072169 * B;
+        float Z = 0.019334 * R + 0.119193 * G + 0.950227 * B;
+
+        X /= 255.0;
+        Y /= 255.0;
+        Z /= 255.0;
+
+        const float u2 = 4.0 * X / (X + 15.0 * Y + 3.0 * Z);
+        const float v2 = 9.0 * Y / (X + 15.0 * Y + 3.0 * Z);
+        const float yr = Y / Yr;
+        const double L = 116.0 * CPU_NAME(CubeRoot)(yr) - 16.0;
+        const float L1 = yr > eps ? (float)L : k * yr;
+        const float u1 = 13.0 * L1 * (u2 - ur2);
+        const float v1 = 13.0 * L1 * (v2 - vr2);
+        const bool black = (X == 0.0) & (Y == 0.0) & (Z == 0.0);
+        const uchar l0 = l[i], u0 = u[i], v0 = v[i];
+
+        recheck[i] = (yr > eps) & ((float)(L - L * CPU_CUBE_ROOT_MARGIN) != (float)(L + L * CPU_CUBE_ROOT_MARGIN));
+        l[i] = black ? l0 : (uchar)((int)(L1 + 0.5) * 255 / 100);
+        u[i] = black ? u0 : (uchar)((int)(u1 + 0.5 + 134) * 255 / 354);
+        v[i] = black ? v0 : (uchar)((int)(v1 + 0.5 + 140) * 255 / 262);
+    }
+}
+
+/*! \brief Function RGB2LUV converts n pixels of planar RGB to L*u*v, black pixels are left unchanged.
+*  Blocks of pixels are converted by RGB2LUVBlock and the few marked pixels again by RGB2LUV, so the
+*  result is the one of RGB2LUV for every color; make check compares all 2^24 colors, 315 of them
+*  are marked.
+*
+*  \param r, g, b planes of the RGB image
+*  \param l, u, v planes of the converted image
+*  \param n number of pixels
+*/
+static void CPU_NAME(RGB2LUV)(const uchar *r, const uchar *g, const uchar *b, uchar *l, uchar *u, uchar *v, int n)
+{
+    uchar recheck[CPU_BLOCK];
+
+    for(int start = 0; start < n; start += CPU_BLOCK)
+    {
+        const int count = n - start < CPU_BLOCK ? n - start : CPU_BLOCK;
+
+        CPU_NAME(RGB2LUVBlock)(r + start, g + start, b + start, l + start, u + start, v + start, recheck, count);
+        for(int i = 0; i < count; i++)
+            if(recheck[i])
+                RGB2LUV(r[start + i], g[start + i], b[start + i], &l[start + i], &u[start + i], &v[start + i]);
+    }
+}
+
+/*! \brief Function LUV2RGB converts n pixels of planar L*u*v to RGB as LUV2RGB in colorspace.h, with
+*  the constants hoisted and the branches replaced by selects, so that the loop is vectorized. The
+*  operations and their types are the ones of LUV2RGB, so is every result, also of the divisions by
+*  zero of L = 0; make check compares all 2^24 inputs.
+*
+*  \param l, u, v planes of the L*u*v image
+*  \param r, g, b planes of the converted image
+*  \param n number of pixels
+*/
+static void CPU_NAME(LUV2RGB)(const uchar *__restrict__ l, const uchar *__restrict__ u, const uchar *__restrict__ v,
+                              uchar *__restrict__ r, uchar *__restrict__ g, uchar *__restrict__ b, int n)
+{
+    const float eps = 216.0 / 24389.0;
+    const float k = 24389.0 / 27.0;
+    const float Xr = 0.964221;
+    const float Yr = 1.0;
+    const float Zr = 0.825211;
+    const float u0 = 4.0 * Xr / (Xr + 15.0 * Yr + 3.0 * Zr);
+    const float v0 = 9.0 * Yr / (Xr + 15.0 * Yr + 3.0 * Zr);
+
+    for(int i = 0; i < n; i++)
+    {
+        const float L = (float)(l[i] * 100 / 255);
+        const float U = (float)(u[i] * 354 / 255 - 134);
+        const float V = (float)(v[i] * 262 / 255 - 140);
+        const float TEMP = (L + 16.0) / 116.0;
+        const float Y1 = L > k * eps ? TEMP * TEMP * TEMP : L / k;
+        const float ud = U / (13.0 * L) + u0;
+        const float vd = V / (13.0 * L) + v0;
+        const float X1 = (ud / vd) * Y1 * 9.0 / 4.0;
+        const float Z1 = (Y1 / vd - ((ud / vd) * Y1 / 4.0 + 15.0 * Y1 / 9.0)) * 3.0;
+        const bool black = (L == 0) & (U == 0) & (V == 0);
+        const float X = (black ? 0.0f : X1) * 255.0;
+        const float Y = (black ? 0.0f : Y1) * 255.0;
+        const float Z = (black ? 0.0f : Z1) * 255.0;
+
+        const int R = (int)(3.2404813432005 * X - 1.5371515162713 * Y - 0.49853632616889 * Z + 0.5);
+        const int G = (int)(-0.96925494999657 * X + 1.8759900014899 * Y + 0.041555926558293 * Z + 0.5);
+        const int B = (int)(0.055646639135177 * X - 0.20404133836651 * Y + 1.0573110696453 * Z + 0.5);
+
+        r[i] = R < 0 ? 0 : R > 255 ? 255 : R;
+        g[i] = G < 0 ? 0 : G > 255 ? 255 : G;
+        b[i] = B < 0 ? 0 : B > 255 ? 255 : B;
+    }
+}
+
+/*! \brief Function Relabel replaces every label by its entry of a map
+*
+*  \param labels n labels
+*  \param n number of labels
+*  \param map new label of every old label
+*/
+static void CPU_NAME(Relabel)(int *__restrict__ labels, int n, const int *__restrict__ map)
+{
+    for(int k = 0; k < n; k++)
+        labels[k] = map[labels[k]];
+}
+
+
+extern const CPUKernels CPU_NAME(CPU_Kernels) =
+{
+    CPU_NAME(RGB2LUV),
+    CPU_NAME(LUV2RGB),
+    CPU_NAME(Relabel)
+};
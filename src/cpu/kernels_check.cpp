@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <vector>
+#include "cpu.h"
+#include "../image/colorspace.h"
+
+
+/**
+ * @file kernels_check.cpp
+ * @brief Exhaustive comparison of the kernels of every instruction set with colorspace.h, run by make check
+ *
+ * The kernels of kernels.cpp promise the results of the scalar conversions of colorspace.h for every
+ * input. The program converts all 2^24 inputs with every instruction set the processor supports and
+ * counts the pixels which differ; it fails if any does.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+#define CHECK_INPUTS (1 << 24)  // every value of three 8 bit channels
+#define CHECK_UNSET 77          // initial value of the outputs, black pixels keep it in rgb2luv
+
+
+/*! \brief Function CheckInputs fills three planes with all 2^24 combinations of their values
+*
+*  \param a, b, c planes of CHECK_INPUTS bytes
+*/
+static void CheckInputs(std::vector<uchar> &a, std::vector<uchar> &b, std::vector<uchar> &c)
+{
+    for(int k = 0; k < CHECK_INPUTS; k++)
+    {
+        a[k] = (uchar)(k >> 16);
+        b[k] = (uchar)(k >> 8);
+        c[k] = (uchar)k;
+    }
+}
+
+/*! \brief Function CheckDiffer counts the pixels whose three planes differ
+*
+*  \param x, y, z planes of the result
+*  \param rx, ry, rz planes of the reference
+*  \return number of differing pixels
+*/
+static long CheckDiffer(const std::vector<uchar> &x, const std::vector<uchar> &y, const std::vector<uchar> &z,
+                        const std::vector<uchar> &rx, const std::vector<uchar> &ry, const std::vector<uchar> &rz)
+{
+    long count = 0;
+
+    for(int k = 0; k < CHECK_INPUTS; k++)
+        count += x[k] != rx[k] || y[k] != ry[k] || z[k] != rz[k];
+    return count;
+}
+
+/*! \brief Function CheckRGB2LUV compares rgb2luv of every instruction set with RGB2LUV
+*
+*  \return number of instruction sets whose result differs
+*/
+static int CheckRGB2LUV()
+{
+    std::vector<uchar> r(CHECK_INPUTS), g(CHECK_INPUTS), b(CHECK_INPUTS);
+    std::vector<uchar> rl(CHECK_INPUTS, CHECK_UNSET), ru(CHECK_INPUTS, CHECK_UNSET), rv(CHECK_INPUTS, CHECK_UNSET);
+    int failed = 0;
+
+    CheckInputs(r, g, b);
+    for(int k = 0; k < CHECK_INPUTS; k++)
+        RGB2LUV(r[k], g[k], b[k], &rl[k], &ru[k], &rv[k]);
+
+    for(int isa = CPU_ISA_SCALAR; isa <= CPU_Supported(); isa++)
+    {
+        std::vector<uchar> l(CHECK_INPUTS, CHECK_UNSET), u(CHECK_INPUTS, CHECK_UNSET), v(CHECK_INPUTS, CHECK_UNSET);
+
+        CPU_Kernels((CpuIsa)isa).rgb2luv(&r[0], &g[0], &b[0], &l[0], &u[0], &v[0], CHECK_INPUTS);
+        const long differ = CheckDiffer(l, u, v, rl, ru, rv);
+        printf("rgb2luv %s: %ld of %d colors differ from RGB2LUV\n", CPU_IsaName((CpuIsa)isa), differ, CHECK_INPUTS);
+        failed += differ != 0;
+    }
+    return failed;
+}
+
+/*! \brief Function CheckLUV2RGB compares luv2rgb of every instruction set with LUV2RGB
+*
+*  \return number of instruction sets whose result differs
+*/
+static int CheckLUV2RGB()
+{
+    std::vector<uchar> l(CHECK_INPUTS), u(CHECK_INPUTS), v(CHECK_INPUTS);
+    std::vector<uchar> rr(CHECK_INPUTS), rg(CHECK_INPUTS), rb(CHECK_INPUTS);
+    int failed = 0;
+
+    CheckInputs(l, u, v);
+    for(int k = 0; k < CHECK_INPUTS; k++)
+        LUV2RGB(l[k], u[k], v[k], &rr[k], &rg[k], &rb[k]);
+
+    for(int isa = CPU_ISA_SCALAR; isa <= CPU_Supported(); isa++)
+    {
+        std::vector<uchar> r(CHECK_INPUTS, CHECK_UNSET), g(CHECK_INPUTS, CHECK_UNSET), b(CHECK_INPUTS, CHECK_UNSET);
+
+        CPU_Kernels((CpuIsa)isa).luv2rgb(&l[0], &u[0], &v[0], &r[0], &g[0], &b[0], CHECK_INPUTS);
+        const long differ = CheckDiffer(r, g, b, rr, rg, rb);
+        printf("luv2rgb %s: %ld of %d inputs differ from LUV2RGB\n", CPU_IsaName((CpuIsa)isa), differ, CHECK_INPUTS);
+        failed += differ != 0;
+    }
+    return failed;
+}
+
+
+int main()
+{
+    const int failed = CheckRGB2LUV() + CheckLUV2RGB();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AlignedImage.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+
+/**
+ * @file AlignedImage.cpp
+ * @brief Image with aligned rows, border and planar or packed layout
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Constructor of an empty AlignedImage
+*/
+AlignedImage::AlignedImage()
+    : memory(NULL), owned(false), capacity(0), width(0), height(0), nchannel(0), border(0), stride(0), layout(IMAGE_PLANAR)
+{
+    planes[0] = planes[1] = planes[2] = planes[3] = NULL;
+}
+
+/*! \brief Constructor of AlignedImage allocates the image, see Allocate()
+*/
+AlignedImage::AlignedImage(int width, int height, int nchannel, ImageLayout layout, int border)
+    : memory(NULL), owned(false), capacity(0), width(0), height(0), nchannel(0), border(0), stride(0), layout(IMAGE_PLANAR)
+{
+    planes[0] = planes[1] = planes[2] = planes[3] = NULL;
+    Allocate(width, height, nchannel, layout, border);
+}
+
+/*! \brief Destructor of AlignedImage
+*/
+AlignedImage::~AlignedImage()
+{
+    Release();
+}
+
+/*! \brief Function Release frees the memory of the image if it is owned
+*/
+void AlignedImage::Release()
+{
+    if(owned)
+        free(memory);
+    memory = NULL;
+    owned = false;
+    capacity = 0;
+    planes[0] = planes[1] = planes[2] = planes[3] = NULL;
+    width = height = nchannel = border = stride = 0;
+}
+
+/*! \brief Function Allocate allocates the image initialized to zero.
+*
+*  Rows start at 64-byte boundaries. The packed layout stores L u v X for every pixel and
+*  requires three channels; X is set to 255 for the pixels inside the image. The allocation
+*  has 64 bytes of slack at the end, so vector loads of a full register starting inside the
+*  image never leave the buffer. Throws std::bad_alloc if the memory can not be allocated,
+*  the image is then empty.
+*
+*  \param width width of the image
+*  \param height height of the image
+*  \param nchannel number of image channels, at most 4 for planar and 3 for packed layout
+*  \param layout planar or packed
+*  \param border number of pixels around the image
+*/
+void AlignedImage::Allocate(int width, int height, int nchannel, ImageLayout layout, int border)
+{
+    Release();
+    Reshape(width, height, nchannel, layout, border);
+}
+
+/*! \brief Function Reshape lays out the image as Allocate does in the memory it owns, which is only
+*  replaced if it is too small. A sequence of images of different sizes costs no allocation once
+*  the largest one was seen.
+*
+*  \param width width of the image
+*  \param height height of the image
+*  \param nchannel number of image channels, at most 4 for planar and 3 for packed layout
+*  \param layout planar or packed
+*  \param border number of pixels around the image
+*/
+void AlignedImage::Reshape(int width, int height, int nchannel, ImageLayout layout, int border)
+{
+    if(layout == IMAGE_PACKED)
+        nchannel = 3;
+
+    int pixel_bytes = layout == IMAGE_PACKED ? IMAGE_PACKED_BYTES : 1;
+    int row_bytes = (width + 2 * border) * pixel_bytes;
+    int rows = height + 2 * border;
+    int nplanes = layout == IMAGE_PACKED ? 1 : nchannel;
+
+    this->width = width;
+    this->height = height;
+    this->nchannel = nchannel;
+    this->border = border;
+    this->layout = layout;
+    stride = (row_bytes + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+
+    size_t plane_bytes = (size_t)stride * rows;
+    size_t size = plane_bytes * nplanes + IMAGE_ALIGNMENT;
+    if(!owned || size > capacity)
+    {
+        if(owned)
+            free(memory);
+        memory = NULL;
+        owned = false;
+        void *p = NULL;
+        if(posix_memalign(&p, IMAGE_ALIGNMENT, size) != 0)
+        {
+            // left empty, as new[] would
+            Release();
+            throw std::bad_alloc();
+        }
+        memory = (uchar*)p;
+        owned = true;
+        capacity = size;
+    }
+    memset(memory, 0, size);
+
+    planes[0] = planes[1] = planes[2] = planes[3] = NULL;
+    // border pixels are to the left of the row start, so the aligned address is column -border
+    for(int c = 0; c < nplanes; c++)
+        planes[c] = memory + plane_bytes * c + (size_t)stride * border + border * pixel_bytes;
+
+    if(layout == IMAGE_PACKED)
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x++)
+                planes[0][y * stride + x * IMAGE_PACKED_BYTES + 3] = 255;
+}
+
+/*! \brief Function Wrap makes the image a view of a dense planar buffer as used by the
+*  functions in image.h. The buffer is not copied and not freed, rows are not aligned.
+*
+*  \param planar planar image
+*  \param width width of the image
+*  \param height height of the image
+*  \param nchannel number of image channels
+*/
+void AlignedImage::Wrap(uchar *planar, int width, int height, int nchannel)
+{
+    Release();
+
+    this->width = width;
+    this->height = height;
+    this->nchannel = nchannel;
+    layout = IMAGE_PLANAR;
+    stride = width;
+    memory = planar;
+    for(int c = 0; c < nchannel && c < 4; c++)
+        planes[c] = planar + (size_t)width * height * c;
+}
+
+/*! \brief Function CopyFromPlanar copies a dense planar buffer into the image
+*
+*  \param planar planar image with the size and number of channels of this image
+*/
+void AlignedImage::CopyFromPlanar(const uchar *planar)
+{
+    for(int c = 1; c <= nchannel; c++)
+    {
+        const uchar *src = planar + (size_t)width * height * (c - 1);
+        for(int y = 0; y < height; y++)
+        {
+            if(layout == IMAGE_PLANAR)
+                memcpy(planes[c - 1] + y * stride, src + y * width, width);
+            else
+                for(int x = 0; x < width; x++)
+                    Set(x, y, c, src[y * width + x]);
+        }
+    }
+}
+
+/*! \brief Function CopyToPlanar copies the image into a dense planar buffer
+*
+*  \param planar planar image with the size and number of channels of this image
+*/
+void AlignedImage::CopyToPlanar(uchar *planar) const
+{
+    for(int c = 1; c <= nchannel; c++)
+    {
+        uchar *dst = planar + (size_t)width * height * (c - 1);
+        for(int y = 0; y < height; y++)
+        {
+            if(layout == IMAGE_PLANAR)
+                memcpy(dst + y * width, planes[c - 1] + y * stride, width);
+            else
+                for(int x = 0; x < width; x++)
+                    dst[y * width + x] = Get(x, y, c);
+        }
+    }
+}
+
+/*! \brief Function CopyFrom copies the pixels of an image of the same size, the layouts can differ
+*
+*  \param image image to copy
+*/
+void AlignedImage::CopyFrom(const AlignedImage &image)
+{
+    for(int c = 1; c <= nchannel; c++)
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x++)
+                Set(x, y, c, image.Get(x, y, c));
+}
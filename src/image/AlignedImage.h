@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALIGNEDIMAGE_H
+#define ALIGNEDIMAGE_H
+
+
+#include <stddef.h>
+
+typedef unsigned char uchar;
+
+#define IMAGE_ALIGNMENT 64      // alignment of the rows in bytes
+#define IMAGE_PACKED_BYTES 4    // bytes of a packed L u v X pixel
+
+
+/*Enumeration ImageLayout selects how the channels of an AlignedImage are stored */
+enum ImageLayout
+{
+    IMAGE_PLANAR,   // one plane per channel, RRR..GGG..BBB
+    IMAGE_PACKED    // three channels and a flag byte per pixel, LUVX LUVX, X is 255 inside the image and 0 in the border
+};
+
+
+/*Class AlignedImage is an 8-bit image with 64-byte aligned rows and an optional border around the image.
+  Channels are numbered from 1 as in GetPixel and SetPixel. Pixels of the border can be read with
+  coordinates from -border to width + border - 1, they are zero. */
+class AlignedImage
+{
+public:
+    AlignedImage();
+    AlignedImage(int width, int height, int nchannel, ImageLayout layout = IMAGE_PLANAR, int border = 0);
+    ~AlignedImage();
+
+    void Allocate(int width, int height, int nchannel, ImageLayout layout = IMAGE_PLANAR, int border = 0);
+    void Reshape(int width, int height, int nchannel, ImageLayout layout = IMAGE_PLANAR, int border = 0);
+    void Wrap(uchar *planar, int width, int height, int nchannel);
+    void Release();
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    int Channels() const { return nchannel; }
+    int Border() const { return border; }
+    int Stride() const { return stride; }
+    ImageLayout Layout() const { return layout; }
+    bool IsPacked() const { return layout == IMAGE_PACKED; }
+
+    // Pixel (0, 0) of the channel of a planar image
+    uchar *Plane(int channel) { return planes[channel - 1]; }
+    const uchar *Plane(int channel) const { return planes[channel - 1]; }
+
+    // Pixel (0, 0) of a packed image
+    uchar *Origin() { return planes[0]; }
+    const uchar *Origin() const { return planes[0]; }
+
+    uchar Get(int x, int y, int channel) const
+    {
+        if(layout == IMAGE_PACKED)
+            return planes[0][y * stride + x * IMAGE_PACKED_BYTES + channel - 1];
+        return planes[channel - 1][y * stride + x];
+    }
+
+    void Set(int x, int y, int channel, uchar val)
+    {
+        if(layout == IMAGE_PACKED)
+            planes[0][y * stride + x * IMAGE_PACKED_BYTES + channel - 1] = val;
+        else
+            planes[channel - 1][y * stride + x] = val;
+    }
+
+    void CopyFromPlanar(const uchar *planar);
+    void CopyToPlanar(uchar *planar) const;
+    void CopyFrom(const AlignedImage &image);
+
+private:
+    uchar *memory;
+    bool owned;
+    size_t capacity;        // bytes of the owned memory
+    uchar *planes[4];
+    int width, height, nchannel, border, stride;
+    ImageLayout layout;
+
+    // not copyable
+    AlignedImage(const AlignedImage &);
+    AlignedImage &operator=(const AlignedImage &);
+};
+
+
+#endif /* ALIGNEDIMAGE_H */
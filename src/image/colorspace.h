@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLORSPACE_H
+#define COLORSPACE_H
+
+
+#include <cmath>
+#include "AlignedImage.h"
+
+
+/* The pixel conversions are inline, the image loops of image.cpp and the ISA variants of the
+   conversion in src/cpu/kernels.cpp are compiled from the same code. */
+
+/*! \brief Function RGB2LUV converts RGB pixel value to LUV pixel value.
+*
+*  \param r component of input image
+*  \param g component of input image
+*  \param b component of input image
+*  \param l component of output image   
+*  \param u component of output image
+*  \param v component of output image  0<=l<=100, −134<=u<=220, −140<=v<=122
+*/
+inline void RGB2LUV(float r, float g, float b, uchar *l, uchar *u, uchar *v)
+{
+   
+    float X, Y, Z;
+    int R,G,B;
+
+    R=(int)r;
+    G=(int)g;
+    B=(int)b;
+
+    X = 0.412453 * R + 0.357580 * G + 0.180423 * B;
+    Y = 0.212671 * R + 0.715160 * G + 0.072169 * B;
+    Z = 0.019334 * R + 0.119193 * G + 0.950227 * B;
+
+    X /= 255.0;
+    Y /= 255.0;
+    Z /= 255.0;
+
+
+    float L1, u1, v1, u2, v2, ur2, vr2, yr, eps, k;
+    eps = 216.0 / 24389.0;
+    k = 24389.0 / 27.0;
+
+    float Xr = 0.964221;
+    float Yr = 1.0;
+    float Zr = 0.825211;
+
+    u2 = 4.0 * X / (X + 15.0 * Y + 3.0 * Z);
+    v2 = 9.0 * Y / (X + 15.0 * Y + 3.0 * Z);
+
+    ur2 = 4.0 * Xr / (Xr + 15.0 * Yr + 3.0 * Zr);
+    vr2 = 9.0 * Yr / (Xr + 15.0 * Yr + 3.0 * Zr);
+
+    yr = Y / Yr;
+
+    if ( yr > eps )
+    {
+        L1 = (116.0 * pow(yr, 1.0 / 3.0) - 16.0);
+
+    }
+    else
+    {
+        L1 = k * yr;
+    }
+
+    u1 = 13.0 * (L1) * (u2 - ur2);
+    v1 = 13.0 * (L1) * (v2 - vr2);
+
+    if( X == 0.0 && Y == 0.0 && Z == 0.0)
+    {
+        L1 = 0;
+        u1 = 0;
+        v1 = 0;
+    }
+    else     // Convert component to 8-bit destination data type (0-255)
+    {
+        *l = (int)(L1 + 0.5) * 255 / 100;
+        *u = (int)(u1 + 0.5 + 134) * 255 / 354;
+        *v = (int)(v1 + 0.5 + 140) * 255 / 262;
+    }
+
+}
+
+/*! \brief Function LUV2RGB converts LUV pixel value to RGB pixel value.
+*
+*  \param L component of input image
+*  \param u component of input image
+*  \param v component of input image
+*  \param r component of output image
+*  \param g component of output image
+*  \param b component of output image
+*/
+inline void LUV2RGB(float L, float u, float v, uchar *R, uchar *G, uchar *B)
+{
+    int LL = (int)L;
+    int uu = (int)u;
+    int vv = (int)v;
+
+    L= (float)(LL * 100 / 255);
+    u= (float)((uu) * 354 / 255 - 134);
+    v= (float)((vv) * 262 / 255 - 140);
+
+
+    float X, Y, Z, ud, vd, u0, v0, TEMP, L1;
+    int r, g, b;
+    float eps = 216.0 / 24389.0;
+    float k = 24389.0 / 27.0;
+    float Xr = 0.964221;
+    float Yr = 1.0;
+    float Zr = 0.825211;
+
+    u0 = 4.0 * Xr / (Xr + 15.0 * Yr + 3.0 * Zr);
+    v0 = 9.0 * Yr / (Xr + 15.0 * Yr + 3.0 * Zr);
+    L1 = ((float)(L)) / 1.0;
+    if((float)(L1) > k * eps)
+    {
+        TEMP = (((float)(L1) + 16.0) / 116.0);
+        Y = TEMP * TEMP * TEMP;
+    }
+    else
+    {
+        Y = ((float)(L1)) / k;
+    }
+    if((L == 0) && (u == 0) && (v == 0))
+    {
+        X = 0;
+        Y = 0;
+        Z = 0;
+    }
+    else
+    {
+        ud = (u / (13.0 * L1) + u0);
+        vd = (v / (13.0 * L1) + v0);
+        X = (ud / vd) * Y * 9.0 / 4.0;
+        Z = (Y / vd - ((ud / vd) * Y / 4.0 + 15.0 * Y / 9.0)) * 3.0;
+    }
+
+    X *= 255.0;
+    Y *= 255.0;
+    Z *= 255.0;
+
+    r = (int)(3.2404813432005 * X - 1.5371515162713 * Y - 0.49853632616889 * Z + 0.5);
+    g = (int)(-0.96925494999657 * X + 1.8759900014899 * Y + 0.041555926558293 * Z + 0.5);
+    b = (int)(0.055646639135177 * X - 0.20404133836651 * Y + 1.0573110696453 * Z + 0.5);
+
+    *R = r < 0 ? 0 : r > 255 ? 255 : r;
+    *G = g < 0 ? 0 : g > 255 ? 255 : g;
+    *B = b < 0 ? 0 : b > 255 ? 255 : b;
+}
+
+
+#endif /* COLORSPACE_H */
@@ -11,7 +11,10 @@
  */
 
 #include "image.h"
+#include "colorspace.h"
+#include "../cpu/cpu.h"
 #include <cstdlib>
+#include <pthread.h>
 
 
 /**
@@ -67,6 +70,26 @@ vector<int> GenerateRandomNumbers(int count)
     return number;
 }
 
+/*! \brief Function GenerateRandomNumbers generates the first numbers of rand() after srand(seed), the
+*  ones of a new process for a seed of 1. Calls of several threads are serialized, so each of them gets
+*  its own sequence.
+*
+*  \param count - Count of numbers to be generated
+*  \param seed - seed of rand()
+*  \return number as vector<int>
+*/
+vector<int> GenerateRandomNumbers(int count, unsigned seed)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&lock);
+    srand(seed);
+    vector<int> number = GenerateRandomNumbers(count);
+    pthread_mutex_unlock(&lock);
+
+    return number;
+}
+
 /*! \brief Function LabelImage in RGB colors
 *
 *  \param image image to be labeled
@@ -77,8 +100,19 @@ vector<int> GenerateRandomNumbers(int count)
 */
 void LabelImage(uchar *image, int width, int height, int** labels,int regCount)
 {
-    vector<int> color = GenerateRandomNumbers(regCount);
+    LabelImage(image, width, height, labels, GenerateRandomNumbers(regCount));
+}
 
+/*! \brief Function LabelImage in the given RGB colors
+*
+*  \param image image to be labeled
+*  \param width width of the image
+*  \param height height of the image
+*  \param labels color labels
+*  \param color color of every label, red in the lowest byte
+*/
+void LabelImage(uchar *image, int width, int height, int** labels, const vector<int> &color)
+{
     for(int i = 0; i < height; i++)
     {
         for(int j = 0; j < width; j++)
@@ -92,144 +126,28 @@ void LabelImage(uchar *image, int width, int height, int** labels,int regCount)
     }
 }
 
-/*! \brief Function RGB2LUV converts RGB pixel value to LUV pixel value.
+/*! \brief Function LabelImage in RGB colors, for an AlignedImage
 *
-*  \param r component of input image
-*  \param g component of input image
-*  \param b component of input image
-*  \param l component of output image   
-*  \param u component of output image
-*  \param v component of output image  0<=l<=100, −134<=u<=220, −140<=v<=122
+*  \param image image to be labeled
+*  \param labels color labels
+*  \param regCount regions to be labeled
 */
-inline void RGB2LUV(float r, float g, float b, uchar *l, uchar *u, uchar *v)
+void LabelImage(AlignedImage &image, int** labels, int regCount)
 {
-   
-    float X, Y, Z;
-    int R,G,B;
-
-    R=(int)r;
-    G=(int)g;
-    B=(int)b;
-
-    X = 0.412453 * R + 0.357580 * G + 0.180423 * B;
-    Y = 0.212671 * R + 0.715160 * G + 0.072169 * B;
-    Z = 0.019334 * R + 0.119193 * G + 0.950227 * B;
-
-    X /= 255.0;
-    Y /= 255.0;
-    Z /= 255.0;
-
-
-    float L1, u1, v1, u2, v2, ur2, vr2, yr, eps, k;
-    eps = 216.0 / 24389.0;
-    k = 24389.0 / 27.0;
-
-    float Xr = 0.964221;
-    float Yr = 1.0;
-    float Zr = 0.825211;
-
-    u2 = 4.0 * X / (X + 15.0 * Y + 3.0 * Z);
-    v2 = 9.0 * Y / (X + 15.0 * Y + 3.0 * Z);
-
-    ur2 = 4.0 * Xr / (Xr + 15.0 * Yr + 3.0 * Zr);
-    vr2 = 9.0 * Yr / (Xr + 15.0 * Yr + 3.0 * Zr);
-
-    yr = Y / Yr;
-
-    if ( yr > eps )
-    {
-        L1 = (116.0 * pow(yr, 1.0 / 3.0) - 16.0);
-
-    }
-    else
-    {
-        L1 = k * yr;
-    }
-
-    u1 = 13.0 * (L1) * (u2 - ur2);
-    v1 = 13.0 * (L1) * (v2 - vr2);
+    vector<int> color = GenerateRandomNumbers(regCount);
 
-    if( X == 0.0 && Y == 0.0 && Z == 0.0)
+    for(int i = 0; i < image.Height(); i++)
     {
-        L1 = 0;
-        u1 = 0;
-        v1 = 0;
-    }
-    else     // Convert component to 8-bit destination data type (0-255)
-    {
-        *l = (int)(L1 + 0.5) * 255 / 100;
-        *u = (int)(u1 + 0.5 + 134) * 255 / 354;
-        *v = (int)(v1 + 0.5 + 140) * 255 / 262;
+        for(int j = 0; j < image.Width(); j++)
+        {
+            int label = labels[i][j];
+            image.Set(j, i, 1, (uchar)((color[label]) & 255));
+            image.Set(j, i, 2, (uchar)((color[label] >> 8) & 255));
+            image.Set(j, i, 3, (uchar)((color[label] >> 16) & 255));
+        }
     }
-
 }
 
-/*! \brief Function LUV2RGB converts LUV pixel value to RGB pixel value.
-*
-*  \param L component of input image
-*  \param u component of input image
-*  \param v component of input image
-*  \param r component of output image
-*  \param g component of output image
-*  \param b component of output image
-*/
-inline void LUV2RGB(float L, float u, float v, uchar *R, uchar *G, uchar *B)
-{
-    int LL = (int)L;
-    int uu = (int)u;
-    int vv = (int)v;
-
-    L= (float)(LL * 100 / 255);
-    u= (float)((uu) * 354 / 255 - 134);
-    v= (float)((vv) * 262 / 255 - 140);
-
-
-    float X, Y, Z, ud, vd, u0, v0, TEMP, L1;
-    int r, g, b;
-    float eps = 216.0 / 24389.0;
-    float k = 24389.0 / 27.0;
-    float Xr = 0.964221;
-    float Yr = 1.0;
-    float Zr = 0.825211;
-
-    u0 = 4.0 * Xr / (Xr + 15.0 * Yr + 3.0 * Zr);
-    v0 = 9.0 * Yr / (Xr + 15.0 * Yr + 3.0 * Zr);
-    L1 = ((float)(L)) / 1.0;
-    if((float)(L1) > k * eps)
-    {
-        TEMP = (((float)(L1) + 16.0) / 116.0);
-        Y = TEMP * TEMP * TEMP;
-    }
-    else
-    {
-        Y = ((float)(L1)) / k;
-    }
-    if((L == 0) && (u == 0) && (v == 0))
-    {
-        X = 0;
-        Y = 0;
-        Z = 0;
-    }
-    else
-    {
-        ud = (u / (13.0 * L1) + u0);
-        vd = (v / (13.0 * L1) + v0);
-        X = (ud / vd) * Y * 9.0 / 4.0;
-        Z = (Y / vd - ((ud / vd) * Y / 4.0 + 15.0 * Y / 9.0)) * 3.0;
-    }
-
-    X *= 255.0;
-    Y *= 255.0;
-    Z *= 255.0;
-
-    r = (int)(3.2404813432005 * X - 1.5371515162713 * Y - 0.49853632616889 * Z + 0.5);
-    g = (int)(-0.96925494999657 * X + 1.8759900014899 * Y + 0.041555926558293 * Z + 0.5);
-    b = (int)(0.055646639135177 * X - 0.20404133836651 * Y + 1.0573110696453 * Z + 0.5);
-
-    *R = r < 0 ? 0 : r > 255 ? 255 : r;
-    *G = g < 0 ? 0 : g > 255 ? 255 : g;
-    *B = b < 0 ? 0 : b > 255 ? 255 : b;
-}
 
 
 /*! \brief Function ConvertRGB2LUV convert RGB image to  LUV
@@ -243,19 +161,10 @@ inline void LUV2RGB(float L, float u, float v, uchar *R, uchar *G, uchar *B)
 uchar * ConvertRGB2LUV(uchar * rgb, int width, int height, int nchannel)
 {
     uchar *luv = AllocateUcharImage(width,height,nchannel);
+    const int size = width * height;
 
-    for(int i = 0; i < height; i++)
-    {
-        for(int j = 0; j < width; j++)
-        {
-            int index_R = i * width + j;
-            int index_G = height * width + i * width + j;
-            int index_B = 2 * height * width + i * width + j;
-
-            RGB2LUV(rgb[index_R], rgb[index_G], rgb[index_B], &luv[index_R], &luv[index_G], &luv[index_B]);
-
-        }
-    }
+    // the planes are contiguous, one call of the kernel of the selected instruction set
+    CPU_Kernels().rgb2luv(rgb, rgb + size, rgb + 2 * size, luv, luv + size, luv + 2 * size, size);
 
     return luv;
 
@@ -273,49 +182,55 @@ uchar * ConvertRGB2LUV(uchar * rgb, int width, int height, int nchannel)
 uchar * ConvertLUV2RGB(uchar * luv, int width, int height, int nchannel)
 {
     uchar *rgb = AllocateUcharImage(width, height, nchannel);
+    const int size = width * height;
 
-    for(int i = 0; i < height; i++)
-    {
-        for(int j = 0; j < width; j++)
-        {
-            int index_L = i * width + j;
-            int index_U = height * width + i * width + j;
-            int index_V = 2  * height * width + i * width + j;
-
-            LUV2RGB(luv[index_L], luv[index_U], luv[index_V], &rgb[index_L], &rgb[index_U], &rgb[index_V]);
-        }
-    }
+    CPU_Kernels().luv2rgb(luv, luv + size, luv + 2 * size, rgb, rgb + size, rgb + 2 * size, size);
     return rgb;
 
 }
 
-/*! \brief Set Pixel at channel component of image at postition given with x and y
+/*! \brief Function ConvertRGB2LUV convert RGB image to LUV, for AlignedImage.
+*  Both images have the same size, their layouts and borders can differ.
 *
-*  \param im image to convert
-*  \param width width of the image
-*  \param height height of the image
-*  \param x x position in the image
-*  \param y y position in the image
-*  \param val value to set at pixel location
-*  \param nchannel number of image channels
+*  \param rgb RGB image to convert
+*  \param luv the converted image
 */
-void SetPixel(uchar *im, int width, int height, int x, int y, const uchar val, int nchannel)
+void ConvertRGB2LUV(const AlignedImage &rgb, AlignedImage &luv)
 {
-    *(im + (nchannel - 1) * height * width + y * width + x) = val;
+    for(int i = 0; i < rgb.Height(); i++)
+    {
+        for(int j = 0; j < rgb.Width(); j++)
+        {
+            uchar l = 0, u = 0, v = 0;   // black stays zero
+
+            RGB2LUV(rgb.Get(j, i, 1), rgb.Get(j, i, 2), rgb.Get(j, i, 3), &l, &u, &v);
+            luv.Set(j, i, 1, l);
+            luv.Set(j, i, 2, u);
+            luv.Set(j, i, 3, v);
+        }
+    }
 }
 
-/*! \brief Get Pixel at channel component of image at postition given with x and y
-*  \param im image to convert
-*  \param width width of the image
-*  \param height height of the image
-*  \param x x position in the image   0 < x < width
-*  \param y y position in the image   0 < y < height
-*  \param nchannel number of image channels
-*  \return pixel value
+/*! \brief Function ConvertLUV2RGB converts LUV image to RGB, for AlignedImage.
+*  Both images have the same size, their layouts and borders can differ.
+*
+*  \param luv LUV image to convert
+*  \param rgb the converted image
 */
-uchar GetPixel(uchar *im, int width, int height, int x, int y, int nchannel)
+void ConvertLUV2RGB(const AlignedImage &luv, AlignedImage &rgb)
 {
-    return *(im + (nchannel - 1) * height * width + y * width + x);
+    for(int i = 0; i < luv.Height(); i++)
+    {
+        for(int j = 0; j < luv.Width(); j++)
+        {
+            uchar r, g, b;
+
+            LUV2RGB(luv.Get(j, i, 1), luv.Get(j, i, 2), luv.Get(j, i, 3), &r, &g, &b);
+            rgb.Set(j, i, 1, r);
+            rgb.Set(j, i, 2, g);
+            rgb.Set(j, i, 3, b);
+        }
+    }
 }
 
 /*! \brief Function range_distance calculate range distance between two pixels
@@ -17,21 +17,53 @@
 #include <cmath>
 #include <vector>
 #include <iostream>
+#include "AlignedImage.h"
 
 using namespace std;
 
-typedef unsigned char uchar;
-
 uchar *AllocateUcharImage(int width, int height, int nchannel);
-uchar GetPixel(uchar *im, int width, int height, int x, int y, int channel);
-void SetPixel(uchar *im, int width, int height, int x, int y, const uchar val, int channel);
 int** GenerateLabels(size_t width, size_t height);
 void LabelImage(uchar *res, int width, int height, int** labels, int regCount);
+void LabelImage(uchar *res, int width, int height, int** labels, const std::vector<int> &color);
+void LabelImage(AlignedImage &image, int** labels, int regCount);
 int range_distance(uchar* image, int width, int height, int x1, int y1, int x2, int y2 );
 uchar *ConvertRGB2LUV(uchar * input, int width, int height, int nchannel);
 uchar *ConvertLUV2RGB(uchar * origin, int width, int height, int nchannel);
+void ConvertRGB2LUV(const AlignedImage &rgb, AlignedImage &luv);
+void ConvertLUV2RGB(const AlignedImage &luv, AlignedImage &rgb);
 float color_distance( const float* a, const float* b);
 std::vector<int> GenerateRandomNumbers(int num);
+std::vector<int> GenerateRandomNumbers(int num, unsigned seed);
+
+
+/*! \brief Set Pixel at channel component of image at postition given with x and y
+*
+*  \param im image to convert
+*  \param width width of the image
+*  \param height height of the image
+*  \param x x position in the image
+*  \param y y position in the image
+*  \param val value to set at pixel location
+*  \param nchannel number of image channels
+*/
+inline void SetPixel(uchar *im, int width, int height, int x, int y, const uchar val, int nchannel)
+{
+    *(im + (nchannel - 1) * height * width + y * width + x) = val;
+}
+
+/*! \brief Get Pixel at channel component of image at postition given with x and y
+*  \param im image to convert
+*  \param width width of the image
+*  \param height height of the image
+*  \param x x position in the image   0 < x < width
+*  \param y y position in the image   0 < y < height
+*  \param nchannel number of image channels
+*  \return pixel value
+*/
+inline uchar GetPixel(const uchar *im, int width, int height, int x, int y, int nchannel)
+{
+    return *(im + (nchannel - 1) * height * width + y * width + x);
+}
 
 
 #endif /* IMAGE_H */
@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ImageFile.h"
+#include "../cpu/cpu.h"
+#include "../io_png/io_png.h"
+#include "../parallel/ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/**
+ * @file ImageFile.cpp
+ * @brief Uncompressed image files mapped into memory
+ *
+ * Besides PNG the programs read and write binary PPM (P6), PAM (P7) and a raw planar format of
+ * RGB or L*u*v, whose 64 byte text header "MSPLANAR RGB width height" or "MSPLANAR LUV width
+ * height", padded with spaces and ended by a newline, is followed by the three planes. The files
+ * are mapped instead of read: the planes of a raw planar input are passed to the filter where
+ * they are in the page cache, PPM and PAM are deinterleaved straight from the mapping, and the
+ * output is written into a mapped file of its final size. The filter asks for L*u*v: every
+ * decoded row, of a PNG file as libpng delivers it or of a mapped file, is deinterleaved and
+ * converted into the L*u*v planes at once, so no planar RGB image is made. Raw planar L*u*v skips the color
+ * conversions on both ends. Output formats are chosen by the extension: .ppm, .pam, .rgb, .luv,
+ * PNG otherwise; input formats by the first bytes of the file. A PNG file written on several threads
+ * is cut into strips of about IMAGE_FILE_STRIP_BYTES, converted, filtered and deflated on their own
+ * and stitched into one stream.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function Open maps a file copy-on-write
+*
+*  \param filename name of the file
+*  \return false if the file can not be mapped, e.g. a pipe or an empty file
+*/
+bool MappedFile::Open(const char *filename)
+{
+    struct stat info;
+    int fd = open(filename, O_RDONLY);
+
+    Close();
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void *map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED)
+        {
+            data = (uchar *)map;
+            size = info.st_size;
+        }
+    }
+    close(fd);
+    return data != NULL;
+}
+
+/*! \brief Function Create creates a file of the given size and maps it shared
+*
+*  \param filename name of the file
+*  \param size size of the file in bytes
+*  \return false if the file can not be created
+*/
+bool MappedFile::Create(const char *filename, size_t size)
+{
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+    Close();
+    if(fd < 0)
+        return false;
+    if(ftruncate(fd, size) == 0)
+    {
+        void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(map != MAP_FAILED)
+        {
+            data = (uchar *)map;
+            this->size = size;
+        }
+    }
+    close(fd);
+    return data != NULL;
+}
+
+/*! \brief Function Close unmaps the file, a created file keeps what was written
+*
+*  \return false if the file can not be unmapped
+*/
+bool MappedFile::Close()
+{
+    bool ok = true;
+
+    if(data)
+        ok = munmap(data, size) == 0;
+    data = NULL;
+    size = 0;
+    return ok;
+}
+
+/*! \brief Function Drop takes the pages of a range out of the memory of the process. A created file
+*  keeps what was written and the pages of an opened file are read again if they are touched, unless
+*  they were changed; the partial page at the end of the range stays.
+*
+*  \param from first byte of the range
+*  \param to end of the range
+*/
+void MappedFile::Drop(size_t from, size_t to)
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    from -= from % page;
+    to = std::min(to, size);
+    to -= to % page;
+    if(data && to > from)
+        madvise(data + from, to - from, MADV_DONTNEED);
+}
+
+
+/*! \brief Function ImageFile_Number reads a decimal number of a PNM header, after white space and
+*  comments
+*
+*  \param p position in the header, moved after the number
+*  \param end end of the file
+*  \param value the number
+*  \return false if there is no number
+*/
+static bool ImageFile_Number(const uchar *&p, const uchar *end, int *value)
+{
+    while(p < end && (isspace(*p) || *p == '#'))
+    {
+        if(*p == '#')
+            while(p < end && *p != '\n')
+                p++;
+        else
+            p++;
+    }
+    if(p == end || !isdigit(*p))
+        return false;
+    for(*value = 0; p < end && isdigit(*p) && *value < 1000000; p++)
+        *value = 10 * *value + (*p - '0');
+    return true;
+}
+
+/*! \brief Function ImageFile_Token reads the next word of a PAM header, after white space and comments
+*
+*  \param p position in the header, moved after the word
+*  \param end end of the file
+*  \return the word, empty at the end of the file
+*/
+static std::string ImageFile_Token(const uchar *&p, const uchar *end)
+{
+    while(p < end && (isspace(*p) || *p == '#'))
+    {
+        if(*p == '#')
+            while(p < end && *p != '\n')
+                p++;
+        else
+            p++;
+    }
+    const uchar *start = p;
+    while(p < end && !isspace(*p))
+        p++;
+    return std::string((const char *)start, p - start);
+}
+
+/*! \brief Function Allocate allocates the planes of a decoded image, zero so that black stays zero
+*
+*  \return false if the buffer can not be allocated
+*/
+bool InputImage::Allocate()
+{
+    decoded = (uchar *)calloc(3 * (size_t)width * height, 1);
+    pixels = decoded;
+    planes.resize(3 * width);
+    return decoded != NULL;
+}
+
+/*! \brief Function StoreRow deinterleaves a decoded row into the planes, converted to L*u*v if asked
+*  for; gray is replicated and alpha is dropped
+*
+*  \param y row of the image
+*  \param data width pixels of depth bytes
+*  \param depth channels of a pixel, 1 to 4
+*/
+void InputImage::StoreRow(int y, const uchar *data, int depth)
+{
+    const size_t size = (size_t)width * height, k = (size_t)y * width;
+    const bool gray = depth < 3;
+    uchar *r = decoded + k, *g = r + size, *b = g + size;
+
+    if(luv)
+    {
+        // the RGB row exists only here
+        r = &planes[0];
+        g = r + width;
+        b = g + width;
+    }
+    for(int x = 0; x < width; x++, data += depth)
+    {
+        r[x] = data[0];
+        g[x] = data[gray ? 0 : 1];
+        b[x] = data[gray ? 0 : 2];
+    }
+    if(luv)
+        CPU_Kernels().rgb2luv(r, g, b, decoded + k, decoded + size + k, decoded + 2 * size + k, width);
+}
+
+/*! \brief Function OpenPng decodes a PNG file row by row, see io_png_read_open_u8_rgb
+*
+*  \param filename name of the file, "-" for the standard input
+*  \return false if the file can not be read
+*/
+bool InputImage::OpenPng(const char *filename)
+{
+    size_t nx, ny;
+    io_png_reader *reader = io_png_read_open_u8_rgb(filename, &nx, &ny);
+
+    format = IMAGE_FILE_PNG;
+    if(!reader)
+    {
+        // palette files, as io_png_read_u8_rgb reads them
+        if(!(decoded = io_png_read_u8_rgb(filename, &nx, &ny)))
+            return false;
+        width = nx;
+        height = ny;
+        pixels = decoded;
+        if(luv)
+        {
+            uchar *rgb = decoded;
+            const int size = width * height;
+            bool ok = Allocate();
+            if(ok)
+                CPU_Kernels().rgb2luv(rgb, rgb + size, rgb + 2 * size, decoded, decoded + size, decoded + 2 * size, size);
+            free(rgb);
+            return ok;
+        }
+        return true;
+    }
+
+    width = nx;
+    height = ny;
+    std::vector<uchar> row(3 * nx);
+    bool ok = Allocate();
+    for(int y = 0; ok && y < height; y++)
+    {
+        ok = io_png_read_rows(reader, &row[0], 1) == 0;
+        StoreRow(y, &row[0], 3);
+    }
+    io_png_read_close(reader);
+    return ok;
+}
+
+/*! \brief Function Open reads an image file, the format is found from its first bytes
+*
+*  \param filename name of the file, "-" for a PNG image on the standard input
+*  \param to_luv convert RGB images to L*u*v while they are decoded, the planar RGB image never exists
+*  \return false if the file can not be read or has an unknown format
+*/
+bool InputImage::Open(const char *filename, bool to_luv)
+{
+    Release();
+    luv = to_luv;
+
+    if(!file.Open(filename) || (file.Size() >= 4 && memcmp(file.Data(), "\x89PNG", 4) == 0))
+    {
+        // PNG is decoded by libpng
+        file.Close();
+        return OpenPng(filename);
+    }
+
+    ImageFileLayout layout;
+    if(!ParseImageHeader(file.Data(), file.Size(), &layout))
+        return false;
+    format = layout.format;
+    width = layout.width;
+    height = layout.height;
+    uchar *mapped = file.Data() + layout.offset;
+
+    if(format == IMAGE_FILE_RAW_RGB || format == IMAGE_FILE_RAW_LUV)
+    {
+        if(format == IMAGE_FILE_RAW_LUV || !luv)
+        {
+            // the planes are used where they are mapped
+            luv = format == IMAGE_FILE_RAW_LUV;
+            pixels = mapped;
+            return true;
+        }
+        const int size = width * height;
+        bool ok = Allocate();
+        if(ok)
+            CPU_Kernels().rgb2luv(mapped, mapped + size, mapped + 2 * size, decoded, decoded + size, decoded + 2 * size, size);
+        file.Close();
+        return ok;
+    }
+
+    // deinterleaved straight from the mapping
+    bool ok = Allocate();
+    for(int y = 0; ok && y < height; y++)
+        StoreRow(y, mapped + (size_t)layout.depth * width * y, layout.depth);
+    file.Close();
+    return ok;
+}
+
+/*! \brief Function Release frees the image and unmaps the file */
+void InputImage::Release()
+{
+    file.Close();
+    free(decoded);
+    decoded = NULL;
+    pixels = NULL;
+    width = height = 0;
+    luv = false;
+}
+
+
+/*! \brief Function ImageFileFormatOf returns the format of an output file from its extension
+*
+*  \param filename name of the file
+*  \return format, PNG for an unknown extension
+*/
+ImageFileFormat ImageFileFormatOf(const char *filename)
+{
+    const char *dot = strrchr(filename, '.');
+
+    if(!dot)
+        return IMAGE_FILE_PNG;
+    if(strcmp(dot, ".ppm") == 0)
+        return IMAGE_FILE_PPM;
+    if(strcmp(dot, ".pam") == 0)
+        return IMAGE_FILE_PAM;
+    if(strcmp(dot, ".rgb") == 0)
+        return IMAGE_FILE_RAW_RGB;
+    if(strcmp(dot, ".luv") == 0)
+        return IMAGE_FILE_RAW_LUV;
+    return IMAGE_FILE_PNG;
+}
+
+/*! \brief Function ParsePngCompression parses the compression of the written PNG files: default, fast,
+*  store or a zlib level from 0 to 9, with the default filters
+*
+*  \param name name of the preset or level
+*  \param options parsed settings, the filters are kept for a level
+*  \return false if the name is unknown
+*/
+bool ParsePngCompression(const char *name, io_png_options *options)
+{
+    if(strcmp(name, "default") == 0)
+        io_png_options_preset(options, IO_PNG_PRESET_DEFAULT);
+    else if(strcmp(name, "fast") == 0)
+        io_png_options_preset(options, IO_PNG_PRESET_FAST);
+    else if(strcmp(name, "store") == 0)
+        io_png_options_preset(options, IO_PNG_PRESET_STORE);
+    else if(isdigit((uchar)name[0]) && name[1] == 0)
+    {
+        options->level = name[0] - '0';
+        options->strategy = -1;
+    }
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Function ParsePngFilter parses the row filter of the written PNG files: none, sub, up, average,
+*  paeth, or all for the best of them in every row
+*
+*  \param name name of the filter
+*  \param options parsed settings
+*  \return false if the name is unknown
+*/
+bool ParsePngFilter(const char *name, io_png_options *options)
+{
+    static const char *const names[] = {"none", "sub", "up", "average", "paeth"};
+
+    if(strcmp(name, "all") == 0)
+    {
+        options->filters = IO_PNG_FILTER_ALL;
+        return true;
+    }
+    for(int k = 0; k < 5; k++)
+        if(strcmp(name, names[k]) == 0)
+        {
+            options->filters = IO_PNG_FILTER_NONE << k;
+            return true;
+        }
+    return false;
+}
+
+/*! \brief Function IsPngFile tells if a file starts with the PNG signature
+*
+*  \param filename name of the file, "-" for the standard input, which is taken as PNG
+*  \return true for a PNG file
+*/
+bool IsPngFile(const char *filename)
+{
+    unsigned char signature[4];
+
+    if(strcmp(filename, "-") == 0)
+        return true;
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+        return false;
+    bool png = fread(signature, 1, 4, file) == 4 && memcmp(signature, "\x89PNG", 4) == 0;
+    fclose(file);
+    return png;
+}
+
+/*! \brief Function ParseImageHeader reads the header of a PPM, PAM or raw planar file and checks
+*  that the file holds all its pixels
+*
+*  \param data first bytes of the file, the whole file
+*  \param size size of the file
+*  \param layout format, size and position of the pixels
+*  \return false for another or a broken format, or PPM and PAM samples other than 8 bit
+*/
+bool ParseImageHeader(const uchar *data, size_t size, ImageFileLayout *layout)
+{
+    const uchar *p = data, *end = data + size;
+    int width = 0, height = 0, maxval = 0, depth = 3;
+
+    if(size >= IMAGE_FILE_HEADER && memcmp(p, IMAGE_FILE_MAGIC, strlen(IMAGE_FILE_MAGIC)) == 0)
+    {
+        char header[IMAGE_FILE_HEADER + 1], color[4];
+        memcpy(header, p, IMAGE_FILE_HEADER);
+        header[IMAGE_FILE_HEADER] = 0;
+        if(sscanf(header, IMAGE_FILE_MAGIC " %3s %d %d", color, &width, &height) != 3
+                || (strcmp(color, "RGB") && strcmp(color, "LUV")) || width <= 0 || height <= 0
+                || size < IMAGE_FILE_HEADER + 3 * (size_t)width * height)
+            return false;
+        layout->format = strcmp(color, "LUV") ? IMAGE_FILE_RAW_RGB : IMAGE_FILE_RAW_LUV;
+        layout->width = width;
+        layout->height = height;
+        layout->depth = 3;
+        layout->offset = IMAGE_FILE_HEADER;
+        return true;
+    }
+    else if(size >= 2 && p[0] == 'P' && p[1] == '6')
+    {
+        layout->format = IMAGE_FILE_PPM;
+        p += 2;
+        if(!ImageFile_Number(p, end, &width) || !ImageFile_Number(p, end, &height) || !ImageFile_Number(p, end, &maxval))
+            return false;
+        p++;    // a single white space ends the header
+    }
+    else if(size >= 2 && p[0] == 'P' && p[1] == '7')
+    {
+        layout->format = IMAGE_FILE_PAM;
+        p += 2;
+        depth = 0;
+        for(std::string key = ImageFile_Token(p, end); key != "ENDHDR"; key = ImageFile_Token(p, end))
+        {
+            if(key.empty())
+                return false;
+            else if(key == "WIDTH")
+                ImageFile_Number(p, end, &width);
+            else if(key == "HEIGHT")
+                ImageFile_Number(p, end, &height);
+            else if(key == "DEPTH")
+                ImageFile_Number(p, end, &depth);
+            else if(key == "MAXVAL")
+                ImageFile_Number(p, end, &maxval);
+            else if(key == "TUPLTYPE")
+                ImageFile_Token(p, end);
+        }
+        p++;    // newline after ENDHDR
+    }
+    else
+        return false;
+
+    // only 8 bit samples
+    if(width <= 0 || height <= 0 || maxval != 255 || depth < 1 || depth > 4
+            || p > end || (size_t)(end - p) < (size_t)depth * width * height)
+        return false;
+    layout->width = width;
+    layout->height = height;
+    layout->depth = depth;
+    layout->offset = p - data;
+    return true;
+}
+
+/*! \brief Function MakeImageHeader writes the header of a PPM, PAM or raw planar file
+*
+*  \param header 2 * IMAGE_FILE_HEADER bytes, the header ends with a zero
+*  \param format format of the file other than PNG
+*  \param width width of the image
+*  \param height height of the image
+*  \return bytes of the header before the pixels
+*/
+size_t MakeImageHeader(char *header, ImageFileFormat format, int width, int height)
+{
+    if(format == IMAGE_FILE_PPM)
+        sprintf(header, "P6\n%d %d\n255\n", width, height);
+    else if(format == IMAGE_FILE_PAM)
+        sprintf(header, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n", width, height);
+    else
+    {
+        // padded, the planes start at an aligned offset
+        memset(header, ' ', IMAGE_FILE_HEADER);
+        int length = sprintf(header, IMAGE_FILE_MAGIC " %s %d %d", format == IMAGE_FILE_RAW_LUV ? "LUV" : "RGB", width, height);
+        header[length] = ' ';
+        header[IMAGE_FILE_HEADER - 1] = '\n';
+        header[IMAGE_FILE_HEADER] = 0;
+    }
+    return strlen(header);
+}
+
+/*! \brief Function ImageFile_InterleaveRow interleaves a row of a planar image, converted to RGB
+*
+*  \param planar 3 planes of width * height bytes
+*  \param width width of the image
+*  \param height height of the image
+*  \param y row
+*  \param luv the planes are L*u*v instead of RGB
+*  \param planes 3 * width bytes for the conversion
+*  \param rgb 3 * width bytes of the interleaved row
+*/
+static void ImageFile_InterleaveRow(const uchar *planar, int width, int height, int y, bool luv, uchar *planes, uchar *rgb)
+{
+    const size_t size = (size_t)width * height;
+    const size_t k = (size_t)y * width;
+    const uchar *r = planar + k, *g = planar + size + k, *b = planar + 2 * size + k;
+
+    if(luv)
+    {
+        CPU_Kernels().luv2rgb(r, g, b, planes, planes + width, planes + 2 * width, width);
+        r = planes;
+        g = planes + width;
+        b = planes + 2 * width;
+    }
+    for(int x = 0; x < width; x++, rgb += 3)
+    {
+        rgb[0] = r[x];
+        rgb[1] = g[x];
+        rgb[2] = b[x];
+    }
+}
+
+/*Class ImageFilePngStrips converts, filters and deflates one strip of a PNG file per task */
+class ImageFilePngStrips : public ParallelTask
+{
+public:
+    const uchar *planar;
+    int width, height;
+    bool luv;
+    int strip_rows;
+    const io_png_options *options;
+    std::vector<io_png_strip> strips;
+    std::vector<int> status;    // result of io_png_deflate_strip of every strip
+
+    void Execute(int task, int)
+    {
+        const int y0 = task * strip_rows;
+        const int y1 = std::min(height, y0 + strip_rows);
+        const int from = y0 > 0 ? y0 - 1 : 0;     // the row above is needed by the filters
+        const size_t bytes = (size_t)3 * width;
+        std::vector<uchar> rgb(bytes * (y1 - from)), planes(bytes);
+
+        for(int y = from; y < y1; y++)
+            ImageFile_InterleaveRow(planar, width, height, y, luv, &planes[0], &rgb[bytes * (y - from)]);
+        status[task] = io_png_deflate_strip(y0 > 0 ? &rgb[0] : NULL, &rgb[bytes * (y0 - from)], width, 3, y1 - y0,
+                                            y1 == height, options, &strips[task]);
+    }
+};
+
+/*! \brief Function ImageFile_WritePngStrips writes a PNG file whose strips are deflated on a thread pool
+*
+*  \param filename name of the file
+*  \param planar 3 planes of width * height bytes
+*  \param width width of the image
+*  \param height height of the image
+*  \param luv the planes are L*u*v instead of RGB
+*  \param options compression of the file, NULL for the defaults; the file is not interlaced
+*  \param pool workers deflating the strips
+*  \return false if the file can not be written
+*/
+static bool ImageFile_WritePngStrips(const char *filename, const uchar *planar, int width, int height, bool luv,
+                                     const io_png_options *options, ThreadPool &pool)
+{
+    ImageFilePngStrips task;
+    task.planar = planar;
+    task.width = width;
+    task.height = height;
+    task.luv = luv;
+    task.strip_rows = std::max(1, IMAGE_FILE_STRIP_BYTES / (3 * width + 1));
+    task.options = options;
+
+    const int count = (height + task.strip_rows - 1) / task.strip_rows;
+    task.strips.resize(count);
+    task.status.resize(count, -1);
+    pool.Run(task, count);
+
+    bool ok = true;
+    for(int k = 0; k < count; k++)
+        ok = ok && task.status[k] == 0;
+    ok = ok && io_png_write_strips(filename, width, height, 3, &task.strips[0], count) == 0;
+    for(int k = 0; k < count; k++)
+        free(task.strips[k].data);
+    return ok;
+}
+
+/*! \brief Function WriteImage writes a planar image in the format given by the extension of the file,
+*  converting between RGB and L*u*v where needed
+*
+*  \param filename name of the file, see ImageFileFormatOf
+*  \param planar 3 planes of width * height bytes
+*  \param width width of the image
+*  \param height height of the image
+*  \param luv the planes are L*u*v instead of RGB
+*  \param png compression of a PNG file, NULL for the defaults
+*  \param num_threads number of threads deflating a PNG file in strips, at most 1 for one stream
+*  \param pool workers deflating a PNG file in strips if not NULL, else num_threads threads are started
+*  \return false if the file can not be written
+*/
+bool WriteImage(const char *filename, const uchar *planar, int width, int height, bool luv,
+                const io_png_options *png, int num_threads, ThreadPool *pool)
+{
+    const ImageFileFormat format = ImageFileFormatOf(filename);
+    const size_t size = (size_t)width * height;
+    const CPUKernels &kernels = CPU_Kernels();
+
+    if(format == IMAGE_FILE_PNG && pool && pool->Size() > 1)
+        return ImageFile_WritePngStrips(filename, planar, width, height, luv, png, *pool);
+    if(format == IMAGE_FILE_PNG && !pool && num_threads > 1)
+    {
+        ThreadPool strip_pool(num_threads);
+        return ImageFile_WritePngStrips(filename, planar, width, height, luv, png, strip_pool);
+    }
+    if(format == IMAGE_FILE_PNG)
+    {
+        if(!luv)
+            return io_png_write_u8_opt(filename, planar, width, height, 3, png) == 0;
+        std::vector<uchar> rgb(3 * size);
+        kernels.luv2rgb(planar, planar + size, planar + 2 * size, &rgb[0], &rgb[size], &rgb[2 * size], size);
+        return io_png_write_u8_opt(filename, &rgb[0], width, height, 3, png) == 0;
+    }
+
+    char header[2 * IMAGE_FILE_HEADER];
+    MappedFile file;
+    const size_t offset = MakeImageHeader(header, format, width, height);
+    if(!file.Create(filename, offset + 3 * size))
+        return false;
+    memcpy(file.Data(), header, offset);
+    uchar *data = file.Data() + offset;
+
+    if(format == IMAGE_FILE_RAW_RGB || format == IMAGE_FILE_RAW_LUV)
+    {
+        if(luv == (format == IMAGE_FILE_RAW_LUV))
+            memcpy(data, planar, 3 * size);
+        else if(luv)
+            kernels.luv2rgb(planar, planar + size, planar + 2 * size, data, data + size, data + 2 * size, size);
+        else
+            // the new file is zero, black stays zero
+            kernels.rgb2luv(planar, planar + size, planar + 2 * size, data, data + size, data + 2 * size, size);
+        return file.Close();
+    }
+
+    // interleaved, converted row by row
+    std::vector<uchar> row(3 * width);
+    for(int y = 0; y < height; y++)
+        ImageFile_InterleaveRow(planar, width, height, y, luv, &row[0], data + (size_t)3 * width * y);
+    return file.Close();
+}
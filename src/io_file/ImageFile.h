@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+
+#include <stddef.h>
+#include <vector>
+#include "../image/AlignedImage.h"
+#include "../io_png/io_png.h"
+
+class ThreadPool;
+
+#define IMAGE_FILE_MAGIC "MSPLANAR"     // first bytes of a raw planar file
+#define IMAGE_FILE_HEADER 64            // bytes of the header of a raw planar file, the planes stay aligned
+#define IMAGE_FILE_STRIP_BYTES 262144   // bytes of the rows of a PNG strip deflated on its own
+
+
+/*Enumeration ImageFileFormat lists the formats of the image files */
+enum ImageFileFormat
+{
+    IMAGE_FILE_PNG,
+    IMAGE_FILE_PPM,         // binary PPM, P6 with a maximal value of 255
+    IMAGE_FILE_PAM,         // PAM, P7 with a depth of 1 to 4 and a maximal value of 255
+    IMAGE_FILE_RAW_RGB,     // raw planar RGB, header IMAGE_FILE_MAGIC RGB width height
+    IMAGE_FILE_RAW_LUV      // raw planar L*u*v, header IMAGE_FILE_MAGIC LUV width height
+};
+
+/*Class MappedFile maps a whole file into memory. An opened file is mapped copy-on-write, so its
+  pixels can be used and even changed in place; a created file is mapped shared, so what is
+  written goes directly to the page cache. */
+class MappedFile
+{
+public:
+    MappedFile() : data(NULL), size(0) {}
+    ~MappedFile() { Close(); }
+
+    bool Open(const char *filename);
+    bool Create(const char *filename, size_t size);
+    bool Close();
+    void Drop(size_t from, size_t to);
+
+    uchar *Data() { return data; }
+    const uchar *Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    uchar *data;
+    size_t size;
+
+    // not copyable
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+/*Structure ImageFileLayout tells where the pixels of a PPM, PAM or raw planar file are */
+struct ImageFileLayout
+{
+    ImageFileFormat format;
+    int width, height;
+    int depth;          // channels of an interleaved pixel, 1 to 4; 3 planes of a raw planar file
+    size_t offset;      // bytes of the header before the pixels
+};
+
+/*Class InputImage reads an image of any ImageFileFormat as a planar image, RGB or converted to
+  L*u*v row by row while it is decoded. The planes of a raw planar file are used in place in the
+  mapped file when no conversion is needed; the other formats are decoded into a buffer. */
+class InputImage
+{
+public:
+    InputImage() : pixels(NULL), decoded(NULL), width(0), height(0), format(IMAGE_FILE_PNG), luv(false) {}
+    ~InputImage() { Release(); }
+
+    bool Open(const char *filename, bool to_luv = false);
+    void Release();
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    ImageFileFormat Format() const { return format; }
+    // the planes are L*u*v instead of RGB, after a conversion or from a raw L*u*v file
+    bool IsLUV() const { return luv; }
+    // planar image, 3 planes of width * height bytes
+    uchar *Planar() { return pixels; }
+
+private:
+    MappedFile file;
+    uchar *pixels;
+    uchar *decoded;     // buffer of the formats other than raw planar, allocated with malloc
+    int width, height;
+    ImageFileFormat format;
+    bool luv;
+    std::vector<uchar> planes;  // one RGB row of a conversion
+
+    bool Allocate();
+    void StoreRow(int y, const uchar *data, int depth);
+    bool OpenPng(const char *filename);
+
+    // not copyable
+    InputImage(const InputImage &);
+    InputImage &operator=(const InputImage &);
+};
+
+ImageFileFormat ImageFileFormatOf(const char *filename);
+bool IsPngFile(const char *filename);
+bool ParseImageHeader(const uchar *data, size_t size, ImageFileLayout *layout);
+size_t MakeImageHeader(char *header, ImageFileFormat format, int width, int height);
+bool ParsePngCompression(const char *name, io_png_options *options);
+bool ParsePngFilter(const char *name, io_png_options *options);
+bool WriteImage(const char *filename, const uchar *planar, int width, int height, bool luv,
+                const io_png_options *png = NULL, int num_threads = 0, ThreadPool *pool = NULL);
+
+
+#endif /* IMAGEFILE_H */
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "LabelFile.h"
+#include "ImageFile.h"
+#include <stdio.h>
+#include <string.h>
+
+
+/**
+ * @file LabelFile.cpp
+ * @brief Label maps of a segmentation
+ *
+ * A label file holds the region of every pixel of a segmentation. Its 64 byte text header
+ * "MSLABELS RAW bits width height regions" or "MSLABELS RLE bits width height regions runs", padded
+ * with spaces and ended by a newline, is followed by the RGB color of every region, as in the
+ * segmented image, padded with zeros to a multiple of 4 bytes, and by the labels. Labels are
+ * little-endian integers of 16 bits if there are at most 65536 regions, else of 32 bits. A raw file
+ * stores the label of every pixel in row-major order. A run-length file stores the runs of every
+ * row from left to right, a label followed by the 16 bit length of the run; runs never cross rows
+ * and longer runs than LABEL_FILE_MAX_RUN are split. The files are mapped like the image files.
+ * The encoding of a written file is chosen by its extension, .rle for runs and raw otherwise.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function LabelFile_Store stores a little-endian integer
+*
+*  \param p first byte
+*  \param value value to store
+*  \param bytes number of bytes, 2 or 4
+*/
+static inline void LabelFile_Store(uchar *p, unsigned value, int bytes)
+{
+    for(int k = 0; k < bytes; k++)
+        p[k] = (uchar)(value >> (8 * k));
+}
+
+/*! \brief Function LabelFile_Load loads a little-endian integer
+*
+*  \param p first byte
+*  \param bytes number of bytes, 2 or 4
+*  \return value
+*/
+static inline unsigned LabelFile_Load(const uchar *p, int bytes)
+{
+    unsigned value = 0;
+
+    for(int k = 0; k < bytes; k++)
+        value |= (unsigned)p[k] << (8 * k);
+    return value;
+}
+
+/*! \brief Function LabelFile_Run returns the length of the run starting at a pixel of a row
+*
+*  \param row labels of the row
+*  \param x first pixel of the run
+*  \param width width of the row
+*  \return length of the run, at most LABEL_FILE_MAX_RUN
+*/
+static inline int LabelFile_Run(const int *row, int x, int width)
+{
+    const int end = x + LABEL_FILE_MAX_RUN < width ? x + LABEL_FILE_MAX_RUN : width;
+    int k = x + 1;
+
+    while(k < end && row[k] == row[x])
+        k++;
+    return k - x;
+}
+
+/*! \brief Function LabelFileEncodingOf returns the encoding of a label file from its extension
+*
+*  \param filename name of the file
+*  \return LABEL_FILE_RLE for .rle, else LABEL_FILE_RAW
+*/
+LabelFileEncoding LabelFileEncodingOf(const char *filename)
+{
+    const char *dot = strrchr(filename, '.');
+
+    return dot && strcmp(dot, ".rle") == 0 ? LABEL_FILE_RLE : LABEL_FILE_RAW;
+}
+
+/*! \brief Function WriteLabelFile writes the labels of a segmentation and the colors of its regions,
+*  raw or run-length encoded as given by the extension of the file
+*
+*  \param filename name of the file, see LabelFileEncodingOf
+*  \param labels label of every pixel, rows of width labels from 0 to regions - 1
+*  \param width width of the image
+*  \param height height of the image
+*  \param regions number of regions
+*  \param colors RGB color of every region, 3 * regions bytes
+*  \return false if the file can not be written
+*/
+bool WriteLabelFile(const char *filename, int **labels, int width, int height, int regions, const uchar *colors)
+{
+    const LabelFileEncoding encoding = LabelFileEncodingOf(filename);
+    const int bytes = regions <= 65536 ? 2 : 4;
+    const size_t table = ((size_t)3 * regions + 3) & ~(size_t)3;
+    size_t runs = 0;
+
+    if(encoding == LABEL_FILE_RLE)
+        for(int y = 0; y < height; y++)
+            for(int x = 0; x < width; x += LabelFile_Run(labels[y], x, width))
+                runs++;
+
+    // padded, ended by a newline
+    char header[2 * LABEL_FILE_HEADER];
+    memset(header, ' ', LABEL_FILE_HEADER);
+    int length = encoding == LABEL_FILE_RLE
+                 ? sprintf(header, LABEL_FILE_MAGIC " RLE %d %d %d %d %lu", 8 * bytes, width, height, regions, (unsigned long)runs)
+                 : sprintf(header, LABEL_FILE_MAGIC " RAW %d %d %d %d", 8 * bytes, width, height, regions);
+    if(length >= LABEL_FILE_HEADER)
+        return false;
+    header[length] = ' ';
+    header[LABEL_FILE_HEADER - 1] = '\n';
+
+    const size_t size = encoding == LABEL_FILE_RLE ? runs * (bytes + 2) : (size_t)width * height * bytes;
+    MappedFile file;
+    if(!file.Create(filename, LABEL_FILE_HEADER + table + size))
+        return false;
+    memcpy(file.Data(), header, LABEL_FILE_HEADER);
+    // the new file is zero, so is the padding of the table
+    memcpy(file.Data() + LABEL_FILE_HEADER, colors, (size_t)3 * regions);
+
+    uchar *data = file.Data() + LABEL_FILE_HEADER + table;
+    for(int y = 0; y < height; y++)
+    {
+        const int *row = labels[y];
+        if(encoding == LABEL_FILE_RAW)
+            for(int x = 0; x < width; x++, data += bytes)
+                LabelFile_Store(data, row[x], bytes);
+        else
+            for(int x = 0, run; x < width; x += run, data += bytes + 2)
+            {
+                run = LabelFile_Run(row, x, width);
+                LabelFile_Store(data, row[x], bytes);
+                LabelFile_Store(data + bytes, run, 2);
+            }
+    }
+    return file.Close();
+}
+
+/*! \brief Function ReadLabelFile reads a label file of WriteLabelFile
+*
+*  \param filename name of the file
+*  \param map filled with the labels and the colors
+*  \return false if the file can not be read or is not a valid label file
+*/
+bool ReadLabelFile(const char *filename, LabelMap &map)
+{
+    MappedFile file;
+
+    if(!file.Open(filename) || file.Size() < LABEL_FILE_HEADER)
+        return false;
+
+    char header[LABEL_FILE_HEADER + 1], encoding[8];
+    int bits = 0, width = 0, height = 0, regions = 0;
+    unsigned long runs = 0;
+    memcpy(header, file.Data(), LABEL_FILE_HEADER);
+    header[LABEL_FILE_HEADER] = 0;
+    const int fields = sscanf(header, LABEL_FILE_MAGIC " %7s %d %d %d %d %lu", encoding, &bits, &width, &height, &regions, &runs);
+    const bool rle = fields == 6 && strcmp(encoding, "RLE") == 0;
+    if(!rle && !(fields == 5 && strcmp(encoding, "RAW") == 0))
+        return false;
+    if((bits != 16 && bits != 32) || width <= 0 || height <= 0 || regions <= 0)
+        return false;
+
+    const int bytes = bits / 8;
+    const size_t table = ((size_t)3 * regions + 3) & ~(size_t)3;
+    const size_t size = rle ? runs * (bytes + 2) : (size_t)width * height * bytes;
+    if(file.Size() != LABEL_FILE_HEADER + table + size)
+        return false;
+
+    map.width = width;
+    map.height = height;
+    map.regions = regions;
+    map.colors.assign(file.Data() + LABEL_FILE_HEADER, file.Data() + LABEL_FILE_HEADER + (size_t)3 * regions);
+    map.labels.resize((size_t)width * height);
+
+    const uchar *data = file.Data() + LABEL_FILE_HEADER + table;
+    const uchar *end = data + size;
+    unsigned *labels = &map.labels[0];
+    if(!rle)
+    {
+        for(size_t k = 0; k < map.labels.size(); k++, data += bytes)
+            if((labels[k] = LabelFile_Load(data, bytes)) >= (unsigned)regions)
+                return false;
+        return true;
+    }
+
+    // every row is covered by its runs
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; data += bytes + 2)
+        {
+            if(data == end)
+                return false;
+            const unsigned label = LabelFile_Load(data, bytes);
+            const int run = LabelFile_Load(data + bytes, 2);
+            if(label >= (unsigned)regions || run == 0 || x + run > width)
+                return false;
+            for(int k = 0; k < run; k++)
+                *labels++ = label;
+            x += run;
+        }
+    return data == end;
+}
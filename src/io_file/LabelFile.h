@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LABELFILE_H
+#define LABELFILE_H
+
+
+#include <vector>
+#include "../image/AlignedImage.h"
+
+#define LABEL_FILE_MAGIC "MSLABELS"     // first bytes of a label file
+#define LABEL_FILE_HEADER 64            // bytes of the header of a label file
+#define LABEL_FILE_MAX_RUN 65535        // longest run, longer ones are split
+
+
+/*Enumeration LabelFileEncoding lists the encodings of the labels of a label file */
+enum LabelFileEncoding
+{
+    LABEL_FILE_RAW,         // width * height labels in row-major order
+    LABEL_FILE_RLE          // runs of a label within a row, a label followed by a 16 bit length
+};
+
+/*Structure LabelMap holds the labels of a segmentation and the colors of its regions */
+struct LabelMap
+{
+    int width, height;
+    int regions;                    // number of regions, the labels are 0 to regions - 1
+    std::vector<unsigned> labels;   // label of every pixel, row-major
+    std::vector<uchar> colors;      // RGB color of every region, 3 * regions bytes
+
+    LabelMap() : width(0), height(0), regions(0) {}
+};
+
+LabelFileEncoding LabelFileEncodingOf(const char *filename);
+bool WriteLabelFile(const char *filename, int **labels, int width, int height, int regions, const uchar *colors);
+bool ReadLabelFile(const char *filename, LabelMap &map);
+
+
+#endif /* LABELFILE_H */
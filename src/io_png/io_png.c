@@ -20,6 +20,12 @@
  * This is a front-end to libpng, with routines to:
  * @li read a PNG file as a deinterlaced 8bit integer or float array
  * @li write a 8bit integer or float array to a PNG file
+ * @li read and write a PNG file row by row, with the channels
+ *     interleaved, in memory proportional to the rows
+ * @li choose the compression level, the zlib strategy and the row
+ *     filters of the written files
+ * @li filter and deflate strips of rows independently, on as many
+ *     threads as the caller likes, and stitch them into one file
  *
  * Multi-channel images are handled: grey, grey+alpha, rgb and
  * rgb+alpha, as well as on-the-fly color model conversion.
@@ -43,6 +49,7 @@
 #else
 #include <png.h>
 #endif
+#include <zlib.h>
 
 /* ensure consistency */
 #include "io_png.h"
@@ -452,6 +459,59 @@ float *io_png_read_f32_gray(const char *fname, size_t * nxp, size_t * nyp) {
  * WRITE
  */
 
+/**
+ * @brief fill the compression settings of a preset
+ *
+ * IO_PNG_PRESET_DEFAULT keeps the defaults of zlib and libpng, as
+ * io_png_write_u8(). IO_PNG_PRESET_FAST is meant for intermediate
+ * files: deflating with level 1 after the up filter takes less than
+ * half the default time, for files about 10% larger. IO_PNG_PRESET_STORE writes the rows as they are, in
+ * stored deflate blocks.
+ *
+ * @param options settings to fill
+ * @param preset IO_PNG_PRESET_DEFAULT, IO_PNG_PRESET_FAST or
+ *        IO_PNG_PRESET_STORE
+ */
+void io_png_options_preset(io_png_options * options, int preset) {
+    options->interlace = (IO_PNG_PRESET_DEFAULT == preset);
+    switch (preset) {
+    case IO_PNG_PRESET_FAST:
+        options->level = 1;
+        options->strategy = -1;
+        options->filters = IO_PNG_FILTER_UP;
+        break;
+    case IO_PNG_PRESET_STORE:
+        options->level = 0;
+        options->strategy = Z_DEFAULT_STRATEGY;
+        options->filters = IO_PNG_FILTER_NONE;
+        break;
+    default:
+        options->level = -1;
+        options->strategy = -1;
+        options->filters = 0;
+        break;
+    }
+}
+
+/**
+ * @brief internal function used to pass the compression settings to
+ * libpng, the defaults are left alone
+ *
+ * @param png_ptr PNG structure of the written file
+ * @param options compression of the file, ignored if NULL
+ */
+static void io_png_set_options(png_structp png_ptr,
+                               const io_png_options * options) {
+    if (NULL == options)
+        return;
+    if (0 <= options->level)
+        png_set_compression_level(png_ptr, options->level);
+    if (0 <= options->strategy)
+        png_set_compression_strategy(png_ptr, options->strategy);
+    if (0 != options->filters)
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, options->filters);
+}
+
 /**
  * @brief internal function used to cleanup the memory when
  * png_write_raw() fails
@@ -488,10 +548,12 @@ static int io_png_write_abort(FILE * fp,
  * @param data deinterlaced (RRR..GGG..BBB..AAA) image byte array
  * @param nx, ny, nc number of columns, lines and channels
  * @param dtype identifier for the data type to be used for output
+ * @param options compression of the file, NULL for the defaults
  * @return 0 if everything OK, -1 if an error occured
  */
 static int io_png_write_raw(const char *fname, const void *data,
-                            size_t nx, size_t ny, size_t nc, int dtype) {
+                            size_t nx, size_t ny, size_t nc, int dtype,
+                            const io_png_options * options) {
     png_structp png_ptr;
     png_infop info_ptr;
     png_byte *idata = NULL, *idata_ptr = NULL;
@@ -573,13 +635,15 @@ static int io_png_write_raw(const char *fname, const void *data,
         (void) fclose(fp);
         return -1;
     }
-    interlace = PNG_INTERLACE_ADAM7;
+    interlace = (NULL == options || options->interlace ?
+                 PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE);
     compression = PNG_COMPRESSION_TYPE_BASE;
     filter = PNG_FILTER_TYPE_BASE;
 
     /* set image header */
     png_set_IHDR(png_ptr, info_ptr, (png_uint_32) nx, (png_uint_32) ny,
                  bit_depth, color_type, interlace, compression, filter);
+    io_png_set_options(png_ptr, options);
     /* TODO : significant bit (sBIT), gamma (gAMA), comments (text) chunks */
     png_write_info(png_ptr, info_ptr);
 
@@ -651,7 +715,25 @@ int io_png_write_u8(const char *fname, const unsigned char *data,
                     size_t nx, size_t ny, size_t nc) {
     return io_png_write_raw(fname, (void *) data,
                             (png_uint_32) nx, (png_uint_32) ny, (png_byte) nc,
-                            IO_PNG_U8);
+                            IO_PNG_U8, NULL);
+}
+
+/**
+ * @brief write a 8bit unsigned integer array into a PNG file with the
+ * given compression
+ *
+ * @param fname PNG file name
+ * @param data array to write
+ * @param nx, ny, nc number of columns, lines and channels of the image
+ * @param options compression of the file, NULL for the defaults
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_write_u8_opt(const char *fname, const unsigned char *data,
+                        size_t nx, size_t ny, size_t nc,
+                        const io_png_options * options) {
+    return io_png_write_raw(fname, (void *) data,
+                            (png_uint_32) nx, (png_uint_32) ny, (png_byte) nc,
+                            IO_PNG_U8, options);
 }
 
 /**
@@ -670,5 +752,622 @@ int io_png_write_f32(const char *fname, const float *data,
                      size_t nx, size_t ny, size_t nc) {
     return io_png_write_raw(fname, (void *) data,
                             (png_uint_32) nx, (png_uint_32) ny, (png_byte) nc,
-                            IO_PNG_F32);
+                            IO_PNG_F32, NULL);
+}
+
+/*
+ * STREAMING
+ */
+
+/**
+ * @brief state of a PNG file read row by row
+ */
+struct io_png_reader {
+    FILE *fp;                   /* input file */
+    png_structp png_ptr;
+    png_infop info_ptr;
+    size_t nx, ny;              /* image size */
+    size_t row;                 /* rows already delivered */
+    png_bytep image;            /* whole image of an interlaced file, else NULL */
+};
+
+/**
+ * @brief state of a PNG file written row by row
+ */
+struct io_png_writer {
+    FILE *fp;                   /* output file */
+    png_structp png_ptr;
+    png_infop info_ptr;
+    size_t nx, ny, nc;          /* image size and channels */
+    size_t row;                 /* rows already written */
+};
+
+/**
+ * @brief internal function used to cleanup the memory when
+ * io_png_read_open_u8_rgb() fails, and to close a reader
+ *
+ * @param reader reader to free
+ * @return NULL
+ */
+static io_png_reader *io_png_reader_abort(io_png_reader * reader) {
+    if (NULL != reader->png_ptr)
+        png_destroy_read_struct(&reader->png_ptr,
+                                NULL != reader->info_ptr ?
+                                &reader->info_ptr : NULL, NULL);
+    if (NULL != reader->fp && stdin != reader->fp)
+        (void) fclose(reader->fp);
+    free(reader->image);
+    free(reader);
+    return NULL;
+}
+
+/**
+ * @brief open a PNG file to be read row by row as 8bit RGB
+ *
+ * The rows are decoded by libpng as they are requested, with the
+ * same conversions as io_png_read_u8_rgb(): 1, 2 and 4bit samples
+ * are expanded to bytes, 16bit samples are downscaled, the alpha
+ * channel is stripped and gray is replicated to RGB. Unlike
+ * io_png_read_u8_rgb(), the channels of a row are interleaved
+ * (RGBRGB...).
+ *
+ * The 7 passes of an interlaced (ADAM7) file each cover the whole
+ * image, so such a file is decoded here at once and only delivered
+ * row by row; the memory is then the one of the image.
+ *
+ * @param fname PNG file name, "-" means stdin
+ * @param nxp, nyp pointers to variables to be filled with the number
+ *        of columns and lines of the image
+ * @return the reader, or NULL if an error happens
+ */
+io_png_reader *io_png_read_open_u8_rgb(const char *fname,
+                                       size_t * nxp, size_t * nyp) {
+    png_byte png_sig[PNG_SIG_LEN];
+    /* volatile: because of setjmp/longjmp */
+    png_bytepp volatile row_pointers = NULL;
+    io_png_reader *reader;
+    int passes;
+    size_t j;
+
+    /* parameters check */
+    if (NULL == fname || NULL == nxp || NULL == nyp)
+        return NULL;
+    if (NULL == (reader = (io_png_reader *) calloc(1, sizeof(io_png_reader))))
+        return NULL;
+
+    /* open the PNG input file */
+    if (0 == strcmp(fname, "-"))
+        reader->fp = stdin;
+    else if (NULL == (reader->fp = fopen(fname, "rb")))
+        return io_png_reader_abort(reader);
+
+    /* read in some of the signature bytes and check this signature */
+    if ((PNG_SIG_LEN != fread(png_sig, 1, PNG_SIG_LEN, reader->fp))
+            || 0 != png_sig_cmp(png_sig, (png_size_t) 0, PNG_SIG_LEN))
+        return io_png_reader_abort(reader);
+
+    /* create the png_struct and the image information */
+    if (NULL == (reader->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+                                   NULL, NULL, NULL)))
+        return io_png_reader_abort(reader);
+    if (NULL == (reader->info_ptr = png_create_info_struct(reader->png_ptr)))
+        return io_png_reader_abort(reader);
+
+    /* set error handling, the reader lives on the heap */
+    if (0 != setjmp(png_jmpbuf(reader->png_ptr))) {
+        free(row_pointers);
+        return io_png_reader_abort(reader);
+    }
+
+    png_init_io(reader->png_ptr, reader->fp);
+    png_set_sig_bytes(reader->png_ptr, PNG_SIG_LEN);
+    png_read_info(reader->png_ptr, reader->info_ptr);
+
+    /* 8bit RGB whatever the original file may contain */
+    png_set_strip_16(reader->png_ptr);
+    png_set_packing(reader->png_ptr);
+    png_set_strip_alpha(reader->png_ptr);
+    png_set_gray_to_rgb(reader->png_ptr);
+    passes = png_set_interlace_handling(reader->png_ptr);
+    png_read_update_info(reader->png_ptr, reader->info_ptr);
+    reader->nx = (size_t) png_get_image_width(reader->png_ptr,
+                                              reader->info_ptr);
+    reader->ny = (size_t) png_get_image_height(reader->png_ptr,
+                                               reader->info_ptr);
+    /* palette files are not converted */
+    if (3 * reader->nx != png_get_rowbytes(reader->png_ptr, reader->info_ptr))
+        return io_png_reader_abort(reader);
+
+    if (1 < passes) {
+        /* an interlaced file is decoded at once */
+        if (NULL == (reader->image =
+                         (png_bytep) malloc(3 * reader->nx * reader->ny))
+                || NULL == (row_pointers =
+                                (png_bytepp) malloc(reader->ny *
+                                                    sizeof(png_bytep)))) {
+            free(row_pointers);
+            return io_png_reader_abort(reader);
+        }
+        for (j = 0; j < reader->ny; j++)
+            row_pointers[j] = reader->image + 3 * reader->nx * j;
+        png_read_image(reader->png_ptr, row_pointers);
+        free(row_pointers);
+        row_pointers = NULL;
+    }
+
+    *nxp = reader->nx;
+    *nyp = reader->ny;
+    return reader;
+}
+
+/**
+ * @brief read the next rows of a PNG file
+ *
+ * @param reader reader of io_png_read_open_u8_rgb()
+ * @param data array of count rows of 3 * nx bytes, RGBRGB...
+ * @param count number of rows
+ * @return 0 if everything OK, -1 if an error occured or the image
+ *         has less rows
+ */
+int io_png_read_rows(io_png_reader * reader, unsigned char *data,
+                     size_t count) {
+    size_t j;
+
+    if (NULL == reader || reader->row + count > reader->ny)
+        return -1;
+
+    if (NULL != reader->image) {
+        memcpy(data, reader->image + 3 * reader->nx * reader->row,
+               3 * reader->nx * count);
+        reader->row += count;
+        return 0;
+    }
+
+    /* set error handling */
+    if (0 != setjmp(png_jmpbuf(reader->png_ptr))) {
+        /* later rows can not be decoded */
+        reader->row = reader->ny + 1;
+        return -1;
+    }
+    for (j = 0; j < count; j++)
+        png_read_row(reader->png_ptr, data + 3 * reader->nx * j, NULL);
+    reader->row += count;
+    return 0;
+}
+
+/**
+ * @brief close a PNG file read row by row and free the reader
+ *
+ * The rows not read are skipped.
+ *
+ * @param reader reader of io_png_read_open_u8_rgb(), ignored if NULL
+ */
+void io_png_read_close(io_png_reader * reader) {
+    if (NULL != reader)
+        (void) io_png_reader_abort(reader);
+}
+
+/**
+ * @brief internal function used to cleanup the memory when
+ * io_png_write_open_u8() fails, and to close a writer
+ *
+ * @param writer writer to free
+ * @return -1
+ */
+static int io_png_writer_abort(io_png_writer * writer) {
+    if (NULL != writer->png_ptr)
+        png_destroy_write_struct(&writer->png_ptr,
+                                 NULL != writer->info_ptr ?
+                                 &writer->info_ptr : NULL);
+    if (NULL != writer->fp && stdout != writer->fp)
+        (void) fclose(writer->fp);
+    free(writer);
+    return -1;
+}
+
+/**
+ * @brief open a PNG file to be written row by row
+ *
+ * The file is written as a 8bit, non interlaced image; an interlaced
+ * file would need the whole image for its first pass. The rows are
+ * filtered and compressed by libpng as they are given.
+ *
+ * @param fname PNG file name, "-" means stdout
+ * @param nx, ny, nc number of columns, lines and channels, the color
+ *        model is gray, gray+alpha, rgb or rgb+alpha
+ * @return the writer, or NULL if an error happens
+ */
+io_png_writer *io_png_write_open_u8(const char *fname,
+                                    size_t nx, size_t ny, size_t nc) {
+    return io_png_write_open_u8_opt(fname, nx, ny, nc, NULL);
+}
+
+/**
+ * @brief open a PNG file to be written row by row with the given
+ * compression, see io_png_write_open_u8()
+ *
+ * @param fname PNG file name, "-" means stdout
+ * @param nx, ny, nc number of columns, lines and channels
+ * @param options compression of the file, NULL for the defaults,
+ *        the interlace setting is ignored
+ * @return the writer, or NULL if an error happens
+ */
+io_png_writer *io_png_write_open_u8_opt(const char *fname,
+                                        size_t nx, size_t ny, size_t nc,
+                                        const io_png_options * options) {
+    static const int color_types[] = { PNG_COLOR_TYPE_GRAY,
+                                       PNG_COLOR_TYPE_GRAY_ALPHA,
+                                       PNG_COLOR_TYPE_RGB,
+                                       PNG_COLOR_TYPE_RGB_ALPHA
+                                     };
+    /* volatile: because of setjmp/longjmp */
+    io_png_writer *volatile writer;
+
+    /* parameters check */
+    if (0 >= nx || 0 >= ny || 1 > nc || 4 < nc || NULL == fname)
+        return NULL;
+    if (NULL == (writer = (io_png_writer *) calloc(1, sizeof(io_png_writer))))
+        return NULL;
+    writer->nx = nx;
+    writer->ny = ny;
+    writer->nc = nc;
+
+    /* open the PNG output file */
+    if (0 == strcmp(fname, "-"))
+        writer->fp = stdout;
+    else if (NULL == (writer->fp = fopen(fname, "wb"))) {
+        (void) io_png_writer_abort(writer);
+        return NULL;
+    }
+
+    /* create the png_struct and the image information */
+    if (NULL == (writer->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                   NULL, NULL, NULL))
+            || NULL == (writer->info_ptr =
+                            png_create_info_struct(writer->png_ptr))) {
+        (void) io_png_writer_abort(writer);
+        return NULL;
+    }
+
+    /* set error handling, the writer lives on the heap */
+    if (0 != setjmp(png_jmpbuf(writer->png_ptr))) {
+        (void) io_png_writer_abort(writer);
+        return NULL;
+    }
+
+    png_init_io(writer->png_ptr, writer->fp);
+    png_set_IHDR(writer->png_ptr, writer->info_ptr,
+                 (png_uint_32) nx, (png_uint_32) ny, 8,
+                 color_types[nc - 1], PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    io_png_set_options(writer->png_ptr, options);
+    png_write_info(writer->png_ptr, writer->info_ptr);
+    return writer;
+}
+
+/**
+ * @brief write the next rows of a PNG file
+ *
+ * @param writer writer of io_png_write_open_u8()
+ * @param data array of count rows of nc * nx bytes, channels
+ *        interleaved
+ * @param count number of rows
+ * @return 0 if everything OK, -1 if an error occured or the image
+ *         has less rows
+ */
+int io_png_write_rows(io_png_writer * writer, const unsigned char *data,
+                      size_t count) {
+    size_t j;
+
+    if (NULL == writer || writer->row + count > writer->ny)
+        return -1;
+
+    /* set error handling */
+    if (0 != setjmp(png_jmpbuf(writer->png_ptr))) {
+        /* the file is broken */
+        writer->row = writer->ny + 1;
+        return -1;
+    }
+    for (j = 0; j < count; j++)
+        png_write_row(writer->png_ptr,
+                      (png_const_bytep) (data + writer->nc * writer->nx * j));
+    writer->row += count;
+    return 0;
+}
+
+/**
+ * @brief end a PNG file written row by row and free the writer
+ *
+ * @param writer writer of io_png_write_open_u8(), ignored if NULL
+ * @return 0 if all the rows were written, -1 otherwise
+ */
+int io_png_write_close(io_png_writer * writer) {
+    if (NULL == writer)
+        return -1;
+    if (writer->row != writer->ny)
+        return io_png_writer_abort(writer);
+
+    /* set error handling */
+    if (0 != setjmp(png_jmpbuf(writer->png_ptr)))
+        return io_png_writer_abort(writer);
+    png_write_end(writer->png_ptr, writer->info_ptr);
+
+    if (stdout != writer->fp && 0 != fclose(writer->fp)) {
+        writer->fp = NULL;
+        return io_png_writer_abort(writer);
+    }
+    writer->fp = NULL;
+    (void) io_png_writer_abort(writer);
+    return 0;
+}
+
+/*
+ * STRIPS
+ */
+
+/**
+ * @brief internal function used to filter a row with one PNG filter
+ *
+ * @param type filter, PNG_FILTER_VALUE_NONE to PNG_FILTER_VALUE_PAETH
+ * @param row row to filter
+ * @param prev row above, zeros for the first row of the image
+ * @param len bytes of the row
+ * @param bpp bytes of a pixel
+ * @param out filter type followed by the len filtered bytes
+ * @return sum of the filtered bytes taken as signed, the heuristic
+ *         libpng uses to choose the filter of a row
+ */
+static unsigned long io_png_filter_row(int type, const png_byte * row,
+                                       const png_byte * prev, size_t len,
+                                       size_t bpp, png_byte * out) {
+    unsigned long sum = 0;
+    size_t i;
+    int a, b, c, p, pa, pb, pc;
+
+    out[0] = (png_byte) type;
+    out++;
+    /* the first pixel has no left neighbour */
+    switch (type) {
+    case PNG_FILTER_VALUE_SUB:
+        memcpy(out, row, bpp);
+        for (i = bpp; i < len; i++)
+            out[i] = (png_byte) (row[i] - row[i - bpp]);
+        break;
+    case PNG_FILTER_VALUE_UP:
+        for (i = 0; i < len; i++)
+            out[i] = (png_byte) (row[i] - prev[i]);
+        break;
+    case PNG_FILTER_VALUE_AVG:
+        for (i = 0; i < bpp; i++)
+            out[i] = (png_byte) (row[i] - (prev[i] >> 1));
+        for (i = bpp; i < len; i++)
+            out[i] = (png_byte) (row[i] - ((row[i - bpp] + prev[i]) >> 1));
+        break;
+    case PNG_FILTER_VALUE_PAETH:
+        for (i = 0; i < bpp; i++)
+            out[i] = (png_byte) (row[i] - prev[i]);
+        for (i = bpp; i < len; i++) {
+            a = row[i - bpp];
+            b = prev[i];
+            c = prev[i - bpp];
+            p = a + b - c;
+            pa = abs(p - a);
+            pb = abs(p - b);
+            pc = abs(p - c);
+            out[i] = (png_byte) (row[i] -
+                                 (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+        }
+        break;
+    default:
+        memcpy(out, row, len);
+        break;
+    }
+
+    for (i = 0; i < len; i++)
+        sum += (unsigned long) abs((signed char) out[i]);
+    return sum;
+}
+
+/**
+ * @brief filter and deflate a strip of rows of a PNG file
+ *
+ * The strips of an image are independent, so they can be deflated
+ * on several threads at the same time. Every strip is a raw deflate
+ * stream ended by a full flush, like the blocks of pigz; the first
+ * one starts with the zlib header, the last one ends the stream and
+ * leaves room for the adler32 checksum, which
+ * io_png_write_strips() computes from those of the strips.
+ *
+ * @param prev row above the strip, NULL for the first strip
+ * @param rows count rows of nc * nx bytes, channels interleaved
+ * @param nx, nc number of columns and channels
+ * @param count number of rows
+ * @param last nonzero for the last strip of the image
+ * @param options compression, NULL for the defaults; without filters
+ *        every row takes the best of the five
+ * @param strip filled with the deflated rows, strip->data is to be
+ *        freed by the caller
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_deflate_strip(const unsigned char *prev, const unsigned char *rows,
+                         size_t nx, size_t nc, size_t count, int last,
+                         const io_png_options * options, io_png_strip * strip) {
+    const size_t len = nx * nc;
+    const int filters = (NULL != options && 0 != options->filters ?
+                         options->filters : IO_PNG_FILTER_ALL);
+    const int level = (NULL != options ? options->level : -1);
+    const int strategy = (NULL != options && 0 <= options->strategy ?
+                          options->strategy : IO_PNG_FILTER_NONE == filters ?
+                          Z_DEFAULT_STRATEGY : Z_FILTERED);
+    png_byte *filtered, *zero, *trial, *out, *swap;
+    const png_byte *row, *above;
+    unsigned long sum, best;
+    size_t j, bound, start;
+    z_stream zs;
+    int type, status;
+
+    strip->data = NULL;
+    strip->size = 0;
+    strip->length = count * (len + 1);
+    strip->adler = adler32(0L, Z_NULL, 0);
+    if (0 >= count || 0 >= len)
+        return -1;
+
+    filtered = (png_byte *) malloc(strip->length);
+    trial = (png_byte *) malloc(len + 1);
+    zero = (png_byte *) calloc(len, 1);
+    if (NULL == filtered || NULL == trial || NULL == zero) {
+        free(filtered);
+        free(trial);
+        free(zero);
+        return -1;
+    }
+
+    /* the filter of the smallest sum, as libpng chooses; a better
+     * trial row and the output row trade places */
+    for (j = 0; j < count; j++) {
+        row = rows + len * j;
+        above = (0 < j ? row - len : NULL != prev ? prev : zero);
+        out = filtered + (len + 1) * j;
+        best = (unsigned long) -1;
+        for (type = PNG_FILTER_VALUE_NONE; type <= PNG_FILTER_VALUE_PAETH; type++) {
+            if (!(filters & (IO_PNG_FILTER_NONE << type)))
+                continue;
+            sum = io_png_filter_row(type, row, above, len, nc,
+                                    (unsigned long) -1 == best ? out : trial);
+            if ((unsigned long) -1 != best && sum < best) {
+                swap = out;
+                out = trial;
+                trial = swap;
+            }
+            if (sum < best)
+                best = sum;
+        }
+        if (out != filtered + (len + 1) * j) {
+            /* the best row is in the trial buffer */
+            swap = filtered + (len + 1) * j;
+            memcpy(swap, out, len + 1);
+            trial = out;
+        }
+    }
+    free(trial);
+    free(zero);
+    strip->adler = adler32(strip->adler, filtered, (uInt) strip->length);
+
+    memset(&zs, 0, sizeof(zs));
+    if (Z_OK != deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, strategy)) {
+        free(filtered);
+        return -1;
+    }
+    /* zlib header, the stored end of a flush and the checksum */
+    bound = deflateBound(&zs, strip->length) + 16;
+    if (NULL == (strip->data = (unsigned char *) malloc(bound))) {
+        (void) deflateEnd(&zs);
+        free(filtered);
+        return -1;
+    }
+
+    start = 0;
+    if (NULL == prev) {
+        /* 32K window, FLEVEL of the level, FCHECK */
+        strip->data[0] = 0x78;
+        strip->data[1] = (unsigned char) ((0 <= level && level < 2 ? 0 :
+                                           2 <= level && level < 6 ? 1 :
+                                           7 <= level ? 3 : 2) << 6);
+        strip->data[1] += (unsigned char) ((31 - (0x7800 + strip->data[1]) % 31) % 31);
+        start = 2;
+    }
+    zs.next_in = filtered;
+    zs.avail_in = (uInt) strip->length;
+    zs.next_out = strip->data + start;
+    zs.avail_out = (uInt) (bound - start - 4);
+    status = deflate(&zs, last ? Z_FINISH : Z_FULL_FLUSH);
+    strip->size = bound - 4 - zs.avail_out + (last ? 4 : 0);
+    (void) deflateEnd(&zs);
+    free(filtered);
+
+    if ((last ? Z_STREAM_END : Z_OK) != status || 0 != zs.avail_in
+            || 0 == zs.avail_out) {
+        free(strip->data);
+        strip->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief write a PNG file from its strips
+ *
+ * The file is non interlaced, every strip is one IDAT chunk. The
+ * adler32 checksum of the whole stream is combined from those of the
+ * strips and stored at the end of the last one.
+ *
+ * @param fname PNG file name, "-" means stdout
+ * @param nx, ny, nc number of columns, lines and channels
+ * @param strips strips of io_png_deflate_strip(), top to bottom
+ * @param count number of strips
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_write_strips(const char *fname, size_t nx, size_t ny, size_t nc,
+                        io_png_strip * strips, size_t count) {
+    static const int color_types[] = { PNG_COLOR_TYPE_GRAY,
+                                       PNG_COLOR_TYPE_GRAY_ALPHA,
+                                       PNG_COLOR_TYPE_RGB,
+                                       PNG_COLOR_TYPE_RGB_ALPHA
+                                     };
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    /* volatile: because of setjmp/longjmp */
+    FILE *volatile fp;
+    unsigned long adler;
+    unsigned char *end;
+    size_t k;
+
+    /* parameters check */
+    if (0 >= nx || 0 >= ny || 1 > nc || 4 < nc || NULL == fname)
+        return -1;
+    if (NULL == strips || 0 >= count || 4 > strips[count - 1].size)
+        return -1;
+    for (k = 0; k < count; k++)
+        if (NULL == strips[k].data)
+            return -1;
+
+    adler = strips[0].adler;
+    for (k = 1; k < count; k++)
+        adler = adler32_combine(adler, strips[k].adler, (z_off_t) strips[k].length);
+    end = strips[count - 1].data + strips[count - 1].size - 4;
+    end[0] = (unsigned char) (adler >> 24);
+    end[1] = (unsigned char) (adler >> 16);
+    end[2] = (unsigned char) (adler >> 8);
+    end[3] = (unsigned char) adler;
+
+    /* open the PNG output file */
+    if (0 == strcmp(fname, "-"))
+        fp = stdout;
+    else if (NULL == (fp = fopen(fname, "wb")))
+        return -1;
+
+    if (NULL == (png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                           NULL, NULL, NULL)))
+        return io_png_write_abort(fp, NULL, NULL, NULL, NULL);
+    if (NULL == (info_ptr = png_create_info_struct(png_ptr)))
+        return io_png_write_abort(fp, NULL, NULL, &png_ptr, NULL);
+    if (0 != setjmp(png_jmpbuf(png_ptr)))
+        return io_png_write_abort(fp, NULL, NULL, &png_ptr, &info_ptr);
+
+    /* libpng writes the header, the chunks are written as they are */
+    png_init_io(png_ptr, fp);
+    png_set_IHDR(png_ptr, info_ptr, (png_uint_32) nx, (png_uint_32) ny, 8,
+                 color_types[nc - 1], PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+    for (k = 0; k < count; k++)
+        png_write_chunk(png_ptr, (png_const_bytep) "IDAT",
+                        strips[k].data, strips[k].size);
+    png_write_chunk(png_ptr, (png_const_bytep) "IEND", NULL, 0);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+
+    if (stdout != fp && 0 != fclose(fp))
+        return -1;
+    return 0;
 }
@@ -19,6 +19,54 @@ extern "C" {
     int io_png_write_u8(const char *fname, const unsigned char *data, size_t nx, size_t ny, size_t nc);
     int io_png_write_f32(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
 
+    /* compression of the written files, see io_png.c */
+#define IO_PNG_PRESET_DEFAULT 0 /* zlib and libpng defaults, interlaced */
+#define IO_PNG_PRESET_FAST 1    /* level 1, up filter */
+#define IO_PNG_PRESET_STORE 2   /* stored, neither filtered nor compressed */
+
+    /* row filters, the values of libpng's PNG_FILTER_* */
+#define IO_PNG_FILTER_NONE 0x08
+#define IO_PNG_FILTER_SUB 0x10
+#define IO_PNG_FILTER_UP 0x20
+#define IO_PNG_FILTER_AVG 0x40
+#define IO_PNG_FILTER_PAETH 0x80
+#define IO_PNG_FILTER_ALL 0xf8
+
+    typedef struct io_png_options {
+        int level;              /* zlib level 0 to 9, -1 for the default */
+        int strategy;           /* zlib strategy, -1 for the default of libpng */
+        int filters;            /* IO_PNG_FILTER_* bits, a row takes the best of them */
+        int interlace;          /* Adam7, only for a whole image written at once */
+    } io_png_options;
+
+    void io_png_options_preset(io_png_options *options, int preset);
+    int io_png_write_u8_opt(const char *fname, const unsigned char *data, size_t nx, size_t ny, size_t nc,
+                            const io_png_options *options);
+
+    /* strips of rows deflated independently and written as one file */
+    typedef struct io_png_strip {
+        unsigned char *data;    /* part of the zlib stream, malloc'ed */
+        size_t size;            /* bytes of data */
+        size_t length;          /* bytes of the filtered rows */
+        unsigned long adler;    /* adler32 of the filtered rows */
+    } io_png_strip;
+    int io_png_deflate_strip(const unsigned char *prev, const unsigned char *rows, size_t nx, size_t nc,
+                             size_t count, int last, const io_png_options *options, io_png_strip *strip);
+    int io_png_write_strips(const char *fname, size_t nx, size_t ny, size_t nc,
+                            io_png_strip *strips, size_t count);
+
+    /* row by row reading and writing, see io_png.c */
+    typedef struct io_png_reader io_png_reader;
+    typedef struct io_png_writer io_png_writer;
+    io_png_reader *io_png_read_open_u8_rgb(const char *fname, size_t *nxp, size_t *nyp);
+    int io_png_read_rows(io_png_reader *reader, unsigned char *data, size_t count);
+    void io_png_read_close(io_png_reader *reader);
+    io_png_writer *io_png_write_open_u8(const char *fname, size_t nx, size_t ny, size_t nc);
+    io_png_writer *io_png_write_open_u8_opt(const char *fname, size_t nx, size_t ny, size_t nc,
+                                            const io_png_options *options);
+    int io_png_write_rows(io_png_writer *writer, const unsigned char *data, size_t count);
+    int io_png_write_close(io_png_writer *writer);
+
 #ifdef __cplusplus
 }
 #endif
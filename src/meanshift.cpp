@@ -19,8 +19,14 @@ Mean shift algorithm represent a general non-parametric mode finding procedure.
 
 #include <stdio.h>
 #include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "ms/ms.h"
 #include "io_png/io_png.h"
+#include "io_file/ImageFile.h"
+#include "io_file/LabelFile.h"
+#include "perf/CacheCounter.h"
 
 using namespace std;
 
@@ -32,29 +38,249 @@ using namespace std;
  */
 
 
+/*! \brief Function Usage tells the user how to run the program
+*
+*  \param name name of the executable
+*/
+static void Usage(const char *name)
+{
+    std::cerr << "Meanshift segmentation and filtering" << std::endl;
+    std::cerr << "Usage: " << name << " [-t threads] [-s simd] [-p] [-c] [-i] [-u speedup] [-g histogram] [-k kernel] [-l levels] [-a] [-o order] [-v] [-d prefix] [-z compression] [-f filter] [-r labels] image spatial_radius color_radius minRegion output_segmented [output_filtered]" << std::endl;
+    std::cerr << "       " << name << " [options] [-j workers] -B manifest" << std::endl;
+    std::cerr << "       " << name << " [options] [-j workers] -B directory spatial_radius color_radius minRegion output_directory" << std::endl;
+    std::cerr << "  -t threads  filter with the double-buffered parallel filter on the given number of threads" << std::endl;
+    std::cerr << "  -s simd     instruction set of the kernels: auto (default), scalar, avx2 or avx512, same result" << std::endl;
+    std::cerr << "              without -s the environment variable MEANSHIFT_ISA selects it" << std::endl;
+    std::cerr << "  -p          filter a packed copy of the image with one 4 byte access per neighbour" << std::endl;
+    std::cerr << "  -c          use a circular window of radius spatial_radius instead of the square window" << std::endl;
+    std::cerr << "  -i          filter with fixed-point integer arithmetic" << std::endl;
+    std::cerr << "  -u speedup  reuse the trajectories of other pixels: none (default), medium or high" << std::endl;
+    std::cerr << "  -g histogram  iterations computed from a sliding histogram of the window: none (default), first or all" << std::endl;
+    std::cerr << "  -k kernel   kernels of the filter, spatial:range or one for both: flat (default), epanechnikov or gaussian" << std::endl;
+    std::cerr << "  -l levels   start from the modes of a pyramid with the given number of coarser levels, at most 4" << std::endl;
+    std::cerr << "  -a          iterate the pixels of a tile in lockstep and remove the converged ones after every iteration" << std::endl;
+    std::cerr << "  -o order    order of the pixels: rows (default), tiles or morton, tiles are sized for the L2 cache" << std::endl;
+    std::cerr << "  -v          print the iteration statistics and the cache misses of the filter" << std::endl;
+    std::cerr << "  -d prefix   write 16 bit maps of the iterations, mean shift, support and capped pixels and their" << std::endl;
+    std::cerr << "              histograms to prefix_iterations.pgm, ..., prefix_histogram.txt" << std::endl;
+    std::cerr << "  -z compression  compression of PNG outputs: default, fast, store or a zlib level 0 to 9; with -t" << std::endl;
+    std::cerr << "              threads they are deflated in strips on the threads" << std::endl;
+    std::cerr << "  -f filter   row filter of PNG outputs: none, sub, up, average, paeth or all (default)" << std::endl;
+    std::cerr << "  -r labels   write the label of every pixel and the colors of the regions, run-length encoded if the" << std::endl;
+    std::cerr << "              name ends with .rle, else raw; 16 or 32 bit little-endian labels" << std::endl;
+    std::cerr << "  -B batch    segment a batch of images, decoding, computing and encoding overlapped, from a manifest with" << std::endl;
+    std::cerr << "              a line input spatial_radius color_radius minRegion output_segmented [output_filtered] per" << std::endl;
+    std::cerr << "              image, or every image of a directory written under its name to the output directory" << std::endl;
+    std::cerr << "  -j workers  workers of the stages of a batch, the number of processors by default" << std::endl;
+    std::cerr << "Images are PNG, binary PPM or PAM, or raw planar .rgb or .luv; outputs take the format of their extension" << std::endl;
+    std::cerr << "Example save only segmented image: " << name << " input.png 7 6.5 20 output_segmented.png" << std::endl;
+    std::cerr << "Example save segmented and filtered image: " << name << " input.png 7 6.5 20 output_segmented.png output_filtered.png" << std::endl;
+    std::cerr << "Example filter on 8 threads: " << name << " -t 8 input.png 7 6.5 20 output_segmented.png" << std::endl;
+    std::cerr << "Example segment a directory: " << name << " -B tiles 7 6.5 20 segmented" << std::endl;
+}
+
+/*! \brief Function Batch segments the images of a manifest or a directory and reports the times of
+*  every image and the throughput of the batch
+*
+*  \param source manifest or directory
+*  \param args parameters and output directory of a directory, else NULL
+*  \param num_iters initial number of iterations
+*  \param options settings of the filter
+*  \param png compression of the PNG outputs
+*  \param num_workers workers of the stages
+*  \return exit status, 1 if an image fails
+*/
+static int Batch(const char *source, char **args, int num_iters, const MSOptions &options, const io_png_options &png, int num_workers)
+{
+    std::vector<MSBatchItem> items;
+    const bool listed = args ? MS_ListBatchDirectory(source, atoi(args[0]), atof(args[1]), atoi(args[2]), args[3], items)
+                             : MS_ReadBatchManifest(source, items);
+    if (!listed)
+    {
+        std::cerr << "Can not read the batch " << source << std::endl;
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const int done = MS_RunBatch(items, num_iters, options, &png, num_workers, MS_BATCH_QUEUE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+
+    for (size_t k = 0; k < items.size(); k++)
+    {
+        const MSBatchItem &item = items[k];
+        if (!item.ok)
+        {
+            cout << item.input << ": failed" << endl;
+            continue;
+        }
+        const double busy = item.decode_time + item.compute_time + item.encode_time;
+        cout << item.input << ": decode " << 1000 * item.decode_time << " ms, compute " << 1000 * item.compute_time
+             << " ms, encode " << 1000 * item.encode_time << " ms, latency " << 1000 * item.latency << " ms, "
+             << 1 / busy << " images/s" << endl;
+    }
+    cout << done << " of " << items.size() << " images in " << seconds << " s on " << num_workers << " workers, "
+         << done / seconds << " images/s" << endl;
+    return done == (int)items.size() ? 0 : 1;
+}
+
+
 int main(int argc, char* argv[])
 {
     // initial value
     int num_iters = 100; // Initial number of iterations for Meanshift
-    
-    if (argc < 6)
+    MSOptions options;   // Optional settings of the filter
+    MSFilterStats stats; // Statistics of the filter
+    bool verbose = false; // Print the iteration statistics
+    MSDiagnostics diagnostics; // Convergence maps of the pixels
+    const char *diagnostics_prefix = NULL;
+    MSRegions regions;   // Number and colors of the regions
+    const char *labels_filename = NULL;
+    io_png_options png;  // Compression of the PNG outputs
+    io_png_options_preset(&png, IO_PNG_PRESET_DEFAULT);
+    const char *batch = NULL; // Manifest or directory of a batch
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_workers = processors > 0 ? (int)processors : 1; // Workers of the stages of a batch
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:pciu:g:k:l:ao:vd:z:f:r:B:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            options.num_threads = atoi(optarg); // Number of threads of the parallel filter
+            break;
+        case 's':
+            if (!MS_ParseSimd(optarg, &options.simd)) // Instruction set of the filter
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            options.packed = true; // Filter the packed L u v X layout
+            break;
+        case 'c':
+            options.disc = true; // Circular window
+            break;
+        case 'i':
+            options.integer = true; // Integer filter
+            break;
+        case 'u':
+            if (!MS_ParseSpeedUp(optarg, &options.speedup)) // Trajectory reuse
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'g':
+            if (!MS_ParseHistogram(optarg, &options.histogram)) // Sliding window histogram
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            if (!MS_ParseKernel(optarg, &options.spatial_kernel, &options.range_kernel)) // Weighted kernels
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            options.pyramid = atoi(optarg); // Levels of the pyramid
+            break;
+        case 'a':
+            options.lockstep = true; // Lockstep filter
+            break;
+        case 'o':
+            if (!MS_ParseTraversal(optarg, &options.traversal)) // Order of the pixels
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'd':
+            diagnostics_prefix = optarg; // Convergence diagnostics
+            options.diagnostics = &diagnostics;
+            break;
+        case 'r':
+            labels_filename = optarg; // Label map of the segmentation
+            options.regions = &regions;
+            break;
+        case 'z':
+            if (!ParsePngCompression(optarg, &png)) // Compression of the PNG outputs
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (!ParsePngFilter(optarg, &png)) // Row filter of the PNG outputs
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'B':
+            batch = optarg; // Manifest or directory of a batch
+            break;
+        case 'j':
+            num_workers = atoi(optarg); // Workers of the stages of a batch
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (batch)
+    {
+        // one manifest, or a directory with its parameters and output directory; no per-image outputs
+        struct stat info;
+        const bool directory = stat(batch, &info) == 0 && S_ISDIR(info.st_mode);
+        if (argc - optind != (directory ? 4 : 0) || diagnostics_prefix || labels_filename)
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+        if (options.simd != MS_SIMD_AUTO)
+            CPU_Select(MS_SimdIsa(options.simd));
+        return Batch(batch, directory ? argv + optind : NULL, num_iters, options, png, num_workers);
+    }
+
+    if (argc - optind < 5)
     {
         // Tell the user how to run the program
-        std::cerr << "Meanshift segmentation and filtering" << std::endl;
-        std::cerr << "Usage: " << argv[0] << " image spatial_radius color_radius minRegion output_segmented [output_filtered]" << std::endl;
-        std::cerr << "Example save only segmented image: " << argv[0] << " input.png 7 6.5 20 output_segmented.png" << std::endl;
-        std::cerr << "Example save segmented and filtered image: " << argv[0] << " input.png 7 6.5 20 output_segmented.png output_filtered.png" << std::endl;
-       return 1;
+        Usage(argv[0]);
+        return 1;
     }
 
-    size_t width, height;
-    // Read image to be segmented
-    uchar * image = io_png_read_u8_rgb(argv[1], &width, &height);
+    char **args = argv + optind; // positional arguments
+    options.stats = &stats;
+    if (options.simd != MS_SIMD_AUTO)
+        CPU_Select(MS_SimdIsa(options.simd)); // also for the color conversion and the relabeling
 
-    const int spatial_radius = atoi(argv[2]); // Spatial radius for Meanshift algorithm
-    const double color_radius = atof(argv[3]); // Range radius for Meanshift algorithm
-    const int minRegion = atoi(argv[4]); // Minimal region for merging
-    const string filename_segment = argv[5]; // Filename for segmented image
+    // Read image to be segmented, PNG, PPM, PAM or raw planar RGB or L*u*v, converted to L*u*v as
+    // it is decoded
+    InputImage input;
+    if (!input.Open(args[0], true))
+    {
+        std::cerr << "Can not read " << args[0] << std::endl;
+        return 1;
+    }
+    uchar * image = input.Planar();
+    const int width = input.Width(), height = input.Height();
+    options.luv = input.IsLUV();
+
+    const int spatial_radius = atoi(args[1]); // Spatial radius for Meanshift algorithm
+    const double color_radius = atof(args[2]); // Range radius for Meanshift algorithm
+    const int minRegion = atoi(args[3]); // Minimal region for merging
+    const string filename_segment = args[4]; // Filename for segmented image
        
 
     int **ilabels = GenerateLabels(width, height);
@@ -62,26 +288,57 @@ int main(int argc, char* argv[])
     uchar *segmented;
     uchar *filtered = AllocateUcharImage(width,height,3);
     
-    segmented = MeanShift(image, filtered, ilabels, width, height, spatial_radius, color_radius, minRegion, num_iters);
+    CacheCounter counter; // Cache misses of the filter and the segmentation
+    counter.Start();
+    segmented = MeanShift(image, filtered, ilabels, width, height, spatial_radius, color_radius, minRegion, num_iters, options);
+    counter.Stop();
+
+    if (options.speedup != MS_SPEEDUP_NONE)
+        cout << "Pixels resolved by trajectory reuse: " << stats.reused << " of " << stats.pixels
+             << " (" << 100.0 * stats.reused / stats.pixels << "%)" << endl;
+    if (verbose)
+        cout << "Instruction set: " << CPU_IsaName(MS_SimdIsa(options.simd)) << endl;
+    if (verbose)
+        cout << "Iterations: " << stats.iterations << ", " << (double)stats.iterations / stats.pixels
+             << " per pixel" << (stats.levels > 1 ? " with all levels" : "") << ", " << stats.capped << " pixels stopped at the limit of " << num_iters << endl;
+    if (verbose && stats.levels > 1)
+        for (int l = stats.levels - 1; l >= 0; l--)
+            cout << "Iterations at level " << l << ": " << stats.level_iterations[l] << endl;
+    if (verbose)
+    {
+        if (counter.Available())
+            cout << "Cache misses: " << counter.Misses() << endl;
+        else
+            cout << "Cache misses: not available" << endl;
+    }
+    if (diagnostics_prefix && !MS_WriteDiagnostics(diagnostics, diagnostics_prefix))
+        std::cerr << "Can not write the diagnostics " << diagnostics_prefix << "_*" << std::endl;
  
     //Save segmented image
-    io_png_write_u8(filename_segment.c_str(), segmented, width, height, 3);
+    int status = 0;
+    if (!WriteImage(filename_segment.c_str(), segmented, width, height, false, &png, options.num_threads))
+    {
+        std::cerr << "Can not write " << filename_segment << std::endl;
+        status = 1;
+    }
+    if (labels_filename && !WriteLabelFile(labels_filename, ilabels, width, height, regions.count, &regions.colors[0]))
+        std::cerr << "Can not write the labels " << labels_filename << std::endl;
     
-    // Optional; save the filtered image
-    if (argc == 7){
-      const string filename_filtered = argv[6]; // Filename for filtered image
-      uchar *rgb = ConvertLUV2RGB(filtered, width, height, 3); // Convert to ConvertLUV2RGB
-      io_png_write_u8(filename_filtered.c_str(), rgb, width, height, 3);
-      
-      delete [] rgb;
+    // Optional; save the filtered image, converted to RGB unless it is written as L*u*v
+    if (argc - optind == 6){
+      const string filename_filtered = args[5]; // Filename for filtered image
+      if (!WriteImage(filename_filtered.c_str(), filtered, width, height, true, &png, options.num_threads))
+      {
+          std::cerr << "Can not write " << filename_filtered << std::endl;
+          status = 1;
+      }
      }
     
-    for(size_t i=0; i<height; i++) delete [] ilabels[i];
+    for(int i=0; i<height; i++) delete [] ilabels[i];
     delete [] ilabels;
 
     delete [] segmented;
     delete [] filtered;
-    free (image);
     
-    return 0;
+    return status;
 }
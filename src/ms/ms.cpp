@@ -12,8 +12,11 @@
 
 
 #include "ms.h"
-#include <stack>
+#include <algorithm>
+#include <unistd.h>
 #include "../ra/TransitiveClosure.h"
+#include "../parallel/ThreadPool.h"
+#include "mskernel.h"
 
 
 /**
@@ -26,17 +29,17 @@
 
 
 
-/*! \brief Function AddToStack add point to the stack.
+/*! \brief Function AddToStack add point to the stack, the last point is the top.
 *
 *  \param i  x coordinate of the point
 *  \param j  y coordinate of the point
 */
-void AddToStack(std::stack<MSPoint> &stack, int i, int j)
+void AddToStack(std::vector<MSPoint> &stack, int i, int j)
 {
     MSPoint p;
     p.x = i;
     p.y = j;
-    stack.push(p);
+    stack.push_back(p);
 }
 
 /*! \brief Function MeanShift runs two phases of Mean shift algorithm Filter and Segment using Meanshift algorithm
@@ -58,6 +61,16 @@ void AddToStack(std::stack<MSPoint> &stack, int i, int j)
 */
 
 uchar* MeanShift(uchar* image, uchar* filtered_luv, int **labels, int width, int height, int spatial_radius, double color_radius, int minRegion, int num_iters)
+{
+    return MeanShift(image, filtered_luv, labels, width, height, spatial_radius, color_radius, minRegion, num_iters, MSOptions());
+}
+
+/*! \brief Function MeanShift runs Filter and Segment phases with the filter settings given in options
+*
+*  \param options settings of the filter phase
+*  \return segmented image
+*/
+uchar* MeanShift(uchar* image, uchar* filtered_luv, int **labels, int width, int height, int spatial_radius, double color_radius, int minRegion, int num_iters, const MSOptions &options)
 {
     int regCount;
  
@@ -65,7 +78,7 @@ uchar* MeanShift(uchar* image, uchar* filtered_luv, int **labels, int width, int
     // filtered image is in L*u*v colorspace
         
     uchar *filt;
-    filt = MS_Filter(image, width, height, spatial_radius, color_radius, num_iters);
+    filt = MS_Filter(image, width, height, spatial_radius, color_radius, num_iters, options);
     
     memcpy(filtered_luv, filt, height*width*3);
     
@@ -76,14 +89,695 @@ uchar* MeanShift(uchar* image, uchar* filtered_luv, int **labels, int width, int
     memcpy(segmented, filt, height*width*3);
   
     // Label regions in the segmented image with labels
-    LabelImage(segmented, width, height, labels, regCount);
+    vector<int> color = options.color_seed ? GenerateRandomNumbers(regCount, options.color_seed) : GenerateRandomNumbers(regCount);
+    LabelImage(segmented, width, height, labels, color);
+    if(options.regions)
+    {
+        // regCount counts the regions before the small ones are merged, the labels are renumbered
+        int count = 0;
+        for(int i = 0; i < height; i++)
+            for(int j = 0; j < width; j++)
+                count = max(count, labels[i][j] + 1);
+        options.regions->count = count;
+        options.regions->colors.resize(3 * count);
+        for(int k = 0; k < count; k++)
+            for(int c = 0; c < 3; c++)
+                options.regions->colors[3 * k + c] = (uchar)((color[k] >> (8 * c)) & 255);
+    }
         
     delete [] filt;
     return segmented;
 }
 
 
-/*! \brief Function MS_Filter filter image usign Meanshift algorithm using a circular flat kernel and color distance in L*u*v colorspace
+/*! \brief Function MS_AccumulateScalar sums the neighbours of the window whose color lies inside the color radius
+*
+*  This is the reference for the vectorized versions in ms_avx2.cpp and ms_avx512.cpp.
+*
+*  \param src planar image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param sums accumulated sums
+*/
+void MS_AccumulateScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                         float L, float U, float V, double color_radius_squared, MSWindowSums *sums)
+{
+    float mi = 0;
+    float mj = 0;
+    float mL = 0;
+    float mU = 0;
+    float mV = 0;
+    int  num = 0;
+
+    for (int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *rowL = src.plane[0] + jj * src.stride;
+        const uchar *rowU = src.plane[1] + jj * src.stride;
+        const uchar *rowV = src.plane[2] + jj * src.stride;
+
+        for (int ii = ifrom; ii < ito; ii++)
+        {
+
+            float L2 = rowL[ii];
+            float U2 = rowU[ii];
+            float V2 = rowV[ii];
+
+            double dL = L2 - L;
+            double dU = U2 - U;
+            double dV = V2 - V;
+
+            if (dL * dL + dU * dU + dV * dV <= color_radius_squared)
+            {
+                mi += ii;
+                mj += jj;
+                mL += L2;
+                mU += U2;
+                mV += V2;
+                num++;
+            }
+        }
+    }
+
+    sums->mi = mi;
+    sums->mj = mj;
+    sums->mL = mL;
+    sums->mU = mU;
+    sums->mV = mV;
+    sums->num = num;
+}
+
+/*! \brief Function MS_AccumulatePackedScalar is MS_AccumulateScalar for the packed L u v X layout.
+*  Neighbours in the border of the image have X == 0 and are skipped, so the window may
+*  reach into the border and needs no clamping.
+*
+*  \param src packed image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param sums accumulated sums
+*/
+void MS_AccumulatePackedScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                               float L, float U, float V, double color_radius_squared, MSWindowSums *sums)
+{
+    float mi = 0;
+    float mj = 0;
+    float mL = 0;
+    float mU = 0;
+    float mV = 0;
+    int  num = 0;
+
+    for (int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *p = src.packed + jj * src.stride + ifrom * IMAGE_PACKED_BYTES;
+
+        for (int ii = ifrom; ii < ito; ii++, p += IMAGE_PACKED_BYTES)
+        {
+            float L2 = p[0];
+            float U2 = p[1];
+            float V2 = p[2];
+
+            double dL = L2 - L;
+            double dU = U2 - U;
+            double dV = V2 - V;
+
+            if (p[3] && dL * dL + dU * dU + dV * dV <= color_radius_squared)
+            {
+                mi += ii;
+                mj += jj;
+                mL += L2;
+                mU += U2;
+                mV += V2;
+                num++;
+            }
+        }
+    }
+
+    sums->mi = mi;
+    sums->mj = mj;
+    sums->mL = mL;
+    sums->mU = mU;
+    sums->mV = mV;
+    sums->num = num;
+}
+
+/*! \brief Function MS_ParseSimd parses the name of an instruction set: auto, scalar, avx2 or avx512
+*
+*  \param name name of the instruction set
+*  \param simd parsed instruction set
+*  \return false if the name is unknown
+*/
+bool MS_ParseSimd(const char *name, MSSimd *simd)
+{
+    if(strcmp(name, "auto") == 0)
+        *simd = MS_SIMD_AUTO;
+    else if(strcmp(name, "scalar") == 0)
+        *simd = MS_SIMD_SCALAR;
+    else if(strcmp(name, "avx2") == 0)
+        *simd = MS_SIMD_AVX2;
+    else if(strcmp(name, "avx512") == 0)
+        *simd = MS_SIMD_AVX512;
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Function MS_ParseHistogram parses the iterations computed from the histogram: none, first or all
+*
+*  \param name name of the histogram use
+*  \param histogram parsed histogram use
+*  \return false if the name is unknown
+*/
+bool MS_ParseHistogram(const char *name, MSHistogramUse *histogram)
+{
+    if(strcmp(name, "none") == 0)
+        *histogram = MS_HISTOGRAM_NONE;
+    else if(strcmp(name, "first") == 0)
+        *histogram = MS_HISTOGRAM_FIRST;
+    else if(strcmp(name, "all") == 0)
+        *histogram = MS_HISTOGRAM_ALL;
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Function MS_ParseTraversal parses the order of the pixels: rows, tiles or morton
+*
+*  \param name name of the order
+*  \param traversal parsed order
+*  \return false if the name is unknown
+*/
+bool MS_ParseTraversal(const char *name, MSTraversal *traversal)
+{
+    if(strcmp(name, "rows") == 0)
+        *traversal = MS_TRAVERSAL_ROWS;
+    else if(strcmp(name, "tiles") == 0)
+        *traversal = MS_TRAVERSAL_TILES;
+    else if(strcmp(name, "morton") == 0)
+        *traversal = MS_TRAVERSAL_MORTON;
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Function MS_ParseKernelName parses the name of a kernel: flat, epanechnikov or gaussian
+*
+*  \param name name of the kernel
+*  \param length length of the name
+*  \param kernel parsed kernel
+*  \return false if the name is unknown
+*/
+static bool MS_ParseKernelName(const char *name, size_t length, MSKernel *kernel)
+{
+    static const char *names[] = {"flat", "epanechnikov", "gaussian"};
+    static const MSKernel kernels[] = {MS_KERNEL_FLAT, MS_KERNEL_EPANECHNIKOV, MS_KERNEL_GAUSSIAN};
+
+    for(int k = 0; k < 3; k++)
+        if(strlen(names[k]) == length && strncmp(name, names[k], length) == 0)
+        {
+            *kernel = kernels[k];
+            return true;
+        }
+    return false;
+}
+
+/*! \brief Function MS_ParseKernel parses the kernels spatial:range, a single name selects it for both
+*
+*  \param name names of the kernels
+*  \param spatial parsed spatial kernel
+*  \param range parsed range kernel
+*  \return false if a name is unknown
+*/
+bool MS_ParseKernel(const char *name, MSKernel *spatial, MSKernel *range)
+{
+    const char *colon = strchr(name, ':');
+
+    if(!colon)
+        return MS_ParseKernelName(name, strlen(name), spatial) && MS_ParseKernelName(name, strlen(name), range);
+    return MS_ParseKernelName(name, colon - name, spatial) && MS_ParseKernelName(colon + 1, strlen(colon + 1), range);
+}
+
+/*! \brief Function MS_ParseSpeedUp parses the name of a speed-up level: none, medium or high
+*
+*  \param name name of the speed-up level
+*  \param speedup parsed speed-up level
+*  \return false if the name is unknown
+*/
+bool MS_ParseSpeedUp(const char *name, MSSpeedUp *speedup)
+{
+    if(strcmp(name, "none") == 0)
+        *speedup = MS_SPEEDUP_NONE;
+    else if(strcmp(name, "medium") == 0)
+        *speedup = MS_SPEEDUP_MEDIUM;
+    else if(strcmp(name, "high") == 0)
+        *speedup = MS_SPEEDUP_HIGH;
+    else
+        return false;
+    return true;
+}
+
+/*! \brief Function MS_SimdIsa returns the instruction set of the kernels for an option of the filter.
+*  Instruction sets not supported by the processor fall back to the next narrower one.
+*
+*  \param simd option of the filter, MS_SIMD_AUTO for CPU_Selected()
+*  \return instruction set
+*/
+CpuIsa MS_SimdIsa(MSSimd simd)
+{
+    CpuIsa isa;
+
+    switch(simd)
+    {
+    case MS_SIMD_SCALAR:
+        isa = CPU_ISA_SCALAR;
+        break;
+    case MS_SIMD_AVX2:
+        isa = CPU_ISA_AVX2;
+        break;
+    case MS_SIMD_AVX512:
+        isa = CPU_ISA_AVX512;
+        break;
+    default:
+        return CPU_Selected();
+    }
+    return isa < CPU_Supported() ? isa : CPU_Supported();
+}
+
+/*! \brief Function MS_SelectAccumulate returns the accumulation function for an instruction set
+*
+*  \param isa instruction set supported by the processor
+*  \param packed true for the packed L u v X layout
+*  \return accumulation function
+*/
+static MSAccumulateFunc MS_SelectAccumulate(CpuIsa isa, bool packed)
+{
+    if(isa == CPU_ISA_AVX512)
+        return packed ? MS_AccumulatePackedAVX512 : MS_AccumulateAVX512;
+    if(isa == CPU_ISA_AVX2)
+        return packed ? MS_AccumulatePackedAVX2 : MS_AccumulateAVX2;
+    return packed ? MS_AccumulatePackedScalar : MS_AccumulateScalar;
+}
+
+/*! \brief Function MS_SelectAccumulateInt returns the accumulation function of the integer filter.
+*  The packed layout has only the scalar version.
+*
+*  \param isa instruction set supported by the processor
+*  \param packed true for the packed L u v X layout
+*  \return accumulation function
+*/
+static MSAccumulateIntFunc MS_SelectAccumulateInt(CpuIsa isa, bool packed)
+{
+    if(packed)
+        return MS_AccumulatePackedIntScalar;
+    if(isa == CPU_ISA_AVX512)
+        return MS_AccumulateIntAVX512;
+    if(isa == CPU_ISA_AVX2)
+        return MS_AccumulateIntAVX2;
+    return MS_AccumulateIntScalar;
+}
+
+/*! \brief Function MS_SelectWindowBatch returns the window sums of the lockstep filter. The vectorized
+*  version needs the flat kernel and the packed layout with a border of the spatial radius.
+*
+*  \param isa instruction set supported by the processor
+*  \param luv image the neighbours are read from
+*  \param spatial_radius spatial radius
+*  \param flat true for the flat kernel
+*  \return window sums of many pixels
+*/
+static MSWindowBatchFunc MS_SelectWindowBatch(CpuIsa isa, const AlignedImage &luv, int spatial_radius, bool flat)
+{
+    if(isa == CPU_ISA_AVX512 && flat && luv.IsPacked() && luv.Border() >= spatial_radius)
+        return MS_WindowBatchPackedAVX512;
+    return MS_WindowBatch;
+}
+
+/*! \brief Function MS_MakeSource describes an AlignedImage for the accumulation functions
+*
+*  \param luv image in L*u*v colorspace
+*  \return source of the neighbours
+*/
+static MSSource MS_MakeSource(const AlignedImage &luv)
+{
+    MSSource src;
+
+    src.packed = luv.IsPacked() ? luv.Origin() : NULL;
+    for(int c = 0; c < 3; c++)
+        src.plane[c] = luv.IsPacked() ? NULL : luv.Plane(c + 1);
+    src.stride = luv.Stride();
+    src.border = luv.Border();
+    return src;
+}
+
+
+/*! \brief Function MS_WindowSquare sums the square window of side 2 * spatial_radius + 1 around the pixel (i, j).
+*  The window is clamped to the image, unless the image is packed and its border is at least
+*  as wide as the spatial radius; then border neighbours are rejected by their X flag.
+*
+*  \param ctx filter settings
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param L, U, V color of the window center
+*  \param sums accumulated sums
+*/
+void MS_WindowSquare(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums)
+{
+    int ifrom = i - ctx.spatial_radius, ito = i + ctx.spatial_radius + 1;
+    int jfrom = j - ctx.spatial_radius, jto = j + ctx.spatial_radius + 1;
+
+    if(!ctx.src.packed || ctx.src.border < ctx.spatial_radius)
+    {
+        ifrom = max(0, ifrom);
+        ito = min(ctx.width, ito);
+        jfrom = max(0, jfrom);
+        jto = min(ctx.height, jto);
+    }
+
+    // rows relative to the pixel, so that the sums do not depend on the band the pixel is in
+    ctx.accumulate(MS_ShiftRows(ctx.src, j), ifrom, ito, jfrom - j, jto - j, L, U, V, ctx.color_radius_squared, sums);
+}
+
+
+/*! \brief Function MS_FilterPixel runs the Meanshift iterations for the pixel (i, j)
+*
+*  The window is fixed at the pixel, the iterations move only the color center.
+*
+*  \param ctx filter settings
+*  \param worker mode table and histogram of the thread
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param luv converted L, u and v value
+*/
+static void MS_FilterPixel(const MSFilterContext &ctx, MSWorker &worker, int i, int j, uchar *luv)
+{
+    MSReuse *reuse = worker.reuse;
+
+    if(reuse && MS_ReuseLookup(reuse, i, j, luv))
+    {
+        if(ctx.diagnostics)
+            MS_Diagnose(ctx, i, j, 0, 0, 0, false);
+        return;
+    }
+
+    const MSSource &src = ctx.src;
+    int ic = i;
+    int jc = j + ctx.row_offset;   // in the rows of the whole image
+    int icOld, jcOld;
+    float LOld, UOld, VOld;
+    float L, U, V;
+
+    if(src.packed)
+    {
+        const uchar *p = src.packed + j * src.stride + i * IMAGE_PACKED_BYTES;
+        L = p[0];
+        U = p[1];
+        V = p[2];
+    }
+    else
+    {
+        L = src.plane[0][j * src.stride + i];
+        U = src.plane[1][j * src.stride + i];
+        V = src.plane[2][j * src.stride + i];
+    }
+    if(ctx.start)
+    {
+        // mode of the coarser level of the pyramid
+        L = ctx.start->Get(i, j, 1);
+        U = ctx.start->Get(i, j, 2);
+        V = ctx.start->Get(i, j, 3);
+    }
+
+    double ms_shift = 5; // initial value of mean shift
+    int iters;
+    int num = 0; // support of the last window
+
+    for (iters = 0; ms_shift > 1 && iters < ctx.num_iters; iters++)
+    {
+        MSWindowSums sums;
+        sums.num = 0;
+        if(worker.histogram && iters < ctx.histogram_iters)
+        {
+            // iteration from the bins of the sliding histogram
+            MSIntSums hsums;
+            MS_HistogramQuery(ctx, worker.histogram, L, U, V, &hsums);
+            sums.mi = (float)hsums.mi;
+            sums.mj = (float)(hsums.mj - hsums.num * j);
+            sums.mL = (float)hsums.mL;
+            sums.mU = (float)hsums.mU;
+            sums.mV = (float)hsums.mV;
+            sums.num = hsums.num;
+        }
+        // no bin is inside the color radius, sum the window
+        if(sums.num == 0)
+            ctx.window(ctx, i, j, L, U, V, &sums);
+        num = sums.num;
+
+        icOld = ic;
+        jcOld = jc;
+         LOld = L;
+         UOld = U;
+         VOld = V;
+         
+        //  Calculate value for uniform kernel, weighted kernels divide by the sum of the weights
+        const float count = ctx.kernel ? sums.weight : sums.num;
+        float num_ = 1.f / count;
+        L = sums.mL * num_;
+        U = sums.mU * num_;
+        V = sums.mV * num_;
+        ic = (int) (sums.mi * num_ + 0.5);
+        jc = (int) ((sums.mj + count * (j + ctx.row_offset)) * num_ + 0.5);
+        int di = ic - icOld;
+        int dj = jc - jcOld;
+        double dL = L - LOld;
+        double dU = U - UOld;
+        double dV = V - VOld;
+
+        // calculate mean shift vector
+        ms_shift = di * di + dj * dj + dL * dL + dU * dU + dV * dV;
+
+        if(reuse && MS_ReuseStep(ctx, reuse, i, j, ic, jc - ctx.row_offset, L, U, V, luv))
+        {
+            MS_ReuseFinish(reuse, i, j, luv);
+            worker.iterations += iters + 1;
+            if(ctx.diagnostics)
+                MS_Diagnose(ctx, i, j, iters + 1, ms_shift, num, false);
+            return;
+        }
+    }
+    // Set pixel L, U and v values
+    luv[0] = (uchar)L;
+    luv[1] = (uchar)U;
+    luv[2] = (uchar)V;
+
+    worker.iterations += iters;
+    if(ms_shift > 1)
+        worker.capped++;
+    if(ctx.diagnostics)
+        MS_Diagnose(ctx, i, j, iters, ms_shift, num, ms_shift > 1);
+
+    if(reuse)
+        MS_ReuseFinish(reuse, i, j, luv);
+}
+
+
+/*! \brief Function MS_SetupReuse prepares the mode table of the trajectory reuse for a region of the image
+*
+*  \param reuse mode table
+*  \param table state of every pixel
+*  \param mode assigned mode of every pixel
+*  \param width width of the image
+*  \param x0, y0, x1, y1 region [x0, x1) x [y0, y1)
+*  \param speedup speed-up level
+*/
+static void MS_SetupReuse(MSReuse *reuse, uchar *table, uchar *mode, int width, int x0, int y0, int x1, int y1, MSSpeedUp speedup)
+{
+    reuse->table = table;
+    reuse->mode = mode;
+    reuse->width = width;
+    reuse->x0 = x0;
+    reuse->y0 = y0;
+    reuse->x1 = x1;
+    reuse->y1 = y1;
+    reuse->reach = speedup == MS_SPEEDUP_HIGH ? 1 : 0;
+    reuse->reused = 0;
+}
+
+
+#define MS_TILE_WIDTH 64    // width of the tiles of the parallel and the lockstep filter
+#define MS_TILE_HEIGHT 16   // height of the tiles of the parallel and the lockstep filter
+#define MS_L2_CACHE_SIZE (256 * 1024)   // L2 cache size if the system does not tell it
+
+/*! \brief Function MS_CacheTileSize returns the side of square tiles whose neighbours fit into half of the L2 cache
+*
+*  \param spatial_radius spatial radius, the apron of a tile
+*  \param bytes bytes of a pixel of the image the neighbours are read from
+*  \return side of the tiles, a multiple of 16
+*/
+static int MS_CacheTileSize(int spatial_radius, int bytes)
+{
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+    if(l2 <= 0)
+        l2 = MS_L2_CACHE_SIZE;
+
+    // (side + 2 * spatial_radius)^2 pixels are read by a tile
+    int side = (int)sqrt(l2 / 2.0 / bytes) - 2 * spatial_radius;
+    return max(16, side / 16 * 16);
+}
+
+/*! \brief Function MS_Morton interleaves the bits of x and y, x in the even bits
+*
+*  \param x, y coordinates below 2^16
+*  \return Z-order index
+*/
+static unsigned MS_Morton(unsigned x, unsigned y)
+{
+    unsigned z = 0;
+
+    for(int b = 0; b < 16; b++)
+        z |= ((x >> b) & 1) << (2 * b) | ((y >> b) & 1) << (2 * b + 1);
+    return z;
+}
+
+/*! \brief Function MS_MortonX extracts x from a Z-order index, MS_MortonX(z >> 1) extracts y
+*
+*  \param z Z-order index
+*  \return coordinate in the even bits
+*/
+static unsigned MS_MortonX(unsigned z)
+{
+    unsigned x = 0;
+
+    for(int b = 0; b < 16; b++)
+        x |= ((z >> (2 * b)) & 1) << b;
+    return x;
+}
+
+/*Structure MSMortonLess orders tiles by the Z-order index of their position */
+struct MSMortonLess
+{
+    int tiles_x;
+    bool operator()(int a, int b) const
+    {
+        return MS_Morton(a % tiles_x, a / tiles_x) < MS_Morton(b % tiles_x, b / tiles_x);
+    }
+};
+
+/*! \brief Function MS_FilterRegion filters the pixels of a region in row-major order, or with ctx.morton
+*  in Z-order. With a histogram, the histogram slides along every row of the region. With ctx.window_batch
+*  the pixels iterate in lockstep, see mslockstep.cpp.
+*
+*  \param ctx filter settings
+*  \param worker mode table and histogram of the thread
+*  \param x0, y0, x1, y1 region [x0, x1) x [y0, y1)
+*  \param dst output image
+*/
+static void MS_FilterRegion(const MSFilterContext &ctx, MSWorker &worker, int x0, int y0, int x1, int y1, AlignedImage *dst)
+{
+    if(ctx.window_batch)
+    {
+        // tiles keep the live pixels in the cache
+        for(int y = y0; y < y1; y += MS_TILE_HEIGHT)
+            for(int x = x0; x < x1; x += MS_TILE_WIDTH)
+                MS_FilterRegionLockstep(ctx, worker, x, y, min(x1, x + MS_TILE_WIDTH), min(y1, y + MS_TILE_HEIGHT), dst);
+        return;
+    }
+
+    uchar luv[3];
+
+    if(ctx.morton && !worker.histogram)
+    {
+        // Z-order of the square of power of 2 side around the region, positions outside are skipped
+        unsigned side = 1;
+        while(side < (unsigned)max(x1 - x0, y1 - y0))
+            side *= 2;
+
+        for(unsigned z = 0; z < side * side; z++)
+        {
+            int i = x0 + (int)MS_MortonX(z);
+            int j = y0 + (int)MS_MortonX(z >> 1);
+            if(i >= x1 || j >= y1)
+                continue;
+
+            ctx.pixel(ctx, worker, i, j, luv);
+            dst->Set(i, j, 1, luv[0]);
+            dst->Set(i, j, 2, luv[1]);
+            dst->Set(i, j, 3, luv[2]);
+        }
+        return;
+    }
+
+    for(int j = y0; j < y1; j++)
+    {
+        if(worker.histogram)
+            MS_HistogramStart(ctx, worker.histogram, x0, j);
+
+        for(int i = x0; i < x1; i++)
+        {
+            ctx.pixel(ctx, worker, i, j, luv);
+            dst->Set(i, j, 1, luv[0]);
+            dst->Set(i, j, 2, luv[1]);
+            dst->Set(i, j, 3, luv[2]);
+
+            if(worker.histogram && i + 1 < x1)
+                MS_HistogramNext(ctx, worker.histogram);
+        }
+
+        if(worker.histogram)
+            MS_HistogramClear(ctx, worker.histogram);
+    }
+}
+
+
+#define MS_PYRAMID_MIN_SIZE 16 // smallest width and height of a coarser level of the pyramid
+
+/*Class MSFilterTiles filters one tile of the image per task */
+class MSFilterTiles : public ParallelTask
+{
+public:
+    MSFilterContext ctx;
+    AlignedImage *dst;
+    int tile_width, tile_height;
+    int tiles_x;
+    const int *order;       // tile of every task, NULL for row-major order
+    MSSpeedUp speedup;
+    uchar *mode_table;      // mode table of the trajectory reuse, a tile assigns only its own pixels
+    uchar *modes;
+    MSFilterStats *task_stats;  // statistics of every tile
+    MSHistogram *histograms;    // histogram of every worker, NULL without histogram
+
+    void Execute(int task, int worker)
+    {
+        int tile = order ? order[task] : task;
+        int x0 = (tile % tiles_x) * tile_width;
+        int y0 = (tile / tiles_x) * tile_height;
+        int x1 = min(ctx.width, x0 + tile_width);
+        int y1 = min(ctx.height, y0 + tile_height);
+        MSReuse reuse;
+        MSWorker state;
+        MSFilterStats &stats = task_stats[task];
+
+        MS_SetupReuse(&reuse, mode_table, modes, ctx.width, x0, y0, x1, y1, speedup);
+        state.reuse = speedup != MS_SPEEDUP_NONE ? &reuse : NULL;
+        state.histogram = histograms ? &histograms[worker] : NULL;
+        state.iterations = 0;
+        state.capped = 0;
+
+        MS_FilterRegion(ctx, state, x0, y0, x1, y1, dst);
+        stats.pixels = (x1 - x0) * (y1 - y0);
+        stats.reused = reuse.reused;
+        stats.iterations = state.iterations;
+        stats.capped = state.capped;
+    }
+};
+
+
+/*! \brief Function MS_Filter filter image usign Meanshift algorithm using a flat kernel and color distance in L*u*v colorspace
+*
+*  The window of a pixel is the square of side 2 * spatial_radius + 1 centered at the pixel, or with
+*  options.disc the disc of radius spatial_radius.
 *
 *  Based on implementation from https://imagej.nih.gov/ij/plugins/download/Mean_Shift.java
 *
@@ -102,93 +796,353 @@ uchar* MeanShift(uchar* image, uchar* filtered_luv, int **labels, int width, int
 */
 uchar* MS_Filter(uchar* image, int width, int height, int spatial_radius, double color_radius, int initIters)
 {
-    double color_radius_squared = color_radius * color_radius;
+    return MS_Filter(image, width, height, spatial_radius, color_radius, initIters, MSOptions());
+}
 
-    // Convert image to L*u*v colorspace
-    uchar * luv = ConvertRGB2LUV(image, width, height, 3);
-    // Initialize number of iterations
-    int  num_iters=initIters;
+/*! \brief Function MS_FilterPlanar filters a planar L*u*v image as MS_Filter
+*
+*  \param luv planar image in L*u*v colorspace
+*  \param options settings of the filter
+*  \return luv filtered in place, or a new image if the filter needs a separate buffer
+*/
+static uchar* MS_FilterPlanar(uchar* luv, int width, int height, int spatial_radius, double color_radius, int initIters, const MSOptions &options)
+{
+    AlignedImage source;
 
-    for(int j = 0; j < height; j++)
-        for(int i = 0; i < width; i++)
-        {
-            int ic = i;
-            int jc = j;
-            int icOld, jcOld;
-            float LOld, UOld, VOld;
+    if(options.packed)
+    {
+        // packed copy with a border of spatial_radius, the window needs no clamping
+        source.Allocate(width, height, 3, IMAGE_PACKED, spatial_radius);
+        source.CopyFromPlanar(luv);
+    }
+    else
+        source.Wrap(luv, width, height, 3);
 
-            float L = GetPixel(luv, width, height, i, j, 1);
-            float U = GetPixel(luv, width, height, i, j, 2);
-            float V = GetPixel(luv, width, height, i, j, 3);
+    if(options.num_threads <= 0)
+    {
+        MS_Filter(source, source, spatial_radius, color_radius, initIters, options);
+        if(options.packed)
+            source.CopyToPlanar(luv);
+        return luv;
+    }
 
-            double ms_shift = 5; // initial value of mean shift
+    uchar *filtered = AllocateUcharImage(width, height, 3);
+    AlignedImage destination;
+    destination.Wrap(filtered, width, height, 3);
 
-            for (int iters = 0; ms_shift > 1 && iters < num_iters; iters++)
-            {
-                float mi = 0;
-                float mj = 0;
-                float mL = 0;
-                float mU = 0;
-                float mV = 0;
-                int  num = 0;
+    MS_Filter(source, destination, spatial_radius, color_radius, initIters, options);
 
-                int ifrom = max(0, i - spatial_radius), ito = min(width, i + spatial_radius + 1);
-                int jfrom = max(0, j - spatial_radius), jto = min(height, j + spatial_radius + 1);
+    return filtered;
+}
 
-                for (int jj = jfrom; jj < jto; jj++)
-                {
-                    for (int ii = ifrom; ii < ito; ii++)
-                    {
+/*! \brief Function MS_Filter filter image usign Meanshift algorithm with the settings given in options
+*
+*  With options.num_threads == 0 the pixels are filtered in place in row-major order, so later pixels
+*  see the already filtered values of earlier ones. With options.num_threads > 0 neighbours are read
+*  from an unmodified copy of the L*u*v image and results go to a separate buffer; the image is split
+*  into tiles which are dispatched to a work-stealing thread pool, and the result does not depend
+*  on the number of threads. With options.packed the L*u*v image is copied to the packed L u v X
+*  layout, so every neighbour is a single 4 byte access. With options.integer the filter computes
+*  with integers only, see msint.cpp. With options.speedup pixels close to the trajectory of another
+*  pixel take its mode without iterating, see msreuse.cpp; with the parallel filter trajectories
+*  are reused within a tile only, so the result still does not depend on the number of threads.
+*  options.spatial_kernel and options.range_kernel weight the neighbours, see msweighted.cpp; the
+*  integer filter and the histogram use the flat kernel.
+*  With options.histogram the first iteration of a pixel, or all of them, are computed from a
+*  sliding histogram of its window, see mshistogram.cpp; the neighbours are then read from an
+*  unmodified image also without threads.
+*  With options.traversal the image is visited in tiles sized for the L2 cache, in row-major order
+*  or in Z-order, and neighbours are read from an unmodified image also without threads.
+*  With options.lockstep all pixels of a tile iterate together and converged pixels are removed
+*  after every iteration, see mslockstep.cpp; the neighbours are read from an unmodified image.
+*  With options.luv the image is taken as L*u*v and only copied.
+*
+*  \param options settings of the filter
+*  \return luv Meanshift filtered image in L*u*v colorspace.
+*/
+uchar* MS_Filter(uchar* image, int width, int height, int spatial_radius, double color_radius, int initIters, const MSOptions &options)
+{
+    // Convert image to L*u*v colorspace, the filter below works on the copy
+    uchar * luv;
+    if(options.luv)
+    {
+        luv = AllocateUcharImage(width, height, 3);
+        memcpy(luv, image, (size_t)width * height * 3);
+    }
+    else
+        luv = ConvertRGB2LUV(image, width, height, 3);
 
-                        float L2 = GetPixel(luv, width, height, ii, jj, 1);
-                        float U2 = GetPixel(luv, width, height, ii, jj, 2);
-                        float V2 = GetPixel(luv, width, height, ii, jj, 3);
+    uchar *filtered = MS_FilterPlanar(luv, width, height, spatial_radius, color_radius, initIters, options);
+    if(filtered != luv)
+        delete [] luv;
+    return filtered;
+}
 
-                        double dL = L2 - L;
-                        double dU = U2 - U;
-                        double dV = V2 - V;
+/*! \brief Function MS_FilterLUV filters a planar L*u*v image in place, with the settings of MS_Filter;
+*  options.luv is not used. An image decoded straight to L*u*v, see InputImage, is filtered without
+*  a conversion or a copy when options.num_threads is 0.
+*
+*  \param luv planar image in L*u*v colorspace, replaced by the filtered image
+*  \param width width of the image
+*  \param height height of the image
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param initIters maximal number of iterations
+*  \param options settings of the filter
+*/
+void MS_FilterLUV(uchar* luv, int width, int height, int spatial_radius, double color_radius, int initIters, const MSOptions &options)
+{
+    uchar *filtered = MS_FilterPlanar(luv, width, height, spatial_radius, color_radius, initIters, options);
+    if(filtered != luv)
+    {
+        memcpy(luv, filtered, (size_t)width * height * 3);
+        delete [] filtered;
+    }
+}
 
-                        if (dL * dL + dU * dU + dV * dV <= color_radius_squared)
-                        {
-                            mi += ii;
-                            mj += jj;
-                            mL += L2;
-                            mU += U2;
-                            mV += V2;
-                            num++;
-                        }
-                    }
-                }
+/*! \brief Function MS_FilterLevel filters one level of the image, options.pyramid is not used
+*
+*  \param luv input image in L*u*v colorspace
+*  \param filtered output image of the same size, can be luv
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param num_iters maximal number of iterations
+*  \param options settings of the filter
+*  \param start initial color centers, NULL to start at the color of every pixel
+*/
+static void MS_FilterLevel(const AlignedImage &luv, AlignedImage &filtered, int spatial_radius, double color_radius,
+                           int num_iters, const MSOptions &options, const AlignedImage *start)
+{
+    int width = luv.Width();
+    int height = luv.Height();
+    std::vector<int> halfwidth(2 * spatial_radius + 1);
+    std::vector<uint64_t> reciprocal;
+    std::vector<float> spatial_weights, range_weights;
+    MSKernelTables kernel;
 
-                icOld = ic;
-                jcOld = jc;
-                 LOld = L;
-                 UOld = U;
-                 VOld = V;
-                 
-                //  Calculate value for uniform kernel
-                float num_ = 1.f / num;
-                L = mL * num_;
-                U = mU * num_;
-                V = mV * num_;
-                ic = (int) (mi * num_ + 0.5);
-                jc = (int) (mj * num_ + 0.5);
-                int di = ic - icOld;
-                int dj = jc - jcOld;
-                double dL = L - LOld;
-                double dU = U - UOld;
-                double dV = V - VOld;
-
-                // calculate mean shift vector
-                ms_shift = di * di + dj * dj + dL * dL + dU * dU + dV * dV;
-            }
-            // Set pixel L, U and v values
-            SetPixel(luv, width, height, i, j, (uchar)L, 1); // L
-            SetPixel(luv, width, height, i, j, (uchar)U, 2); // u
-            SetPixel(luv, width, height, i, j, (uchar)V, 3); // v
+    MSFilterContext ctx;
+    ctx.src = MS_MakeSource(luv);
+    ctx.width = width;
+    ctx.height = height;
+    ctx.spatial_radius = spatial_radius;
+    ctx.color_radius_squared = color_radius * color_radius;
+    ctx.num_iters = num_iters;
+    // Select the neighbourhood accumulation for this processor
+    const CpuIsa isa = MS_SimdIsa(options.simd);
+    ctx.accumulate = MS_SelectAccumulate(isa, luv.IsPacked());
+    ctx.window = MS_WindowSquare;
+    ctx.halfwidth = NULL;
+    if(options.disc)
+    {
+        MS_DiscHalfWidths(spatial_radius, &halfwidth[0]);
+        ctx.halfwidth = &halfwidth[0];
+        ctx.window = MS_SelectDiscWindow(spatial_radius, luv.IsPacked(), isa == CPU_ISA_SCALAR);
+    }
+    ctx.kernel = NULL;
+    if((options.spatial_kernel != MS_KERNEL_FLAT || options.range_kernel != MS_KERNEL_FLAT) &&
+       !options.integer && options.histogram == MS_HISTOGRAM_NONE)
+    {
+        ctx.window = MS_SelectKernel(options.spatial_kernel, options.range_kernel, spatial_radius, color_radius,
+                                     luv.IsPacked(), &kernel, spatial_weights, range_weights);
+        ctx.kernel = &kernel;
+    }
+    ctx.start = start;
+    ctx.window_batch = NULL;
+    ctx.row_offset = options.row_offset;
+    ctx.diagnostics = NULL;
+    if(options.diagnostics)
+    {
+        MSDiagnostics *diagnostics = options.diagnostics;
+        diagnostics->width = width;
+        diagnostics->height = height;
+        diagnostics->iterations.assign((size_t)width * height, 0);
+        diagnostics->shift.assign((size_t)width * height, 0);
+        diagnostics->support.assign((size_t)width * height, 0);
+        diagnostics->capped.assign((size_t)width * height, 0);
+        ctx.diagnostics = diagnostics;
+    }
+    ctx.morton = options.traversal == MS_TRAVERSAL_MORTON;
+    ctx.pixel = MS_FilterPixel;
+    ctx.histogram_iters = options.histogram == MS_HISTOGRAM_ALL ? num_iters : 1;
+    ctx.accumulate_int = NULL;
+    ctx.color_radius_int = 0;
+    ctx.reciprocal = NULL;
+    if(options.integer)
+    {
+        reciprocal.resize((2 * spatial_radius + 1) * (2 * spatial_radius + 1) + 1);
+        MS_IntReciprocals((int)reciprocal.size() - 1, &reciprocal[0]);
+        ctx.reciprocal = &reciprocal[0];
+        ctx.color_radius_int = MS_IntColorRadius(color_radius);
+        ctx.accumulate_int = MS_SelectAccumulateInt(isa, luv.IsPacked());
+        ctx.pixel = MS_FilterPixelInt;
+    }
+
+    // the lockstep filter iterates the float kernels without trajectory reuse and histogram
+    if(options.lockstep && !options.integer && options.speedup == MS_SPEEDUP_NONE && options.histogram == MS_HISTOGRAM_NONE)
+        ctx.window_batch = MS_SelectWindowBatch(isa, luv, spatial_radius, ctx.kernel == NULL);
+
+    // Mode table of the trajectory reuse
+    std::vector<uchar> mode_table, modes;
+    if(options.speedup != MS_SPEEDUP_NONE)
+    {
+        mode_table.assign((size_t)width * height, MS_MODE_FREE);
+        modes.resize((size_t)width * height * 3);
+    }
+
+    // the parallel filter, the tiles, the histogram and the lockstep filter must not see the results of the filter
+    const bool tiled = options.num_threads > 0 || options.traversal != MS_TRAVERSAL_ROWS;
+    AlignedImage copy;
+    if(&luv == &filtered && (tiled || options.histogram != MS_HISTOGRAM_NONE || ctx.window_batch))
+    {
+        copy.Allocate(width, height, 3, luv.Layout(), luv.Border());
+        copy.CopyFrom(luv);
+        ctx.src = MS_MakeSource(copy);
+    }
+
+    if(!tiled)
+    {
+        MSReuse reuse;
+        MSHistogram histogram;
+        MSWorker worker;
+
+        MS_SetupReuse(&reuse, mode_table.empty() ? NULL : &mode_table[0], modes.empty() ? NULL : &modes[0],
+                      width, 0, 0, width, height, options.speedup);
+        worker.reuse = options.speedup != MS_SPEEDUP_NONE ? &reuse : NULL;
+        worker.histogram = options.histogram != MS_HISTOGRAM_NONE ? &histogram : NULL;
+        worker.iterations = 0;
+        worker.capped = 0;
+
+        MS_FilterRegion(ctx, worker, 0, 0, width, height, &filtered);
+
+        if(options.stats)
+        {
+            options.stats->pixels = (long)width * height;
+            options.stats->reused = reuse.reused;
+            options.stats->iterations = worker.iterations;
+            options.stats->capped = worker.capped;
+            options.stats->levels = 1;
+            options.stats->level_iterations[0] = worker.iterations;
         }
-        
-    return luv;
+        return;
+    }
+
+    MSFilterTiles tiles;
+    tiles.ctx = ctx;
+    tiles.dst = &filtered;
+    tiles.tile_width = MS_TILE_WIDTH;
+    tiles.tile_height = MS_TILE_HEIGHT;
+    if(options.traversal != MS_TRAVERSAL_ROWS)
+        tiles.tile_width = tiles.tile_height = MS_CacheTileSize(spatial_radius, luv.IsPacked() ? IMAGE_PACKED_BYTES : 3);
+    tiles.tiles_x = (width + tiles.tile_width - 1) / tiles.tile_width;
+    int tiles_y = (height + tiles.tile_height - 1) / tiles.tile_height;
+
+    // tiles close in Z-order are close in the image
+    std::vector<int> order;
+    tiles.order = NULL;
+    if(options.traversal == MS_TRAVERSAL_MORTON)
+    {
+        MSMortonLess less;
+        less.tiles_x = tiles.tiles_x;
+        for(int t = 0; t < tiles.tiles_x * tiles_y; t++)
+            order.push_back(t);
+        std::sort(order.begin(), order.end(), less);
+        tiles.order = &order[0];
+    }
+
+    std::vector<MSFilterStats> task_stats(tiles.tiles_x * tiles_y);
+    tiles.speedup = options.speedup;
+    tiles.mode_table = mode_table.empty() ? NULL : &mode_table[0];
+    tiles.modes = modes.empty() ? NULL : &modes[0];
+    tiles.task_stats = &task_stats[0];
+
+    if(options.num_threads <= 0)
+    {
+        // tiles on the calling thread
+        std::vector<MSHistogram> histograms(options.histogram != MS_HISTOGRAM_NONE ? 1 : 0);
+        tiles.histograms = histograms.empty() ? NULL : &histograms[0];
+        for(int t = 0; t < tiles.tiles_x * tiles_y; t++)
+            tiles.Execute(t, 0);
+    }
+    else
+    {
+        // a pool of the caller stays warm between calls
+        ThreadPool *started = options.pool ? NULL : new ThreadPool(options.num_threads);
+        ThreadPool &pool = options.pool ? *options.pool : *started;
+        std::vector<MSHistogram> histograms(options.histogram != MS_HISTOGRAM_NONE ? pool.Size() : 0);
+        tiles.histograms = histograms.empty() ? NULL : &histograms[0];
+        pool.Run(tiles, tiles.tiles_x * tiles_y);
+        delete started;
+    }
+
+    if(options.stats)
+    {
+        MSFilterStats total = MSFilterStats();
+        for(size_t t = 0; t < task_stats.size(); t++)
+        {
+            total.pixels += task_stats[t].pixels;
+            total.reused += task_stats[t].reused;
+            total.iterations += task_stats[t].iterations;
+            total.capped += task_stats[t].capped;
+        }
+        total.levels = 1;
+        total.level_iterations[0] = total.iterations;
+        *options.stats = total;
+    }
+}
+
+/*! \brief Function MS_Filter filter an image in L*u*v colorspace stored in an AlignedImage
+*
+*  With options.num_threads == 0 the pixels are visited in row-major order on the calling thread;
+*  when luv and filtered are the same image it is filtered in place. With options.num_threads > 0
+*  the image is split into tiles for the thread pool, and neighbours are always read from an
+*  unmodified image.
+*
+*  With options.pyramid the image is first downsampled by 2 and filtered with half the spatial
+*  radius, recursively for the given number of levels. The modes of the coarser level are the
+*  initial color centers of the finer level, see mspyramid.cpp, so most pixels converge after
+*  a few iterations at full resolution.
+*
+*  \param luv input image in L*u*v colorspace
+*  \param filtered output image of the same size, can be luv
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param num_iters maximal number of iterations
+*  \param options settings of the filter
+*/
+void MS_Filter(const AlignedImage &luv, AlignedImage &filtered, int spatial_radius, double color_radius, int num_iters, const MSOptions &options)
+{
+    const int width = luv.Width();
+    const int height = luv.Height();
+
+    if(options.pyramid <= 0 || width < 2 * MS_PYRAMID_MIN_SIZE || height < 2 * MS_PYRAMID_MIN_SIZE)
+    {
+        MS_FilterLevel(luv, filtered, spatial_radius, color_radius, num_iters, options, NULL);
+        return;
+    }
+
+    // coarser level with half the spatial radius, the packed layout keeps a border of the radius
+    const int coarse_radius = (spatial_radius + 1) / 2;
+    AlignedImage coarse((width + 1) / 2, (height + 1) / 2, 3, luv.Layout(), luv.IsPacked() ? coarse_radius : 0);
+    MSOptions coarse_options = options;
+    MSFilterStats coarse_stats = MSFilterStats();
+
+    coarse_options.pyramid = min(options.pyramid, MS_PYRAMID_MAX_LEVELS) - 1;
+    coarse_options.stats = &coarse_stats;
+    coarse_options.diagnostics = NULL;
+    MS_PyramidDownsample(luv, &coarse);
+    MS_Filter(coarse, coarse, coarse_radius, color_radius, num_iters, coarse_options);
+
+    AlignedImage start(width, height, 3);
+    MS_PyramidStart(luv, coarse, color_radius, &start);
+    MS_FilterLevel(luv, filtered, spatial_radius, color_radius, num_iters, options, &start);
+
+    if(options.stats)
+    {
+        options.stats->levels = coarse_stats.levels + 1;
+        options.stats->iterations += coarse_stats.iterations;
+        for(int l = 0; l < coarse_stats.levels; l++)
+            options.stats->level_iterations[l + 1] = coarse_stats.level_iterations[l];
+    }
 }
 
 
@@ -236,6 +1190,19 @@ int MS_Segment(uchar * image, int width, int height, int **labels, double color_
 *  \return regCount number of regions
 */
 int MS_Cluster(uchar  *image, int width, int height, int **labels,int* modePoints, float *mode, double color_radius)
+{
+    std::vector<MSPoint> stack;
+
+    return MS_Cluster(image, width, height, labels, modePoints, mode, color_radius, stack);
+}
+
+/*! \brief Function MS_Cluster cluster the image using Meanshift, with the stack of the flood fill given
+*  by the caller, so that its memory is reused
+*
+*  \param stack stack of the flood fill, empty on return
+*  \return regCount number of regions
+*/
+int MS_Cluster(uchar  *image, int width, int height, int **labels,int* modePoints, float *mode, double color_radius, std::vector<MSPoint> &stack)
 {
     int regCount = 0;
     int lbl = -1;
@@ -266,13 +1233,12 @@ int MS_Cluster(uchar  *image, int width, int height, int **labels,int* modePoint
                 mode[lbl * 3 + 1] = 354 * U / 255 - 134;
                 mode[lbl * 3 + 2] = 256 * V / 255 - 140;
 
-                std::stack<MSPoint> stack;
                 AddToStack(stack, i, j);
 
                 while(!stack.empty())
                 {
-                    MSPoint point = stack.top();
-                    stack.pop();
+                    MSPoint point = stack.back();
+                    stack.pop_back();
                     
                     for(int k = 0; k < 8; k++) // calculate for 8 connected pixels
                     {
@@ -17,11 +17,18 @@
 #include <iostream>
 #include <cmath>
 #include <string.h>
+#include <vector>
+#include <string>
 #include "../image/image.h"
+#include "../cpu/cpu.h"
+#include "../io_png/io_png.h"
+#include "../io_file/ImageFile.h"
 
 
 using namespace std;
 
+class ThreadPool;
+
 /*Structure MSPoint define the stack */
 struct MSPoint
 {
@@ -29,10 +36,282 @@ struct MSPoint
     int y;
 };
 
+/*Enumeration MSSimd selects the instruction set of the neighbourhood accumulation, all give the same result */
+enum MSSimd
+{
+    MS_SIMD_AUTO,       // CPU_Selected(), the widest instruction set supported by the processor unless forced
+    MS_SIMD_SCALAR,     // scalar reference
+    MS_SIMD_AVX2,
+    MS_SIMD_AVX512
+};
+
+/*Enumeration MSSpeedUp selects how much the filter reuses the trajectories of other pixels */
+enum MSSpeedUp
+{
+    MS_SPEEDUP_NONE,    // every pixel is iterated
+    MS_SPEEDUP_MEDIUM,  // pixels at the spatial centers of a trajectory take its mode
+    MS_SPEEDUP_HIGH     // also the pixels around the spatial centers
+};
+
+/*Enumeration MSHistogramUse selects the iterations computed from a sliding histogram of the window */
+enum MSHistogramUse
+{
+    MS_HISTOGRAM_NONE,  // every iteration sums the window
+    MS_HISTOGRAM_FIRST, // the first iteration
+    MS_HISTOGRAM_ALL    // all iterations
+};
+
+/*Enumeration MSKernel selects the profile of a kernel, see msweighted.cpp */
+enum MSKernel
+{
+    MS_KERNEL_FLAT,
+    MS_KERNEL_EPANECHNIKOV,
+    MS_KERNEL_GAUSSIAN
+};
+
+/*Enumeration MSTraversal selects the order in which the filter visits the pixels */
+enum MSTraversal
+{
+    MS_TRAVERSAL_ROWS,      // row-major order, with threads tiles of 64 x 16 pixels
+    MS_TRAVERSAL_TILES,     // tiles sized for the L2 cache, row-major order of the tiles and of their pixels
+    MS_TRAVERSAL_MORTON     // tiles sized for the L2 cache, Z-order of the tiles and of their pixels
+};
+
+#define MS_PYRAMID_MAX_LEVELS 4 // largest number of coarser levels of the pyramid
+
+/*Structure MSFilterStats holds the statistics of a filter run */
+struct MSFilterStats
+{
+    long pixels;        // pixels of the image
+    long reused;        // pixels resolved by trajectory reuse
+    long iterations;    // iterations of all pixels, summed over the levels of the pyramid
+    long capped;        // pixels of the full resolution which stopped at the iteration limit without converging
+    int levels;         // levels of the pyramid, 1 without pyramid
+    long level_iterations[MS_PYRAMID_MAX_LEVELS + 1];   // iterations per level, level 0 is the full resolution
+};
+
+#define MS_DIAGNOSTICS_SHIFT_SCALE 256  // a mean shift of 1, the convergence threshold, is 256 in MSDiagnostics::shift
+
+/*Structure MSDiagnostics holds maps of the convergence of every pixel at full resolution, in row-major
+  order, see msdiagnostics.cpp. Values larger than 65535 are saturated. */
+struct MSDiagnostics
+{
+    int width, height;
+    std::vector<unsigned short> iterations;  // iterations of the pixel, 0 if it took the mode of a reused trajectory
+    std::vector<unsigned short> shift;       // squared mean shift of the last iteration, times MS_DIAGNOSTICS_SHIFT_SCALE
+    std::vector<unsigned short> support;     // neighbours inside the color radius in the last iteration
+    std::vector<unsigned short> capped;      // 1 if the pixel stopped at the iteration limit without converging
+
+    MSDiagnostics() : width(0), height(0) {}
+};
+
+/*Structure MSRegions holds the regions of a segmentation, whose labels are 0 to count - 1 */
+struct MSRegions
+{
+    int count;                  // number of regions
+    std::vector<uchar> colors;  // RGB color of every region in the segmented image, 3 * count bytes
+
+    MSRegions() : count(0) {}
+};
+
+/*Structure MSOptions holds the optional settings of the Meanshift filter */
+struct MSOptions
+{
+    int num_threads;    // 0 runs the reference in-place filter, >0 the double-buffered parallel filter
+    MSSimd simd;        // instruction set of the neighbourhood accumulation
+    bool packed;        // filter a packed L u v X copy with a border of spatial_radius pixels
+    bool disc;          // circular window of radius spatial_radius instead of the square window
+    bool integer;       // fixed-point integer arithmetic instead of floating point
+    MSSpeedUp speedup;  // trajectory reuse
+    MSHistogramUse histogram;   // iterations computed from a sliding histogram of the window
+    MSKernel spatial_kernel;    // weights of the neighbours by their offset
+    MSKernel range_kernel;      // weights of the neighbours by their color distance
+    bool lockstep;      // iterate the pixels of a tile together, converged pixels are removed after every iteration
+    MSTraversal traversal;  // order of the pixels, tiles read from an unmodified image also without threads
+    int pyramid;        // coarser levels of the pyramid which give the initial color centers, 0 without pyramid
+    MSFilterStats *stats;   // filled by the filter if not NULL
+    MSDiagnostics *diagnostics; // filled by the filter if not NULL
+    MSRegions *regions; // filled by MeanShift if not NULL
+    int row_offset;     // the image is a band starting at this row of a larger image, see msbands.cpp
+    bool luv;           // the image given to MS_Filter and MeanShift is already in L*u*v, not RGB
+    unsigned color_seed;    // 0 continues rand() for the colors of the regions, else they are the first numbers after srand(color_seed)
+    ThreadPool *pool;   // workers of the parallel filter if not NULL, else num_threads workers are started per call
+
+    MSOptions() : num_threads(0), simd(MS_SIMD_AUTO), packed(false), disc(false), integer(false),
+                  speedup(MS_SPEEDUP_NONE), histogram(MS_HISTOGRAM_NONE),
+                  spatial_kernel(MS_KERNEL_FLAT), range_kernel(MS_KERNEL_FLAT), lockstep(false), traversal(MS_TRAVERSAL_ROWS), pyramid(0), stats(NULL), diagnostics(NULL), regions(NULL), row_offset(0), luv(false), color_seed(0), pool(NULL) {}
+};
+
+#define MS_BAND_HEIGHT 256  // default rows of a band of the out-of-core filter
+
+/*Class MSRowSource delivers the rows of an RGB image from top to bottom, channels interleaved */
+class MSRowSource
+{
+public:
+    virtual ~MSRowSource() {}
+
+    virtual int Width() const = 0;
+    virtual int Height() const = 0;
+
+    // Read the next count rows into rgb, 3 * Width() bytes per row
+    virtual bool ReadRows(uchar *rgb, int count) = 0;
+};
+
+/*Class MSRowSink accepts the rows of an RGB image from top to bottom, channels interleaved */
+class MSRowSink
+{
+public:
+    virtual ~MSRowSink() {}
+
+    // Write the next count rows, 3 * width bytes per row
+    virtual bool WriteRows(const uchar *rgb, int count) = 0;
+};
+
+/*Class MSPlanarRows reads and writes the rows of a planar RGB image in memory, as returned by
+  io_png_read_u8_rgb. Rows are written after they are read, so the image can be its own sink. */
+class MSPlanarRows : public MSRowSource, public MSRowSink
+{
+public:
+    MSPlanarRows(uchar *planar, int width, int height) : planar(planar), width(width), height(height), read(0), written(0) {}
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    bool ReadRows(uchar *rgb, int count);
+    bool WriteRows(const uchar *rgb, int count);
+
+private:
+    uchar *planar;
+    int width, height;
+    int read, written;      // rows read and written
+};
+
+/*Class MSPngReader reads the rows of a PNG file as libpng decodes them, see io_png_read_open_u8_rgb */
+class MSPngReader : public MSRowSource
+{
+public:
+    MSPngReader(const char *filename);
+    ~MSPngReader();
+
+    bool IsOpen() const { return reader != NULL; }
+    int Width() const { return (int)width; }
+    int Height() const { return (int)height; }
+    bool ReadRows(uchar *rgb, int count);
+
+private:
+    io_png_reader *reader;
+    size_t width, height;
+
+    MSPngReader(const MSPngReader &);
+    MSPngReader &operator=(const MSPngReader &);
+};
+
+/*Class MSPngWriter writes the rows of a non interlaced RGB PNG file as they are given */
+class MSPngWriter : public MSRowSink
+{
+public:
+    MSPngWriter(const char *filename, int width, int height, const io_png_options *options = NULL);
+    ~MSPngWriter();
+
+    bool IsOpen() const { return writer != NULL; }
+    bool WriteRows(const uchar *rgb, int count);
+    // end the file, false if a row is missing or the file can not be written
+    bool Close();
+
+private:
+    io_png_writer *writer;
+
+    MSPngWriter(const MSPngWriter &);
+    MSPngWriter &operator=(const MSPngWriter &);
+};
+
+/*Class MSMappedReader reads the rows of a mapped PPM, PAM or raw planar RGB file, see ParseImageHeader;
+  gray is replicated and alpha is dropped. The rows read leave the memory of the process. */
+class MSMappedReader : public MSRowSource
+{
+public:
+    MSMappedReader(const char *filename);
+
+    bool IsOpen() const { return file.Data() != NULL; }
+    int Width() const { return layout.width; }
+    int Height() const { return layout.height; }
+    bool ReadRows(uchar *rgb, int count);
+
+private:
+    MappedFile file;
+    ImageFileLayout layout;
+    int read;               // rows read
+
+    MSMappedReader(const MSMappedReader &);
+    MSMappedReader &operator=(const MSMappedReader &);
+};
+
+/*Class MSMappedWriter writes the rows of a PPM, PAM or raw planar RGB file, chosen by the extension,
+  into a file of its final size mapped shared; the rows written leave the memory of the process. */
+class MSMappedWriter : public MSRowSink
+{
+public:
+    MSMappedWriter(const char *filename, int width, int height);
+    ~MSMappedWriter();
+
+    bool IsOpen() const { return file.Data() != NULL; }
+    bool WriteRows(const uchar *rgb, int count);
+    // unmap the file, false if a row is missing or the file can not be written
+    bool Close();
+
+private:
+    MappedFile file;
+    ImageFileLayout layout;
+    int written;            // rows written
+
+    MSMappedWriter(const MSMappedWriter &);
+    MSMappedWriter &operator=(const MSMappedWriter &);
+};
+
+#define MS_BATCH_QUEUE 2    // default items which may wait between two stages of a batch
+
+/*Structure MSBatchItem is an image of a batch with its parameters and the times of its stages, see msbatch.cpp */
+struct MSBatchItem
+{
+    std::string input;
+    int spatial_radius;
+    double color_radius;
+    int minRegion;
+    std::string segmented;  // output of the segmented image
+    std::string filtered;   // output of the filtered image, none if empty
+    bool ok;                // read, segmented and written
+    double decode_time;     // seconds of every stage
+    double compute_time;
+    double encode_time;
+    double latency;         // seconds from the start of the decoding to the end of the encoding
+
+    MSBatchItem() : spatial_radius(0), color_radius(0), minRegion(0), ok(false),
+                    decode_time(0), compute_time(0), encode_time(0), latency(0) {}
+};
+
 uchar* MeanShift(uchar* image, uchar *filtered, int **labels, int width, int height, int spatial_radius, double color_radius, int minRegion, int num_iters);
+uchar* MeanShift(uchar* image, uchar *filtered, int **labels, int width, int height, int spatial_radius, double color_radius, int minRegion, int num_iters, const MSOptions &options);
 uchar* MS_Filter(uchar* image, int width, int height, int h_spatial, double h_range, int initIters);
+uchar* MS_Filter(uchar* image, int width, int height, int h_spatial, double h_range, int initIters, const MSOptions &options);
+void MS_FilterLUV(uchar* luv, int width, int height, int h_spatial, double h_range, int initIters, const MSOptions &options);
+void MS_Filter(const AlignedImage &luv, AlignedImage &filtered, int h_spatial, double h_range, int num_iters, const MSOptions &options);
+bool MS_FilterBands(MSRowSource &source, MSRowSink &sink, int h_spatial, double h_range, int num_iters,
+                    const MSOptions &options, int band_height);
+bool MS_ParseSimd(const char *name, MSSimd *simd);
+CpuIsa MS_SimdIsa(MSSimd simd);
+bool MS_ParseSpeedUp(const char *name, MSSpeedUp *speedup);
+bool MS_ParseHistogram(const char *name, MSHistogramUse *histogram);
+bool MS_ParseTraversal(const char *name, MSTraversal *traversal);
+bool MS_ParseKernel(const char *name, MSKernel *spatial, MSKernel *range);
+bool MS_WriteDiagnostics(const MSDiagnostics &diagnostics, const char *prefix);
+void MS_DiagnosticsSummary(const MSDiagnostics &diagnostics, std::ostream &out);
+bool MS_ReadBatchManifest(const char *filename, std::vector<MSBatchItem> &items);
+bool MS_ListBatchDirectory(const char *directory, int spatial_radius, double color_radius, int minRegion,
+                           const char *output_directory, std::vector<MSBatchItem> &items);
+int MS_RunBatch(std::vector<MSBatchItem> &items, int num_iters, const MSOptions &options, const io_png_options *png,
+                int num_workers, int capacity);
 int MS_Segment(uchar * image, int width, int height, int **labels, double h_range, int minRegion);
 int MS_Cluster(uchar  *image, int width, int height, int **labels,int* modePoints, float *mode, double h_range);
+int MS_Cluster(uchar  *image, int width, int height, int **labels,int* modePoints, float *mode, double h_range, std::vector<MSPoint> &stack);
 
 
 #endif /* MEANSHIFT_H */
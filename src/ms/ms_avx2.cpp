@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+#include <immintrin.h>
+#include <string.h>
+
+
+/**
+ * @file ms_avx2.cpp
+ * @brief AVX2 neighbourhood accumulation for the Meanshift filter, compiled with -mavx2
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function Load8 loads n <= 8 bytes and widens them to 32 bit lanes, missing lanes are zero
+*
+*  \param p bytes to load
+*  \param n number of valid bytes
+*  \return widened bytes
+*/
+static inline __m256i Load8(const uchar *p, int n)
+{
+    if(n >= 8)
+        return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+
+    // do not read past the end of the plane
+    uchar tmp[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(tmp, p, n);
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)tmp));
+}
+
+/*! \brief Function Load16 loads n <= 16 bytes and widens them to 16 bit lanes, missing lanes are zero
+*
+*  \param p bytes to load
+*  \param n number of valid bytes
+*  \return widened bytes
+*/
+static inline __m256i Load16(const uchar *p, int n)
+{
+    if(n >= 16)
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p));
+
+    uchar tmp[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    memcpy(tmp, p, n);
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)tmp));
+}
+
+/*! \brief Function HorizontalSum adds the eight 32 bit lanes
+*
+*  \param v lanes to add
+*  \return sum of the lanes
+*/
+static inline int HorizontalSum(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+/*! \brief Function CompareRadius compares eight squared color distances with the color radius.
+*  Lanes close to the radius are decided in double precision, so the result is the one of the scalar version.
+*
+*  \param dL, dU, dV channel differences
+*  \param dist single precision squared distances
+*  \param radius squared range radius in every lane
+*  \param color_radius_squared squared range radius
+*  \return lanes inside the color radius, -1 in 32 bit lanes
+*/
+static inline __m256i CompareRadius(__m256 dL, __m256 dU, __m256 dV, __m256 dist, __m256 radius, double color_radius_squared)
+{
+    const __m256 tolerance = _mm256_set1_ps((float)(color_radius_squared * MS_RADIUS_TOLERANCE));
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    __m256 mask = _mm256_cmp_ps(dist, radius, _CMP_LE_OQ);
+    int near = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(dist, radius)), tolerance, _CMP_LE_OQ));
+
+    if(!near)
+        return _mm256_castps_si256(mask);
+
+    float l[8], u[8], v[8];
+    _mm256_storeu_ps(l, dL);
+    _mm256_storeu_ps(u, dU);
+    _mm256_storeu_ps(v, dV);
+    int bits = (int)MS_ExactLanes((unsigned)_mm256_movemask_ps(mask), (unsigned)near, l, u, v, color_radius_squared);
+
+    const __m256i lanebits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lanebits), lanebits);
+}
+
+/*! \brief Function MS_AccumulateAVX2 is the eight lane version of MS_AccumulateScalar
+*
+*  Color distances are computed in float lanes and the comparison mask selects the lanes which are
+*  added to integer accumulators, so the sums are exact. Distances close to the color radius are
+*  decided in double precision, so the result is the one of the reference.
+*
+*  \param src image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param sums accumulated sums
+*/
+void MS_AccumulateAVX2(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                       float L, float U, float V, double color_radius_squared, MSWindowSums *sums)
+{
+    const __m256 vL = _mm256_set1_ps(L);
+    const __m256 vU = _mm256_set1_ps(U);
+    const __m256 vV = _mm256_set1_ps(V);
+    const __m256 radius = _mm256_set1_ps((float)color_radius_squared);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256i si = _mm256_setzero_si256();
+    __m256i sL = _mm256_setzero_si256();
+    __m256i sU = _mm256_setzero_si256();
+    __m256i sV = _mm256_setzero_si256();
+    int mj = 0;
+    int num = 0;
+
+    for(int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *rowL = src.plane[0] + jj * src.stride;
+        const uchar *rowU = src.plane[1] + jj * src.stride;
+        const uchar *rowV = src.plane[2] + jj * src.stride;
+        __m256i rown = _mm256_setzero_si256();
+
+        for(int ii = ifrom; ii < ito; ii += 8)
+        {
+            int n = ito - ii;
+            __m256i L2 = Load8(rowL + ii, n);
+            __m256i U2 = Load8(rowU + ii, n);
+            __m256i V2 = Load8(rowV + ii, n);
+
+            __m256 dL = _mm256_sub_ps(_mm256_cvtepi32_ps(L2), vL);
+            __m256 dU = _mm256_sub_ps(_mm256_cvtepi32_ps(U2), vU);
+            __m256 dV = _mm256_sub_ps(_mm256_cvtepi32_ps(V2), vV);
+            __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dL, dL), _mm256_mul_ps(dU, dU)), _mm256_mul_ps(dV, dV));
+
+            __m256i mask = CompareRadius(dL, dU, dV, dist, radius, color_radius_squared);
+            if(n < 8)
+                mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes));
+
+            si = _mm256_add_epi32(si, _mm256_and_si256(mask, _mm256_add_epi32(_mm256_set1_epi32(ii), lanes)));
+            sL = _mm256_add_epi32(sL, _mm256_and_si256(mask, L2));
+            sU = _mm256_add_epi32(sU, _mm256_and_si256(mask, U2));
+            sV = _mm256_add_epi32(sV, _mm256_and_si256(mask, V2));
+            rown = _mm256_sub_epi32(rown, mask);    // mask lanes are -1
+        }
+
+        int count = HorizontalSum(rown);
+        mj += count * jj;
+        num += count;
+    }
+
+    sums->mi = (float)HorizontalSum(si);
+    sums->mj = (float)mj;
+    sums->mL = (float)HorizontalSum(sL);
+    sums->mU = (float)HorizontalSum(sU);
+    sums->mV = (float)HorizontalSum(sV);
+    sums->num = num;
+}
+
+/*! \brief Function MS_AccumulatePackedAVX2 is the eight lane version of MS_AccumulatePackedScalar
+*
+*  One 32 byte load brings eight L u v X neighbours, the channels are separated with shifts.
+*  Loads may run up to seven pixels past the window, which stays inside the allocation of
+*  a packed AlignedImage; those lanes are masked out.
+*
+*  \param src packed image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param sums accumulated sums
+*/
+void MS_AccumulatePackedAVX2(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                             float L, float U, float V, double color_radius_squared, MSWindowSums *sums)
+{
+    const __m256 vL = _mm256_set1_ps(L);
+    const __m256 vU = _mm256_set1_ps(U);
+    const __m256 vV = _mm256_set1_ps(V);
+    const __m256 radius = _mm256_set1_ps((float)color_radius_squared);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i si = _mm256_setzero_si256();
+    __m256i sL = _mm256_setzero_si256();
+    __m256i sU = _mm256_setzero_si256();
+    __m256i sV = _mm256_setzero_si256();
+    int mj = 0;
+    int num = 0;
+
+    for(int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *row = src.packed + jj * src.stride;
+        __m256i rown = _mm256_setzero_si256();
+
+        for(int ii = ifrom; ii < ito; ii += 8)
+        {
+            int n = ito - ii;
+            __m256i px = _mm256_loadu_si256((const __m256i*)(row + ii * 4));
+            __m256i L2 = _mm256_and_si256(px, byte);
+            __m256i U2 = _mm256_and_si256(_mm256_srli_epi32(px, 8), byte);
+            __m256i V2 = _mm256_and_si256(_mm256_srli_epi32(px, 16), byte);
+            __m256i inside = _mm256_cmpgt_epi32(_mm256_srli_epi32(px, 24), zero);
+
+            __m256 dL = _mm256_sub_ps(_mm256_cvtepi32_ps(L2), vL);
+            __m256 dU = _mm256_sub_ps(_mm256_cvtepi32_ps(U2), vU);
+            __m256 dV = _mm256_sub_ps(_mm256_cvtepi32_ps(V2), vV);
+            __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dL, dL), _mm256_mul_ps(dU, dU)), _mm256_mul_ps(dV, dV));
+
+            __m256i mask = _mm256_and_si256(inside, CompareRadius(dL, dU, dV, dist, radius, color_radius_squared));
+            if(n < 8)
+                mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes));
+
+            si = _mm256_add_epi32(si, _mm256_and_si256(mask, _mm256_add_epi32(_mm256_set1_epi32(ii), lanes)));
+            sL = _mm256_add_epi32(sL, _mm256_and_si256(mask, L2));
+            sU = _mm256_add_epi32(sU, _mm256_and_si256(mask, U2));
+            sV = _mm256_add_epi32(sV, _mm256_and_si256(mask, V2));
+            rown = _mm256_sub_epi32(rown, mask);
+        }
+
+        int count = HorizontalSum(rown);
+        mj += count * jj;
+        num += count;
+    }
+
+    sums->mi = (float)HorizontalSum(si);
+    sums->mj = (float)mj;
+    sums->mL = (float)HorizontalSum(sL);
+    sums->mU = (float)HorizontalSum(sU);
+    sums->mV = (float)HorizontalSum(sV);
+    sums->num = num;
+}
+
+/*! \brief Function MS_AccumulateIntAVX2 is the sixteen lane version of MS_AccumulateIntScalar
+*
+*  Channel differences are sixteen 16 bit lanes; pairs of squared differences are added into
+*  32 bit lanes by _mm256_madd_epi16, and the comparison masks are packed back to 16 bit lanes
+*  in pixel order. Horizontal positions are added relative to ifrom so they fit in 16 bits.
+*  The result is the same as the one of MS_AccumulateIntScalar.
+*
+*  \param src image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center with MS_INT_SHIFT fractional bits
+*  \param color_radius_int squared range radius with 2 * MS_INT_SHIFT fractional bits
+*  \param sums accumulated sums
+*/
+void MS_AccumulateIntAVX2(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                          int L, int U, int V, int color_radius_int, MSIntSums *sums)
+{
+    const __m256i vL = _mm256_set1_epi16((short)L);
+    const __m256i vU = _mm256_set1_epi16((short)U);
+    const __m256i vV = _mm256_set1_epi16((short)V);
+    const __m256i radius = _mm256_set1_epi32(color_radius_int + 1);
+    const __m256i lanes = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i si = _mm256_setzero_si256();
+    __m256i sL = _mm256_setzero_si256();
+    __m256i sU = _mm256_setzero_si256();
+    __m256i sV = _mm256_setzero_si256();
+    int mj = 0;
+    int num = 0;
+
+    for(int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *rowL = src.plane[0] + jj * src.stride;
+        const uchar *rowU = src.plane[1] + jj * src.stride;
+        const uchar *rowV = src.plane[2] + jj * src.stride;
+        __m256i rown = _mm256_setzero_si256();
+
+        for(int ii = ifrom; ii < ito; ii += 16)
+        {
+            int n = ito - ii;
+            __m256i L2 = Load16(rowL + ii, n);
+            __m256i U2 = Load16(rowU + ii, n);
+            __m256i V2 = Load16(rowV + ii, n);
+
+            __m256i dL = _mm256_sub_epi16(_mm256_slli_epi16(L2, MS_INT_SHIFT), vL);
+            __m256i dU = _mm256_sub_epi16(_mm256_slli_epi16(U2, MS_INT_SHIFT), vU);
+            __m256i dV = _mm256_sub_epi16(_mm256_slli_epi16(V2, MS_INT_SHIFT), vV);
+
+            // unpack and pack work within 128 bit halves, so packing the masks restores pixel order
+            __m256i LUlo = _mm256_unpacklo_epi16(dL, dU);
+            __m256i LUhi = _mm256_unpackhi_epi16(dL, dU);
+            __m256i Vlo = _mm256_unpacklo_epi16(dV, zero);
+            __m256i Vhi = _mm256_unpackhi_epi16(dV, zero);
+            __m256i distlo = _mm256_add_epi32(_mm256_madd_epi16(LUlo, LUlo), _mm256_madd_epi16(Vlo, Vlo));
+            __m256i disthi = _mm256_add_epi32(_mm256_madd_epi16(LUhi, LUhi), _mm256_madd_epi16(Vhi, Vhi));
+
+            __m256i mask = _mm256_packs_epi32(_mm256_cmpgt_epi32(radius, distlo), _mm256_cmpgt_epi32(radius, disthi));
+            if(n < 16)
+                mask = _mm256_and_si256(mask, _mm256_cmpgt_epi16(_mm256_set1_epi16((short)n), lanes));
+
+            __m256i offset = _mm256_add_epi16(_mm256_set1_epi16((short)(ii - ifrom)), lanes);
+            si = _mm256_add_epi32(si, _mm256_madd_epi16(_mm256_and_si256(mask, offset), ones));
+            sL = _mm256_add_epi32(sL, _mm256_madd_epi16(_mm256_and_si256(mask, L2), ones));
+            sU = _mm256_add_epi32(sU, _mm256_madd_epi16(_mm256_and_si256(mask, U2), ones));
+            sV = _mm256_add_epi32(sV, _mm256_madd_epi16(_mm256_and_si256(mask, V2), ones));
+            rown = _mm256_sub_epi32(rown, _mm256_madd_epi16(mask, ones));  // mask lanes are -1
+        }
+
+        int count = HorizontalSum(rown);
+        mj += count * jj;
+        num += count;
+    }
+
+    sums->mi = HorizontalSum(si) + num * ifrom;
+    sums->mj = mj;
+    sums->mL = HorizontalSum(sL);
+    sums->mU = HorizontalSum(sU);
+    sums->mV = HorizontalSum(sV);
+    sums->num = num;
+}
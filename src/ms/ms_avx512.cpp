@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+#include <immintrin.h>
+
+
+/**
+ * @file ms_avx512.cpp
+ * @brief AVX-512 neighbourhood accumulation for the Meanshift filter, compiled with -mavx512f -mavx512bw -mavx512vl
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function CompareRadius compares sixteen squared color distances with the color radius.
+*  Lanes close to the radius are decided in double precision, so the result is the one of the scalar version.
+*
+*  \param valid lanes to compare
+*  \param dL, dU, dV channel differences
+*  \param dist single precision squared distances
+*  \param radius squared range radius in every lane
+*  \param color_radius_squared squared range radius
+*  \return lanes of valid inside the color radius
+*/
+static inline __mmask16 CompareRadius(__mmask16 valid, __m512 dL, __m512 dU, __m512 dV, __m512 dist, __m512 radius,
+                                      double color_radius_squared)
+{
+    const __m512 tolerance = _mm512_set1_ps((float)(color_radius_squared * MS_RADIUS_TOLERANCE));
+    __mmask16 mask = _mm512_mask_cmp_ps_mask(valid, dist, radius, _CMP_LE_OQ);
+    __mmask16 near = _mm512_mask_cmp_ps_mask(valid, _mm512_abs_ps(_mm512_sub_ps(dist, radius)), tolerance, _CMP_LE_OQ);
+
+    if(!near)
+        return mask;
+
+    float l[16], u[16], v[16];
+    _mm512_storeu_ps(l, dL);
+    _mm512_storeu_ps(u, dU);
+    _mm512_storeu_ps(v, dV);
+    return (__mmask16)MS_ExactLanes(mask, near, l, u, v, color_radius_squared);
+}
+
+/*! \brief Function MS_AccumulateAVX512 is the sixteen lane version of MS_AccumulateScalar
+*
+*  The comparison result is a lane mask used directly by the masked integer adds, and the
+*  partial loads at the end of a row are masked, so no byte outside the window is read.
+*
+*  \param src image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param sums accumulated sums
+*/
+void MS_AccumulateAVX512(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                         float L, float U, float V, double color_radius_squared, MSWindowSums *sums)
+{
+    const __m512 vL = _mm512_set1_ps(L);
+    const __m512 vU = _mm512_set1_ps(U);
+    const __m512 vV = _mm512_set1_ps(V);
+    const __m512 radius = _mm512_set1_ps((float)color_radius_squared);
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    __m512i si = _mm512_setzero_si512();
+    __m512i sL = _mm512_setzero_si512();
+    __m512i sU = _mm512_setzero_si512();
+    __m512i sV = _mm512_setzero_si512();
+    int mj = 0;
+    int num = 0;
+
+    for(int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *rowL = src.plane[0] + jj * src.stride;
+        const uchar *rowU = src.plane[1] + jj * src.stride;
+        const uchar *rowV = src.plane[2] + jj * src.stride;
+        int count = 0;
+
+        for(int ii = ifrom; ii < ito; ii += 16)
+        {
+            int n = ito - ii;
+            __mmask16 valid = n >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << n) - 1);
+
+            __m512i L2 = _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(valid, rowL + ii));
+            __m512i U2 = _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(valid, rowU + ii));
+            __m512i V2 = _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(valid, rowV + ii));
+
+            __m512 dL = _mm512_sub_ps(_mm512_cvtepi32_ps(L2), vL);
+            __m512 dU = _mm512_sub_ps(_mm512_cvtepi32_ps(U2), vU);
+            __m512 dV = _mm512_sub_ps(_mm512_cvtepi32_ps(V2), vV);
+            __m512 dist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dL, dL), _mm512_mul_ps(dU, dU)), _mm512_mul_ps(dV, dV));
+
+            __mmask16 mask = CompareRadius(valid, dL, dU, dV, dist, radius, color_radius_squared);
+
+            si = _mm512_mask_add_epi32(si, mask, si, _mm512_add_epi32(_mm512_set1_epi32(ii), lanes));
+            sL = _mm512_mask_add_epi32(sL, mask, sL, L2);
+            sU = _mm512_mask_add_epi32(sU, mask, sU, U2);
+            sV = _mm512_mask_add_epi32(sV, mask, sV, V2);
+            count += __builtin_popcount(mask);
+        }
+
+        mj += count * jj;
+        num += count;
+    }
+
+    sums->mi = (float)_mm512_reduce_add_epi32(si);
+    sums->mj = (float)mj;
+    sums->mL = (float)_mm512_reduce_add_epi32(sL);
+    sums->mU = (float)_mm512_reduce_add_epi32(sU);
+    sums->mV = (float)_mm512_reduce_add_epi32(sV);
+    sums->num = num;
+}
+
+/*! \brief Function MS_AccumulatePackedAVX512 is the sixteen lane version of MS_AccumulatePackedScalar
+*
+*  One masked 64 byte load brings sixteen L u v X neighbours, a cache line per load when the
+*  window starts at an aligned column.
+*
+*  \param src packed image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param sums accumulated sums
+*/
+void MS_AccumulatePackedAVX512(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                               float L, float U, float V, double color_radius_squared, MSWindowSums *sums)
+{
+    const __m512 vL = _mm512_set1_ps(L);
+    const __m512 vU = _mm512_set1_ps(U);
+    const __m512 vV = _mm512_set1_ps(V);
+    const __m512 radius = _mm512_set1_ps((float)color_radius_squared);
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i byte = _mm512_set1_epi32(0xFF);
+    const __m512i flag = _mm512_set1_epi32((int)0xFF000000);
+
+    __m512i si = _mm512_setzero_si512();
+    __m512i sL = _mm512_setzero_si512();
+    __m512i sU = _mm512_setzero_si512();
+    __m512i sV = _mm512_setzero_si512();
+    int mj = 0;
+    int num = 0;
+
+    for(int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *row = src.packed + jj * src.stride;
+        int count = 0;
+
+        for(int ii = ifrom; ii < ito; ii += 16)
+        {
+            int n = ito - ii;
+            __mmask16 valid = n >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << n) - 1);
+
+            __m512i px = _mm512_maskz_loadu_epi32(valid, row + ii * 4);
+            __m512i L2 = _mm512_and_si512(px, byte);
+            __m512i U2 = _mm512_and_si512(_mm512_srli_epi32(px, 8), byte);
+            __m512i V2 = _mm512_and_si512(_mm512_srli_epi32(px, 16), byte);
+            __mmask16 inside = _mm512_mask_test_epi32_mask(valid, px, flag);
+
+            __m512 dL = _mm512_sub_ps(_mm512_cvtepi32_ps(L2), vL);
+            __m512 dU = _mm512_sub_ps(_mm512_cvtepi32_ps(U2), vU);
+            __m512 dV = _mm512_sub_ps(_mm512_cvtepi32_ps(V2), vV);
+            __m512 dist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dL, dL), _mm512_mul_ps(dU, dU)), _mm512_mul_ps(dV, dV));
+
+            __mmask16 mask = CompareRadius(inside, dL, dU, dV, dist, radius, color_radius_squared);
+
+            si = _mm512_mask_add_epi32(si, mask, si, _mm512_add_epi32(_mm512_set1_epi32(ii), lanes));
+            sL = _mm512_mask_add_epi32(sL, mask, sL, L2);
+            sU = _mm512_mask_add_epi32(sU, mask, sU, U2);
+            sV = _mm512_mask_add_epi32(sV, mask, sV, V2);
+            count += __builtin_popcount(mask);
+        }
+
+        mj += count * jj;
+        num += count;
+    }
+
+    sums->mi = (float)_mm512_reduce_add_epi32(si);
+    sums->mj = (float)mj;
+    sums->mL = (float)_mm512_reduce_add_epi32(sL);
+    sums->mU = (float)_mm512_reduce_add_epi32(sU);
+    sums->mV = (float)_mm512_reduce_add_epi32(sV);
+    sums->num = num;
+}
+
+// Column of the lanes of a 32 lane 16 bit vector holding sixteen pixels of two rows
+static const uchar ms_lanes32[32] =
+{
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/*! \brief Function Load2x16 loads the bytes [p, p + n) and [q, q + n) for n <= 16 and widens them to 16 bit lanes
+*
+*  \param p bytes of the lower half
+*  \param q bytes of the upper half
+*  \param valid mask of the lanes to load
+*  \return widened bytes
+*/
+static inline __m512i Load2x16(const uchar *p, const uchar *q, __mmask32 valid)
+{
+    __m128i lo = _mm_maskz_loadu_epi8((__mmask16)valid, p);
+    __m128i hi = _mm_maskz_loadu_epi8((__mmask16)(valid >> 16), q);
+    return _mm512_cvtepu8_epi16(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+}
+
+/*! \brief Function MS_AccumulateIntAVX512 is the thirty-two lane version of MS_AccumulateIntScalar
+*
+*  Channel differences are 16 bit lanes, and a vector holds sixteen pixels of two rows, so the
+*  lanes are used also by the narrow windows of small spatial radii. The squared distances of
+*  pixel pairs are computed by _mm512_madd_epi16 in 32 bit lanes, and the comparison masks are
+*  packed to a 16 bit lane mask in pixel order. Partial loads are masked.
+*
+*  \param src image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center with MS_INT_SHIFT fractional bits
+*  \param color_radius_int squared range radius with 2 * MS_INT_SHIFT fractional bits
+*  \param sums accumulated sums
+*/
+void MS_AccumulateIntAVX512(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                            int L, int U, int V, int color_radius_int, MSIntSums *sums)
+{
+    const __m512i vL = _mm512_set1_epi16((short)L);
+    const __m512i vU = _mm512_set1_epi16((short)U);
+    const __m512i vV = _mm512_set1_epi16((short)V);
+    const __m512i radius = _mm512_set1_epi32(color_radius_int);
+    const __m512i lanes = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)ms_lanes32));
+    const __m512i ones = _mm512_set1_epi16(1);
+    const __m512i all = _mm512_set1_epi32(-1);
+    const __m512i zero = _mm512_setzero_si512();
+
+    __m512i si = _mm512_setzero_si512();
+    __m512i sL = _mm512_setzero_si512();
+    __m512i sU = _mm512_setzero_si512();
+    __m512i sV = _mm512_setzero_si512();
+    int mj = 0;
+    int num = 0;
+
+    for(int jj = jfrom; jj < jto; jj += 2)
+    {
+        // the second row is jj + 1, or a copy of row jj whose lanes are all masked
+        int jj2 = jj + 1 < jto ? jj + 1 : jj;
+        const uchar *rowL = src.plane[0] + jj * src.stride;
+        const uchar *rowU = src.plane[1] + jj * src.stride;
+        const uchar *rowV = src.plane[2] + jj * src.stride;
+        const uchar *rowL2 = src.plane[0] + jj2 * src.stride;
+        const uchar *rowU2 = src.plane[1] + jj2 * src.stride;
+        const uchar *rowV2 = src.plane[2] + jj2 * src.stride;
+        int count = 0, count2 = 0;
+
+        for(int ii = ifrom; ii < ito; ii += 16)
+        {
+            int n = ito - ii;
+            __mmask32 valid = n >= 16 ? 0xFFFFu : (1u << n) - 1;
+            if(jj2 != jj)
+                valid |= valid << 16;
+
+            __m512i L2 = Load2x16(rowL + ii, rowL2 + ii, valid);
+            __m512i U2 = Load2x16(rowU + ii, rowU2 + ii, valid);
+            __m512i V2 = Load2x16(rowV + ii, rowV2 + ii, valid);
+
+            __m512i dL = _mm512_sub_epi16(_mm512_slli_epi16(L2, MS_INT_SHIFT), vL);
+            __m512i dU = _mm512_sub_epi16(_mm512_slli_epi16(U2, MS_INT_SHIFT), vU);
+            __m512i dV = _mm512_sub_epi16(_mm512_slli_epi16(V2, MS_INT_SHIFT), vV);
+
+            // unpack and pack work within 128 bit lanes, so packing the masks restores pixel order
+            __m512i LUlo = _mm512_unpacklo_epi16(dL, dU);
+            __m512i LUhi = _mm512_unpackhi_epi16(dL, dU);
+            __m512i Vlo = _mm512_unpacklo_epi16(dV, zero);
+            __m512i Vhi = _mm512_unpackhi_epi16(dV, zero);
+            __m512i distlo = _mm512_add_epi32(_mm512_madd_epi16(LUlo, LUlo), _mm512_madd_epi16(Vlo, Vlo));
+            __m512i disthi = _mm512_add_epi32(_mm512_madd_epi16(LUhi, LUhi), _mm512_madd_epi16(Vhi, Vhi));
+
+            __m512i inlo = _mm512_maskz_mov_epi32(_mm512_cmple_epi32_mask(distlo, radius), all);
+            __m512i inhi = _mm512_maskz_mov_epi32(_mm512_cmple_epi32_mask(disthi, radius), all);
+            __mmask32 mask = _mm512_movepi16_mask(_mm512_packs_epi32(inlo, inhi)) & valid;
+
+            __m512i offset = _mm512_add_epi16(_mm512_set1_epi16((short)(ii - ifrom)), lanes);
+            si = _mm512_add_epi32(si, _mm512_madd_epi16(_mm512_maskz_mov_epi16(mask, offset), ones));
+            sL = _mm512_add_epi32(sL, _mm512_madd_epi16(_mm512_maskz_mov_epi16(mask, L2), ones));
+            sU = _mm512_add_epi32(sU, _mm512_madd_epi16(_mm512_maskz_mov_epi16(mask, U2), ones));
+            sV = _mm512_add_epi32(sV, _mm512_madd_epi16(_mm512_maskz_mov_epi16(mask, V2), ones));
+            count += __builtin_popcount(mask & 0xFFFFu);
+            count2 += __builtin_popcount(mask >> 16);
+        }
+
+        mj += count * jj + count2 * jj2;
+        num += count + count2;
+    }
+
+    sums->mi = _mm512_reduce_add_epi32(si) + num * ifrom;
+    sums->mj = mj;
+    sums->mL = _mm512_reduce_add_epi32(sL);
+    sums->mU = _mm512_reduce_add_epi32(sU);
+    sums->mV = _mm512_reduce_add_epi32(sV);
+    sums->num = num;
+}
+
+/*! \brief Function MS_WindowBatchPackedAVX512 sums the windows of n pixels with one pixel per lane
+*
+*  Every neighbour offset of the window is one gather of sixteen L u v X pixels, one around each
+*  pixel, compared with sixteen different color centers. The packed image must have a border of
+*  at least the spatial radius, so no window is clamped; border neighbours have X == 0. The
+*  distances are decided as in MS_AccumulatePackedAVX512.
+*
+*  \param ctx filter settings
+*  \param n number of pixels
+*  \param i, j coordinates of the pixels
+*  \param L, U, V colors of the window centers
+*  \param sums accumulated sums of every pixel
+*/
+void MS_WindowBatchPackedAVX512(const MSFilterContext &ctx, int n, const int *i, const int *j,
+                                const float *L, const float *U, const float *V, MSWindowSums *sums)
+{
+    const int R = ctx.spatial_radius;
+    const __m512 radius = _mm512_set1_ps((float)ctx.color_radius_squared);
+    const __m512i byte = _mm512_set1_epi32(0xFF);
+    const __m512i flag = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i one = _mm512_set1_epi32(1);
+
+    for(int k = 0; k < n; k += 16)
+    {
+        int m = n - k;
+        __mmask16 valid = m >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << m) - 1);
+
+        __m512i vi = _mm512_maskz_loadu_epi32(valid, i + k);
+        __m512i vj = _mm512_maskz_loadu_epi32(valid, j + k);
+        __m512i base = _mm512_add_epi32(_mm512_mullo_epi32(vj, _mm512_set1_epi32(ctx.src.stride)), _mm512_slli_epi32(vi, 2));
+        __m512 vL = _mm512_maskz_loadu_ps(valid, L + k);
+        __m512 vU = _mm512_maskz_loadu_ps(valid, U + k);
+        __m512 vV = _mm512_maskz_loadu_ps(valid, V + k);
+
+        __m512i num = _mm512_setzero_si512();
+        __m512i sdi = _mm512_setzero_si512();
+        __m512i sdj = _mm512_setzero_si512();
+        __m512i sL = _mm512_setzero_si512();
+        __m512i sU = _mm512_setzero_si512();
+        __m512i sV = _mm512_setzero_si512();
+
+        for(int dy = -R; dy <= R; dy++)
+        {
+            const int w = ctx.halfwidth ? ctx.halfwidth[dy + R] : R;
+            const __m512i vdy = _mm512_set1_epi32(dy);
+
+            for(int dx = -w; dx <= w; dx++)
+            {
+                __m512i offset = _mm512_add_epi32(base, _mm512_set1_epi32(dy * ctx.src.stride + dx * IMAGE_PACKED_BYTES));
+                __m512i px = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, offset, ctx.src.packed, 1);
+                __m512i L2 = _mm512_and_si512(px, byte);
+                __m512i U2 = _mm512_and_si512(_mm512_srli_epi32(px, 8), byte);
+                __m512i V2 = _mm512_and_si512(_mm512_srli_epi32(px, 16), byte);
+                __mmask16 inside = _mm512_mask_test_epi32_mask(valid, px, flag);
+
+                __m512 dL = _mm512_sub_ps(_mm512_cvtepi32_ps(L2), vL);
+                __m512 dU = _mm512_sub_ps(_mm512_cvtepi32_ps(U2), vU);
+                __m512 dV = _mm512_sub_ps(_mm512_cvtepi32_ps(V2), vV);
+                __m512 dist = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dL, dL), _mm512_mul_ps(dU, dU)), _mm512_mul_ps(dV, dV));
+
+                __mmask16 mask = CompareRadius(inside, dL, dU, dV, dist, radius, ctx.color_radius_squared);
+
+                num = _mm512_mask_add_epi32(num, mask, num, one);
+                sdi = _mm512_mask_add_epi32(sdi, mask, sdi, _mm512_set1_epi32(dx));
+                sdj = _mm512_mask_add_epi32(sdj, mask, sdj, vdy);
+                sL = _mm512_mask_add_epi32(sL, mask, sL, L2);
+                sU = _mm512_mask_add_epi32(sU, mask, sU, U2);
+                sV = _mm512_mask_add_epi32(sV, mask, sV, V2);
+            }
+        }
+
+        // the sum of the columns is num * pixel + sum of the offsets, the rows stay relative to the pixel
+        sdi = _mm512_add_epi32(sdi, _mm512_mullo_epi32(num, vi));
+
+        int lane_num[16], lane_i[16], lane_j[16], lane_L[16], lane_U[16], lane_V[16];
+        _mm512_storeu_si512(lane_num, num);
+        _mm512_storeu_si512(lane_i, sdi);
+        _mm512_storeu_si512(lane_j, sdj);
+        _mm512_storeu_si512(lane_L, sL);
+        _mm512_storeu_si512(lane_U, sU);
+        _mm512_storeu_si512(lane_V, sV);
+
+        for(int l = 0; l < 16 && l < m; l++)
+        {
+            MSWindowSums &s = sums[k + l];
+            s.mi = (float)lane_i[l];
+            s.mj = (float)lane_j[l];
+            s.mL = (float)lane_L[l];
+            s.mU = (float)lane_U[l];
+            s.mV = (float)lane_V[l];
+            s.num = lane_num[l];
+        }
+    }
+}
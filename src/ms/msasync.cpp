@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include "msasync.h"
+#include "../parallel/ThreadPool.h"
+
+
+/**
+ * @file msasync.cpp
+ * @brief Segmentations submitted to a shared executor with staged results
+ *
+ * MSExecutor::Submit queues an MSJob and returns at once. A worker filters the image, publishes the
+ * filtered L*u*v image, labels the clusters as MS_Cluster, publishes these labels, merges and prunes
+ * the regions on a copy of them as TransitiveClosure and publishes the final labels. A stage is
+ * published by Wait and Ready of the job and by Ready of its listener, so a caller can show the
+ * filtered image while the segmentation continues. The results are the ones of MeanShift with the
+ * options of the executor.
+ *
+ * Cancel removes a queued job at once; a running job stops when its current stage ends, the stages
+ * themselves are not interrupted. Either way Finished of the listener is called and Wait of the
+ * stages not reached returns false. The destructor of a job cancels it and waits until the executor
+ * released it, the executor must outlive its jobs.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+/*! \brief Constructor of MSJob copies the image, the job is submitted with MSExecutor::Submit
+*
+*  \param image planar RGB image, or L*u*v if the executor has the luv option
+*  \param width width of the image
+*  \param height height of the image
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param minRegion minimal region for merging
+*  \param listener told about the stages on the thread of the worker, or NULL
+*/
+MSJob::MSJob(const uchar *image, int width, int height, int spatial_radius, double color_radius, int minRegion,
+             MSJobListener *listener)
+    : image(image, image + (width > 0 && height > 0 ? (size_t)3 * width * height : 0)), width(width), height(height),
+      spatial_radius(spatial_radius), color_radius(color_radius), minRegion(minRegion), listener(listener), executor(NULL),
+      ready(0), cancelled(false), finished(true), num_clusters(0), regions(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&changed, NULL);
+}
+
+MSJob::~MSJob()
+{
+    Cancel();
+    WaitFinished();
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&lock);
+}
+
+/*! \brief Function Ready tells if a stage was published, without waiting
+*
+*  \param stage stage
+*  \return true if the result of the stage can be read
+*/
+bool MSJob::Ready(MSJobStage stage)
+{
+    pthread_mutex_lock(&lock);
+    const bool result = ready > stage;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+/*! \brief Function Wait waits until a stage was published or the job ended without it
+*
+*  \param stage stage
+*  \return true if the result of the stage can be read, false if the job was cancelled or not submitted
+*/
+bool MSJob::Wait(MSJobStage stage)
+{
+    pthread_mutex_lock(&lock);
+    while(ready <= stage && !finished)
+        pthread_cond_wait(&changed, &lock);
+    const bool result = ready > stage;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+/*! \brief Function Cancel stops the job, a queued job at once and a running one after its current stage
+*/
+void MSJob::Cancel()
+{
+    pthread_mutex_lock(&lock);
+    const bool ended = finished;
+    cancelled = true;
+    MSExecutor *owner = executor;
+    pthread_mutex_unlock(&lock);
+
+    // a job the executor still queues is ended here, else the worker ends it
+    if(!ended && owner && owner->Withdraw(*this))
+        Finish();
+}
+
+bool MSJob::Cancelled()
+{
+    pthread_mutex_lock(&lock);
+    const bool result = cancelled;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+/*! \brief Function Finished tells if the executor released the job
+*
+*  \return true if no stage will be published any more
+*/
+bool MSJob::Finished()
+{
+    pthread_mutex_lock(&lock);
+    const bool result = finished;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+/*! \brief Function WaitFinished waits until the executor released the job, after Finished of the listener
+*/
+void MSJob::WaitFinished()
+{
+    pthread_mutex_lock(&lock);
+    while(!finished)
+        pthread_cond_wait(&changed, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+/*! \brief Function Publish makes the result of a stage readable and tells the listener
+*
+*  \param stage stage
+*  \return false if the job was cancelled and the next stage is not computed
+*/
+bool MSJob::Publish(MSJobStage stage)
+{
+    pthread_mutex_lock(&lock);
+    ready = stage + 1;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    if(listener)
+        listener->Ready(*this, stage);
+    return !Cancelled();
+}
+
+/*! \brief Function Finish tells the listener and releases the job, it must not be touched afterwards
+*/
+void MSJob::Finish()
+{
+    if(listener)
+        listener->Finished(*this);
+
+    pthread_mutex_lock(&lock);
+    finished = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+
+/*! \brief Constructor of MSExecutor starts the workers and their thread pools
+*
+*  \param num_workers jobs processed at once, values smaller than 1 are treated as 1
+*  \param num_iters initial number of iterations
+*  \param options settings of the filter, with options.num_threads every worker keeps a pool of that many threads
+*/
+MSExecutor::MSExecutor(int num_workers, int num_iters, const MSOptions &options)
+    : options(options), workers(num_workers < 1 ? 1 : num_workers), running(workers.size(), (MSJob *)NULL), stopping(false)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&queued, NULL);
+
+    // shared by the workers, they are not filled
+    this->options.stats = NULL;
+    this->options.diagnostics = NULL;
+    this->options.regions = NULL;
+    for(size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].executor = this;
+        workers[w].pool = options.num_threads > 0 ? new ThreadPool(options.num_threads) : NULL;
+        workers[w].engine = new MeanShiftEngine(this->options, num_iters);
+        workers[w].engine->Options().pool = workers[w].pool;
+        pthread_create(&workers[w].thread, NULL, WorkerMain, &workers[w]);
+    }
+}
+
+/*! \brief Destructor of MSExecutor cancels the queued and the running jobs and stops the workers
+*/
+MSExecutor::~MSExecutor()
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    std::deque<MSJob*> withdrawn;
+    withdrawn.swap(queue);
+    for(size_t w = 0; w < running.size(); w++)
+        if(running[w])
+        {
+            pthread_mutex_lock(&running[w]->lock);
+            running[w]->cancelled = true;
+            pthread_mutex_unlock(&running[w]->lock);
+        }
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+
+    for(size_t k = 0; k < withdrawn.size(); k++)
+    {
+        pthread_mutex_lock(&withdrawn[k]->lock);
+        withdrawn[k]->cancelled = true;
+        pthread_mutex_unlock(&withdrawn[k]->lock);
+        withdrawn[k]->Finish();
+    }
+    for(size_t w = 0; w < workers.size(); w++)
+    {
+        pthread_join(workers[w].thread, NULL);
+        delete workers[w].engine;
+        delete workers[w].pool;
+    }
+
+    pthread_cond_destroy(&queued);
+    pthread_mutex_destroy(&lock);
+}
+
+/*! \brief Function Submit queues a job, the jobs are started in the order of submission
+*
+*  \param job job which was not submitted or cancelled before
+*  \return false if the job was submitted or cancelled before or its image is empty
+*/
+bool MSExecutor::Submit(MSJob &job)
+{
+    if(job.width <= 0 || job.height <= 0)
+        return false;
+
+    pthread_mutex_lock(&job.lock);
+    const bool accepted = !job.executor && !job.cancelled;
+    if(accepted)
+    {
+        job.executor = this;
+        job.finished = false;
+    }
+    pthread_mutex_unlock(&job.lock);
+    if(!accepted)
+        return false;
+
+    pthread_mutex_lock(&lock);
+    queue.push_back(&job);
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+/*! \brief Function Withdraw removes a job from the queue
+*
+*  \param job job
+*  \return true if the job was queued, false if a worker took it
+*/
+bool MSExecutor::Withdraw(MSJob &job)
+{
+    pthread_mutex_lock(&lock);
+    std::deque<MSJob*>::iterator position = std::find(queue.begin(), queue.end(), &job);
+    const bool found = position != queue.end();
+    if(found)
+        queue.erase(position);
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+void *MSExecutor::WorkerMain(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+
+    worker->executor->WorkerLoop((int)(worker - &worker->executor->workers[0]));
+    return NULL;
+}
+
+/*! \brief Function WorkerLoop processes the queued jobs in order until the executor stops
+*
+*  \param worker index of the worker
+*/
+void MSExecutor::WorkerLoop(int worker)
+{
+    pthread_mutex_lock(&lock);
+    while(true)
+    {
+        while(queue.empty() && !stopping)
+            pthread_cond_wait(&queued, &lock);
+        if(stopping)
+            break;
+        MSJob &job = *queue.front();
+        queue.pop_front();
+        running[worker] = &job;
+        pthread_mutex_unlock(&lock);
+
+        Process(job, workers[worker]);
+
+        // no longer reachable by the destructor when the owner may destroy the job
+        pthread_mutex_lock(&lock);
+        running[worker] = NULL;
+        pthread_mutex_unlock(&lock);
+        job.Finish();
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*! \brief Function Process computes and publishes the stages of a job until it is cancelled
+*
+*  \param job job taken from the queue
+*  \param worker state of the worker
+*/
+void MSExecutor::Process(MSJob &job, Worker &worker)
+{
+    const int width = job.width, height = job.height;
+    const size_t size = (size_t)width * height;
+    MeanShiftEngine &engine = *worker.engine;
+
+    if(!job.Cancelled())
+    {
+        job.filtered.resize(3 * size);
+        engine.Filter(&job.image[0], &job.filtered[0], width, height, job.spatial_radius, job.color_radius);
+        std::vector<uchar>().swap(job.image);
+        if(job.Publish(MS_STAGE_FILTERED))
+        {
+            job.clusters.resize(size);
+            job.num_clusters = engine.Cluster(&job.filtered[0], &job.clusters[0], width, height, job.color_radius);
+            if(job.Publish(MS_STAGE_CLUSTERED))
+            {
+                // the closure relabels in place, the labels of the clusters stay readable
+                job.labels = job.clusters;
+                job.regions = engine.Merge(&job.labels[0], width, height, job.color_radius, job.minRegion);
+                job.Publish(MS_STAGE_LABELED);
+            }
+        }
+    }
+}
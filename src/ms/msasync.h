@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSASYNC_H
+#define MSASYNC_H
+
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "ms.h"
+#include "msengine.h"
+
+
+/*Enumeration MSJobStage names the results of a job in the order they become ready */
+enum MSJobStage
+{
+    MS_STAGE_FILTERED,  // filtered L*u*v image
+    MS_STAGE_CLUSTERED, // labels of MS_Cluster, before the transitive closure
+    MS_STAGE_LABELED,   // labels of the regions after the merging and the pruning
+    MS_STAGES
+};
+
+class MSJob;
+class MSExecutor;
+
+
+/*Class MSJobListener is told about the results of a job on the thread which produced them.
+  It must not destroy the job or wait for a later stage of it. */
+class MSJobListener
+{
+public:
+    virtual ~MSJobListener() {}
+
+    // stage of job is ready, its result can be read
+    virtual void Ready(MSJob &job, MSJobStage stage) = 0;
+    // job ended, after its last Ready; also when it was cancelled
+    virtual void Finished(MSJob &) {}
+};
+
+
+/*Class MSJob is a segmentation submitted to an MSExecutor and the handle of its staged results.
+  The result of a stage is written once and can be read from any thread after Wait or Ready of
+  that stage returned true. */
+class MSJob
+{
+public:
+    MSJob(const uchar *image, int width, int height, int spatial_radius, double color_radius, int minRegion,
+          MSJobListener *listener = NULL);
+    ~MSJob();
+
+    bool Ready(MSJobStage stage);
+    bool Wait(MSJobStage stage);
+    void Cancel();
+    bool Cancelled();
+    bool Finished();
+    void WaitFinished();
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    const uchar *Filtered() const { return &filtered[0]; }  // 3 * width * height bytes of planar L*u*v
+    const int *Clusters() const { return &clusters[0]; }    // width * height labels, row-major
+    int NumClusters() const { return num_clusters; }
+    const int *Labels() const { return &labels[0]; }        // width * height labels, row-major
+    int Regions() const { return regions; }
+
+private:
+    friend class MSExecutor;
+
+    std::vector<uchar> image;   // planar RGB, or L*u*v with the luv option of the executor
+    int width, height;
+    int spatial_radius;
+    double color_radius;
+    int minRegion;
+    MSJobListener *listener;
+    MSExecutor *executor;       // set by Submit
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int ready;                  // stages which are ready
+    bool cancelled;
+    bool finished;              // the executor does not touch the job any more
+
+    std::vector<uchar> filtered;
+    std::vector<int> clusters;
+    std::vector<int> labels;
+    int num_clusters;
+    int regions;
+
+    bool Publish(MSJobStage stage);
+    void Finish();
+
+    // not copyable
+    MSJob(const MSJob &);
+    MSJob &operator=(const MSJob &);
+};
+
+
+/*Class MSExecutor segments the submitted jobs on a fixed number of workers, each with its own
+  MeanShiftEngine and, with options.num_threads, its own thread pool, see msasync.cpp */
+class MSExecutor
+{
+public:
+    MSExecutor(int num_workers, int num_iters, const MSOptions &options);
+    ~MSExecutor();
+
+    int Size() const { return (int)workers.size(); }
+    bool Submit(MSJob &job);
+
+private:
+    friend class MSJob;
+
+    /*Structure Worker holds the warm state of a worker between jobs */
+    struct Worker
+    {
+        MSExecutor *executor;
+        pthread_t thread;
+        ThreadPool *pool;           // workers of the parallel filter, NULL without threads
+        MeanShiftEngine *engine;    // scratch memory of the phases
+    };
+
+    MSOptions options;
+    std::vector<Worker> workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;          // a job was submitted or the executor stops
+    std::deque<MSJob*> queue;
+    std::vector<MSJob*> running;    // job of every worker, NULL when it waits
+    bool stopping;
+
+    static void *WorkerMain(void *arg);
+    void WorkerLoop(int worker);
+    void Process(MSJob &job, Worker &worker);
+    bool Withdraw(MSJob &job);
+
+    // not copyable
+    MSExecutor(const MSExecutor &);
+    MSExecutor &operator=(const MSExecutor &);
+};
+
+
+#endif /* MSASYNC_H */
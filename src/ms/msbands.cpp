@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ms.h"
+#include "../parallel/ThreadPool.h"
+
+
+/**
+ * @file msbands.cpp
+ * @brief Out-of-core filter of images larger than the memory
+ *
+ * The image is filtered in horizontal bands of band_height rows. A band is read with a halo of
+ * spatial_radius rows above and below, converted to L*u*v and filtered as an image of its own, and
+ * only its own rows are converted back and written. The window of a pixel is fixed at the pixel,
+ * so every pixel of a band sees exactly the neighbours it has in the whole image, and the windows
+ * sum the rows relative to the pixel, so the sums do not depend on the band either. The result is
+ * the one of the double-buffered filter (-t), except with the trajectory reuse (-u), whose regions
+ * end at the bands. The halo rows of the previous band are kept, so
+ * every row is read once. The memory is proportional to the width times the band height; the
+ * bands are read from a row source, so formats decoded row by row need no full-size buffer.
+ * MSPngReader and MSPngWriter stream PNG files through the bands: the first band is filtered
+ * once its rows are decoded and written while the next ones are still in the file. MSMappedReader
+ * and MSMappedWriter do the same for mapped PPM, PAM and raw planar RGB files and drop the pages
+ * of the rows done, so the mappings do not grow to the size of the image either.
+ * With options.num_threads the tiles of a band are filtered on options.pool, or on one pool started
+ * for all the bands.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function ReadRows copies the next rows of the planar image, interleaved
+*
+*  \param rgb count rows, 3 * width bytes per row
+*  \param count number of rows
+*  \return false after the last row
+*/
+bool MSPlanarRows::ReadRows(uchar *rgb, int count)
+{
+    const size_t size = (size_t)width * height;
+
+    if(read + count > height)
+        return false;
+    for(int y = read; y < read + count; y++)
+        for(int x = 0; x < width; x++, rgb += 3)
+        {
+            size_t k = (size_t)y * width + x;
+            rgb[0] = planar[k];
+            rgb[1] = planar[size + k];
+            rgb[2] = planar[2 * size + k];
+        }
+    read += count;
+    return true;
+}
+
+/*! \brief Function WriteRows copies the next interleaved rows into the planar image
+*
+*  \param rgb count rows, 3 * width bytes per row
+*  \param count number of rows
+*  \return false after the last row
+*/
+bool MSPlanarRows::WriteRows(const uchar *rgb, int count)
+{
+    const size_t size = (size_t)width * height;
+
+    if(written + count > height)
+        return false;
+    for(int y = written; y < written + count; y++)
+        for(int x = 0; x < width; x++, rgb += 3)
+        {
+            size_t k = (size_t)y * width + x;
+            planar[k] = rgb[0];
+            planar[size + k] = rgb[1];
+            planar[2 * size + k] = rgb[2];
+        }
+    written += count;
+    return true;
+}
+
+/*! \brief Constructor MSPngReader opens a PNG file, IsOpen tells if it succeeded
+*
+*  \param filename name of the file, "-" for the standard input
+*/
+MSPngReader::MSPngReader(const char *filename) : width(0), height(0)
+{
+    reader = io_png_read_open_u8_rgb(filename, &width, &height);
+}
+
+MSPngReader::~MSPngReader()
+{
+    io_png_read_close(reader);
+}
+
+/*! \brief Function ReadRows decodes the next rows of the file
+*
+*  \param rgb count rows, 3 * width bytes per row
+*  \param count number of rows
+*  \return false after the last row or if the file is broken
+*/
+bool MSPngReader::ReadRows(uchar *rgb, int count)
+{
+    return reader && io_png_read_rows(reader, rgb, count) == 0;
+}
+
+/*! \brief Constructor MSPngWriter creates a PNG file, IsOpen tells if it succeeded
+*
+*  \param filename name of the file, "-" for the standard output
+*  \param width width of the image
+*  \param height height of the image
+*  \param options compression of the file, NULL for the defaults
+*/
+MSPngWriter::MSPngWriter(const char *filename, int width, int height, const io_png_options *options)
+{
+    writer = io_png_write_open_u8_opt(filename, width, height, 3, options);
+}
+
+MSPngWriter::~MSPngWriter()
+{
+    Close();
+}
+
+/*! \brief Function WriteRows encodes the next rows of the file
+*
+*  \param rgb count rows, 3 * width bytes per row
+*  \param count number of rows
+*  \return false after the last row or if the file can not be written
+*/
+bool MSPngWriter::WriteRows(const uchar *rgb, int count)
+{
+    return writer && io_png_write_rows(writer, rgb, count) == 0;
+}
+
+/*! \brief Function Close ends the file, later calls do nothing
+*
+*  \return false if a row is missing or the file can not be written
+*/
+bool MSPngWriter::Close()
+{
+    if(!writer)
+        return false;
+    bool ok = io_png_write_close(writer) == 0;
+    writer = NULL;
+    return ok;
+}
+
+
+/*! \brief Constructor MSMappedReader maps a PPM, PAM or raw planar RGB file, IsOpen tells if it succeeded
+*
+*  \param filename name of the file
+*/
+MSMappedReader::MSMappedReader(const char *filename) : read(0)
+{
+    // the planes of a raw L*u*v file are not RGB
+    if(!file.Open(filename) || !ParseImageHeader(file.Data(), file.Size(), &layout) || layout.format == IMAGE_FILE_RAW_LUV)
+        file.Close();
+    if(!file.Data())
+        layout.width = layout.height = 0;
+}
+
+/*! \brief Function ReadRows interleaves the next rows of the file
+*
+*  \param rgb count rows, 3 * width bytes per row
+*  \param count number of rows
+*  \return false after the last row
+*/
+bool MSMappedReader::ReadRows(uchar *rgb, int count)
+{
+    const int width = layout.width, depth = layout.depth;
+    const size_t size = (size_t)width * layout.height, pixels = (size_t)width * count;
+    const uchar *data = file.Data() + layout.offset;
+
+    if(!file.Data() || read + count > layout.height)
+        return false;
+    if(layout.format == IMAGE_FILE_RAW_RGB)
+    {
+        const uchar *r = data + (size_t)width * read, *g = r + size, *b = g + size;
+        for(size_t k = 0; k < pixels; k++, rgb += 3)
+        {
+            rgb[0] = r[k];
+            rgb[1] = g[k];
+            rgb[2] = b[k];
+        }
+        for(int c = 0; c < 3; c++)
+            file.Drop(layout.offset + c * size + (size_t)width * read, layout.offset + c * size + (size_t)width * (read + count));
+    }
+    else
+    {
+        const bool gray = depth < 3;
+        const uchar *p = data + (size_t)depth * width * read;
+        for(size_t k = 0; k < pixels; k++, p += depth, rgb += 3)
+        {
+            rgb[0] = p[0];
+            rgb[1] = p[gray ? 0 : 1];
+            rgb[2] = p[gray ? 0 : 2];
+        }
+        file.Drop(layout.offset + (size_t)depth * width * read, layout.offset + (size_t)depth * width * (read + count));
+    }
+    read += count;
+    return true;
+}
+
+/*! \brief Constructor MSMappedWriter creates a PPM, PAM or raw planar RGB file of its final size,
+*  IsOpen tells if it succeeded
+*
+*  \param filename name of the file, the format is chosen by ImageFileFormatOf; PNG and L*u*v are not written
+*  \param width width of the image
+*  \param height height of the image
+*/
+MSMappedWriter::MSMappedWriter(const char *filename, int width, int height) : written(0)
+{
+    char header[2 * IMAGE_FILE_HEADER];
+
+    layout.format = ImageFileFormatOf(filename);
+    layout.width = width;
+    layout.height = height;
+    layout.depth = 3;
+    layout.offset = 0;
+    if(width <= 0 || height <= 0 || layout.format == IMAGE_FILE_PNG || layout.format == IMAGE_FILE_RAW_LUV)
+        return;
+    layout.offset = MakeImageHeader(header, layout.format, width, height);
+    if(file.Create(filename, layout.offset + (size_t)3 * width * height))
+        memcpy(file.Data(), header, layout.offset);
+}
+
+MSMappedWriter::~MSMappedWriter()
+{
+    Close();
+}
+
+/*! \brief Function WriteRows stores the next rows in the file
+*
+*  \param rgb count rows, 3 * width bytes per row
+*  \param count number of rows
+*  \return false after the last row or if the file was not created
+*/
+bool MSMappedWriter::WriteRows(const uchar *rgb, int count)
+{
+    const int width = layout.width;
+    const size_t size = (size_t)width * layout.height, pixels = (size_t)width * count;
+    uchar *data = file.Data() + layout.offset;
+
+    if(!file.Data() || written + count > layout.height)
+        return false;
+    if(layout.format == IMAGE_FILE_RAW_RGB)
+    {
+        uchar *r = data + (size_t)width * written, *g = r + size, *b = g + size;
+        for(size_t k = 0; k < pixels; k++, rgb += 3)
+        {
+            r[k] = rgb[0];
+            g[k] = rgb[1];
+            b[k] = rgb[2];
+        }
+        for(int c = 0; c < 3; c++)
+            file.Drop(layout.offset + c * size + (size_t)width * written, layout.offset + c * size + (size_t)width * (written + count));
+    }
+    else
+    {
+        memcpy(data + (size_t)3 * width * written, rgb, 3 * pixels);
+        file.Drop(layout.offset + (size_t)3 * width * written, layout.offset + (size_t)3 * width * (written + count));
+    }
+    written += count;
+    return true;
+}
+
+/*! \brief Function Close unmaps the file, later calls do nothing
+*
+*  \return false if a row is missing or the file can not be written
+*/
+bool MSMappedWriter::Close()
+{
+    if(!file.Data())
+        return false;
+    bool ok = written == layout.height;
+    return file.Close() && ok;
+}
+
+
+/*Structure MSBandRows holds the planar rows of the color conversions */
+struct MSBandRows
+{
+    std::vector<uchar> interleaved;     // rows as read or written
+    std::vector<uchar> planes;          // one row of 6 planes, R G B L u v
+
+    MSBandRows(int width, int rows) : interleaved((size_t)3 * width * rows), planes((size_t)6 * width) {}
+};
+
+/*! \brief Function MS_ReadBand reads rows of the source and converts them to L*u*v
+*
+*  \param source row source
+*  \param rows buffers of the conversion
+*  \param band image of the band
+*  \param y0 first row of the band to read
+*  \param count number of rows to read
+*  \return false if the source fails
+*/
+static bool MS_ReadBand(MSRowSource &source, MSBandRows &rows, AlignedImage &band, int y0, int count)
+{
+    const int width = band.Width();
+    uchar *r = &rows.planes[0], *g = r + width, *b = g + width;
+    uchar *l = b + width, *u = l + width, *v = u + width;
+
+    if(count <= 0)
+        return true;
+    if(!source.ReadRows(&rows.interleaved[0], count))
+        return false;
+
+    for(int y = 0; y < count; y++)
+    {
+        const uchar *rgb = &rows.interleaved[(size_t)3 * width * y];
+        for(int x = 0; x < width; x++)
+        {
+            r[x] = rgb[3 * x];
+            g[x] = rgb[3 * x + 1];
+            b[x] = rgb[3 * x + 2];
+        }
+
+        // black stays zero
+        memset(l, 0, 3 * width);
+        CPU_Kernels().rgb2luv(r, g, b, l, u, v, width);
+
+        for(int c = 1; c <= 3; c++)
+        {
+            const uchar *src = l + (c - 1) * width;
+            if(band.IsPacked())
+                for(int x = 0; x < width; x++)
+                    band.Set(x, y0 + y, c, src[x]);
+            else
+                memcpy(band.Plane(c) + (size_t)(y0 + y) * band.Stride(), src, width);
+        }
+    }
+    return true;
+}
+
+/*! \brief Function MS_WriteBand converts rows of the filtered band to RGB and writes them to the sink
+*
+*  \param sink row sink
+*  \param rows buffers of the conversion
+*  \param band filtered planar image of the band
+*  \param y0 first row of the band to write
+*  \param count number of rows to write
+*  \return false if the sink fails
+*/
+static bool MS_WriteBand(MSRowSink &sink, MSBandRows &rows, const AlignedImage &band, int y0, int count)
+{
+    const int width = band.Width();
+    uchar *r = &rows.planes[0], *g = r + width, *b = g + width;
+
+    for(int y = 0; y < count; y++)
+    {
+        const size_t offset = (size_t)(y0 + y) * band.Stride();
+        CPU_Kernels().luv2rgb(band.Plane(1) + offset, band.Plane(2) + offset, band.Plane(3) + offset, r, g, b, width);
+
+        uchar *rgb = &rows.interleaved[(size_t)3 * width * y];
+        for(int x = 0; x < width; x++)
+        {
+            rgb[3 * x] = r[x];
+            rgb[3 * x + 1] = g[x];
+            rgb[3 * x + 2] = b[x];
+        }
+    }
+    return sink.WriteRows(&rows.interleaved[0], count);
+}
+
+/*! \brief Function MS_CopyRows copies rows between bands of the same layout and width
+*
+*  \param src band the rows are copied from
+*  \param src_y first row in src
+*  \param dst band the rows are copied to
+*  \param dst_y first row in dst
+*  \param count number of rows
+*/
+static void MS_CopyRows(const AlignedImage &src, int src_y, AlignedImage &dst, int dst_y, int count)
+{
+    const int planes = src.IsPacked() ? 1 : 3;
+    const size_t bytes = (size_t)src.Width() * (src.IsPacked() ? IMAGE_PACKED_BYTES : 1);
+
+    for(int c = 1; c <= planes; c++)
+        for(int y = 0; y < count; y++)
+            memcpy(dst.Plane(c) + (size_t)(dst_y + y) * dst.Stride(), src.Plane(c) + (size_t)(src_y + y) * src.Stride(), bytes);
+}
+
+/*! \brief Function MS_FilterBands filters an image from a row source to a row sink in bands with a
+*  halo of spatial_radius rows, see msbands.cpp. The result is the one of MS_Filter with
+*  options.num_threads > 0, except with the trajectory reuse. The pyramid and the diagnostics need
+*  the whole image and are rejected.
+*
+*  \param source RGB rows of the input image
+*  \param sink receives the RGB rows of the filtered image
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param num_iters maximal number of iterations
+*  \param options settings of the filter, options.stats is the sum over the bands, where the halo rows
+*  are filtered again
+*  \param band_height rows of a band, MS_BAND_HEIGHT if not positive
+*  \return false if the source or the sink fails, or options.pyramid or options.diagnostics are set
+*/
+bool MS_FilterBands(MSRowSource &source, MSRowSink &sink, int spatial_radius, double color_radius, int num_iters,
+                    const MSOptions &options, int band_height)
+{
+    const int width = source.Width();
+    const int height = source.Height();
+    const int R = spatial_radius;
+    const ImageLayout layout = options.packed ? IMAGE_PACKED : IMAGE_PLANAR;
+
+    if(options.pyramid > 0 || options.diagnostics)
+        return false;
+    if(band_height <= 0)
+        band_height = MS_BAND_HEIGHT;
+
+    MSOptions band_options = options;
+    MSFilterStats band_stats, total = MSFilterStats();
+    band_options.stats = &band_stats;
+    // one pool for all the bands, not one started and joined per band
+    ThreadPool *started = options.num_threads > 0 && !options.pool ? new ThreadPool(options.num_threads) : NULL;
+    if(started)
+        band_options.pool = started;
+
+    MSBandRows rows(width, band_height + 2 * R);
+    AlignedImage bands[2], filtered;
+    int current = 0;
+    int loaded_from = 0, loaded_to = 0;     // rows of the image in bands[current]
+    bool ok = true;
+
+    for(int y0 = 0; ok && y0 < height; y0 += band_height)
+    {
+        const int y1 = min(height, y0 + band_height);
+        const int from = max(0, y0 - R);
+        const int to = min(height, y1 + R);
+        AlignedImage &band = bands[1 - current];
+
+        // the halo rows of the previous band are kept, the rest is read
+        band.Allocate(width, to - from, 3, layout, options.packed ? R : 0);
+        int kept = max(0, loaded_to - from);
+        if(kept > 0)
+            MS_CopyRows(bands[current], from - loaded_from, band, 0, kept);
+        if(!(ok = MS_ReadBand(source, rows, band, kept, to - from - kept)))
+            break;
+
+        filtered.Allocate(width, to - from, 3);
+        band_options.row_offset = from;
+        MS_Filter(band, filtered, R, color_radius, num_iters, band_options);
+        ok = MS_WriteBand(sink, rows, filtered, y0 - from, y1 - y0);
+
+        total.reused += band_stats.reused;
+        total.iterations += band_stats.iterations;
+        total.capped += band_stats.capped;
+        current = 1 - current;
+        loaded_from = from;
+        loaded_to = to;
+    }
+    delete started;
+
+    if(ok && options.stats)
+    {
+        total.pixels = (long)width * height;
+        total.levels = 1;
+        total.level_iterations[0] = total.iterations;
+        *options.stats = total;
+    }
+    return ok;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ms.h"
+#include "msengine.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <dirent.h>
+#include <time.h>
+#include "../io_file/ImageFile.h"
+#include "../parallel/Pipeline.h"
+
+
+/**
+ * @file msbatch.cpp
+ * @brief Segmentation of a batch of images in one process
+ *
+ * The items of a batch pass three stages, decoding, filtering and segmentation, and encoding, on the
+ * workers of one thread pool, see Pipeline. While an item is computed the next ones are decoded and
+ * the previous ones encoded, and at most capacity decoded or computed items wait for their next
+ * stage, which bounds the memory. The colors of the regions of every item are the ones of a
+ * separate run of meanshift, also when several items are segmented at once.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+/*! \brief Function MS_BatchClock returns a monotonic time
+*
+*  \return seconds
+*/
+static double MS_BatchClock()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+/*! \brief Function MS_ReadBatchManifest reads the items of a batch, one per line:
+*  input spatial_radius color_radius minRegion output_segmented [output_filtered].
+*  Empty lines and lines starting with # are skipped.
+*
+*  \param filename name of the manifest
+*  \param items the items are appended
+*  \return false if the manifest can not be read or a line is not valid
+*/
+bool MS_ReadBatchManifest(const char *filename, std::vector<MSBatchItem> &items)
+{
+    std::ifstream manifest(filename);
+    std::string line;
+
+    if(!manifest)
+        return false;
+    while(std::getline(manifest, line))
+    {
+        std::istringstream fields(line);
+        MSBatchItem item;
+        if(!(fields >> item.input) || item.input[0] == '#')
+            continue;
+        if(!(fields >> item.spatial_radius >> item.color_radius >> item.minRegion >> item.segmented))
+        {
+            std::cerr << filename << ": not a batch item: " << line << std::endl;
+            return false;
+        }
+        fields >> item.filtered;
+        items.push_back(item);
+    }
+    return true;
+}
+
+/*! \brief Function MS_ListBatchDirectory makes an item of every image of a directory, in the order of
+*  the names; the segmented image is written under the same name to the output directory
+*
+*  \param directory directory of the images, files with the extension of an ImageFileFormat
+*  \param spatial_radius, color_radius, minRegion parameters of every item
+*  \param output_directory directory of the segmented images
+*  \param items the items are appended
+*  \return false if the directory can not be read
+*/
+bool MS_ListBatchDirectory(const char *directory, int spatial_radius, double color_radius, int minRegion,
+                           const char *output_directory, std::vector<MSBatchItem> &items)
+{
+    static const char *extensions[] = { ".png", ".ppm", ".pam", ".rgb", ".luv" };
+    DIR *dir = opendir(directory);
+    std::vector<std::string> names;
+
+    if(!dir)
+        return false;
+    for(struct dirent *entry; (entry = readdir(dir)) != NULL; )
+    {
+        const char *dot = strrchr(entry->d_name, '.');
+        for(size_t k = 0; dot && k < sizeof(extensions) / sizeof(extensions[0]); k++)
+            if(strcmp(dot, extensions[k]) == 0)
+                names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for(size_t k = 0; k < names.size(); k++)
+    {
+        MSBatchItem item;
+        item.input = std::string(directory) + "/" + names[k];
+        item.spatial_radius = spatial_radius;
+        item.color_radius = color_radius;
+        item.minRegion = minRegion;
+        item.segmented = std::string(output_directory) + "/" + names[k];
+        items.push_back(item);
+    }
+    return true;
+}
+
+/*Structure MSBatchImage holds the buffers of an item between its stages */
+struct MSBatchImage
+{
+    InputImage input;
+    std::vector<uchar> segmented;
+    std::vector<uchar> filtered;
+    std::vector<int> labels;
+    int width, height;  // kept after the input is released
+    double start;
+
+    MSBatchImage() : width(0), height(0), start(0) {}
+};
+
+/*Class MSBatchStages decodes, segments and encodes the items of a batch */
+class MSBatchStages : public PipelineStages
+{
+public:
+    MSBatchStages(std::vector<MSBatchItem> &items, int num_iters, const MSOptions &options, const io_png_options *png, int num_workers)
+        : items(items), images(items.size(), (MSBatchImage*)NULL), engines(num_workers, (MeanShiftEngine*)NULL),
+          pools(num_workers, (ThreadPool*)NULL), num_iters(num_iters), options(options), png(png)
+    {
+        // started once, not per item
+        for(int w = 0; w < num_workers && options.num_threads > 0; w++)
+            pools[w] = new ThreadPool(options.num_threads);
+    }
+    ~MSBatchStages()
+    {
+        for(size_t k = 0; k < images.size(); k++)
+            delete images[k];
+        for(size_t w = 0; w < engines.size(); w++)
+        {
+            delete engines[w];
+            delete pools[w];
+        }
+    }
+
+    bool Execute(int stage, int item, int worker);
+
+private:
+    std::vector<MSBatchItem> &items;
+    std::vector<MSBatchImage*> images;
+    std::vector<MeanShiftEngine*> engines;  // of every worker, their scratch memory is kept between the items
+    std::vector<ThreadPool*> pools;         // of every worker with options.num_threads, filter and encoder share it
+    int num_iters;
+    const MSOptions &options;
+    const io_png_options *png;
+
+    bool Decode(MSBatchItem &item, MSBatchImage &image);
+    void Compute(MSBatchItem &item, MSBatchImage &image, int worker);
+    bool Encode(MSBatchItem &item, MSBatchImage &image, int worker);
+};
+
+/*! \brief Function Execute runs a stage of an item, an item which fails is dropped
+*
+*  \param stage 0 decodes, 1 computes and 2 encodes
+*  \param item index of the item
+*  \param worker index of the worker
+*/
+bool MSBatchStages::Execute(int stage, int item, int worker)
+{
+    const double start = MS_BatchClock();
+    bool ok = true;
+
+    if(stage == 0)
+    {
+        images[item] = new MSBatchImage();
+        images[item]->start = start;
+        ok = Decode(items[item], *images[item]);
+        items[item].decode_time = MS_BatchClock() - start;
+    }
+    else if(stage == 1)
+    {
+        Compute(items[item], *images[item], worker);
+        items[item].compute_time = MS_BatchClock() - start;
+    }
+    else
+    {
+        ok = items[item].ok = Encode(items[item], *images[item], worker);
+        items[item].encode_time = MS_BatchClock() - start;
+        items[item].latency = MS_BatchClock() - images[item]->start;
+    }
+    if(!ok || stage == 2)
+    {
+        delete images[item];
+        images[item] = NULL;
+    }
+    return ok;
+}
+
+/*! \brief Function Decode reads the input of an item, converted to L*u*v
+*
+*  \param item item
+*  \param image buffers of the item
+*  \return false if the input can not be read
+*/
+bool MSBatchStages::Decode(MSBatchItem &item, MSBatchImage &image)
+{
+    if(!image.input.Open(item.input.c_str(), true))
+    {
+        std::cerr << "Can not read " << item.input << std::endl;
+        return false;
+    }
+    image.width = image.input.Width();
+    image.height = image.input.Height();
+    return true;
+}
+
+/*! \brief Function Compute filters and segments an item with the engine of the worker, the input is released
+*
+*  \param item item
+*  \param image buffers of the item
+*  \param worker index of the worker
+*/
+void MSBatchStages::Compute(MSBatchItem &item, MSBatchImage &image, int worker)
+{
+    const size_t size = (size_t)image.width * image.height;
+
+    if(!engines[worker])
+    {
+        engines[worker] = new MeanShiftEngine(options, num_iters);
+        engines[worker]->Options().stats = NULL;
+        engines[worker]->Options().diagnostics = NULL;
+        engines[worker]->Options().regions = NULL;
+        engines[worker]->Options().pool = pools[worker];
+    }
+    MeanShiftEngine &engine = *engines[worker];
+    engine.Options().luv = image.input.IsLUV();
+    image.labels.resize(size);
+    image.filtered.resize(3 * size);
+    image.segmented.resize(3 * size);
+    engine.Run(image.input.Planar(), &image.filtered[0], &image.labels[0], &image.segmented[0], image.width, image.height,
+               item.spatial_radius, item.color_radius, item.minRegion);
+    image.input.Release();
+}
+
+/*! \brief Function Encode writes the outputs of an item
+*
+*  \param item item
+*  \param image buffers of the item
+*  \param worker index of the worker
+*  \return false if an output can not be written
+*/
+bool MSBatchStages::Encode(MSBatchItem &item, MSBatchImage &image, int worker)
+{
+    const int width = image.width, height = image.height;
+    bool ok = WriteImage(item.segmented.c_str(), &image.segmented[0], width, height, false, png, 0, pools[worker]);
+
+    if(ok && !item.filtered.empty())
+        ok = WriteImage(item.filtered.c_str(), &image.filtered[0], width, height, true, png, 0, pools[worker]);
+    if(!ok)
+        std::cerr << "Can not write the outputs of " << item.input << std::endl;
+    return ok;
+}
+
+/*! \brief Function MS_RunBatch segments the items of a batch as MeanShift, decoding, computing and
+*  encoding overlapped on a pool of workers. The colors of the regions are the ones of a separate run
+*  unless options.color_seed is set. Every item gets its result and the times of its stages.
+*
+*  \param items items of the batch
+*  \param num_iters initial number of iterations
+*  \param options settings of the filter of every item, stats, diagnostics and regions are ignored
+*  \param png compression of the PNG outputs
+*  \param num_workers workers of the pool
+*  \param capacity items which may wait between two stages, MS_BATCH_QUEUE by default
+*  \return number of items read, segmented and written
+*/
+int MS_RunBatch(std::vector<MSBatchItem> &items, int num_iters, const MSOptions &options, const io_png_options *png,
+                int num_workers, int capacity)
+{
+    MSOptions batch_options = options;
+    if(!batch_options.color_seed)
+        batch_options.color_seed = 1;   // the seed of a new process
+
+    ThreadPool pool(num_workers);
+    Pipeline pipeline(pool, 3, capacity);
+    MSBatchStages stages(items, num_iters, batch_options, png, pool.Size());
+    pipeline.Run(stages, (int)items.size());
+
+    int done = 0;
+    for(size_t k = 0; k < items.size(); k++)
+        done += items[k].ok;
+    return done;
+}
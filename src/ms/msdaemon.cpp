@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "msdaemon.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "../parallel/ThreadPool.h"
+
+
+/**
+ * @file msdaemon.cpp
+ * @brief Segmentation served on a Unix domain socket
+ *
+ * A client creates a POSIX shared memory of MS_DaemonJobSize bytes, stores the planar RGB image at
+ * its start and sends a line "SEGMENT name width height spatial_radius color_radius minRegion". The
+ * daemon writes the planar RGB filtered image and the 32 bit labels, row-major, to the offsets of
+ * MS_DaemonLabelsOffset and answers "OK regions queue_ms compute_ms", "BUSY" if the admission
+ * queue is full, or "ERROR message". "STATS" answers the requests, the rejected and failed ones and
+ * the percentiles of the latency, from admission to the end, of the latest MS_DAEMON_LATENCIES
+ * successful jobs.
+ * A connection may send any number of requests, one at a time.
+ *
+ * Every worker takes the jobs from the queue in order and keeps its thread pool and its
+ * MeanShiftEngine between the jobs, so a small image costs no process start, no thread start and,
+ * after the first job of its size, no new scratch memory; the labels go straight to the shared memory.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+/*! \brief Function MS_DaemonClock returns a monotonic time
+*
+*  \return seconds
+*/
+static double MS_DaemonClock()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+/*Structure MSDaemonConnection passes the daemon and a client socket to a new thread */
+struct MSDaemonConnection
+{
+    MSDaemon *daemon;
+    int client;
+};
+
+
+/*! \brief Constructor of MSDaemon starts the workers and their thread pools
+*
+*  \param num_workers jobs processed at once, values smaller than 1 are treated as 1
+*  \param num_iters initial number of iterations
+*  \param options settings of the filter, with options.num_threads every worker keeps a pool of that many threads
+*  \param capacity jobs admitted but not yet started, more are answered BUSY
+*/
+MSDaemon::MSDaemon(int num_workers, int num_iters, const MSOptions &options, int capacity)
+    : num_iters(num_iters), options(options), capacity(capacity < 1 ? 1 : capacity), listener(-1),
+      workers(num_workers < 1 ? 1 : num_workers), stopping(false), requests(0), rejected(0), failed(0), completed(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&queued, NULL);
+    pthread_cond_init(&finished, NULL);
+
+    this->options.stats = NULL;
+    this->options.diagnostics = NULL;
+    for(size_t w = 0; w < workers.size(); w++)
+    {
+        workers[w].daemon = this;
+        workers[w].pool = options.num_threads > 0 ? new ThreadPool(options.num_threads) : NULL;
+        workers[w].engine = new MeanShiftEngine(this->options, num_iters);
+        workers[w].engine->Options().pool = workers[w].pool;
+        pthread_create(&workers[w].thread, NULL, WorkerMain, &workers[w]);
+    }
+}
+
+MSDaemon::~MSDaemon()
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&queued);
+    pthread_mutex_unlock(&lock);
+    for(size_t w = 0; w < workers.size(); w++)
+    {
+        pthread_join(workers[w].thread, NULL);
+        delete workers[w].engine;
+        delete workers[w].pool;
+    }
+    if(listener >= 0)
+        close(listener);
+
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&queued);
+    pthread_mutex_destroy(&lock);
+}
+
+/*! \brief Function Listen creates the socket of the daemon, an existing file of that name is replaced
+*
+*  \param path path of the Unix domain socket
+*  \return false if the socket can not be created
+*/
+bool MSDaemon::Listen(const char *path)
+{
+    struct sockaddr_un address;
+
+    if(strlen(path) >= sizeof(address.sun_path))
+        return false;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0)
+        return false;
+    unlink(path);
+    if(bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        close(listener);
+        listener = -1;
+        return false;
+    }
+    return true;
+}
+
+/*! \brief Function Serve accepts clients, each on a thread of its own, until accept fails
+*/
+void MSDaemon::Serve()
+{
+    while(true)
+    {
+        const int client = accept(listener, NULL, NULL);
+        if(client < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+
+        MSDaemonConnection *connection = new MSDaemonConnection;
+        connection->daemon = this;
+        connection->client = client;
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, ConnectionMain, connection) != 0)
+        {
+            close(client);
+            delete connection;
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+void *MSDaemon::ConnectionMain(void *arg)
+{
+    MSDaemonConnection *connection = (MSDaemonConnection *)arg;
+
+    connection->daemon->Connection(connection->client);
+    delete connection;
+    return NULL;
+}
+
+/*! \brief Function Connection answers the requests of a client, line by line, until it disconnects
+*
+*  \param client socket of the client, closed at the end
+*/
+void MSDaemon::Connection(int client)
+{
+    std::string pending;
+    char buffer[MS_DAEMON_LINE];
+
+    while(true)
+    {
+        size_t end = pending.find('\n');
+        if(end == std::string::npos)
+        {
+            if(pending.size() >= MS_DAEMON_LINE)
+            {
+                const char reply[] = "ERROR request too long\n";
+                send(client, reply, sizeof(reply) - 1, MSG_NOSIGNAL);
+                break;
+            }
+            const ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if(received < 0 && errno == EINTR)
+                continue;
+            if(received <= 0)
+                break;
+            pending.append(buffer, received);
+            continue;
+        }
+
+        std::string line = pending.substr(0, end);
+        pending.erase(0, end + 1);
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        const std::string reply = Request(line.c_str());
+        size_t sent = 0;
+        while(sent < reply.size())
+        {
+            const ssize_t count = send(client, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if(count < 0 && errno == EINTR)
+                continue;
+            if(count <= 0)
+                break;
+            sent += count;
+        }
+        if(sent < reply.size())
+            break;
+    }
+    close(client);
+}
+
+/*! \brief Function Request answers a request line
+*
+*  \param line request without its newline
+*  \return reply ended by a newline
+*/
+std::string MSDaemon::Request(const char *line)
+{
+    char command[16], memory[256], reply[128];
+    MSDaemonJob job;
+
+    if(sscanf(line, "%15s", command) != 1)
+        return "ERROR empty request\n";
+    if(strcmp(command, "STATS") == 0)
+        return Statistics();
+    if(strcmp(command, "SEGMENT") != 0)
+        return "ERROR unknown request\n";
+    if(sscanf(line, "SEGMENT %255s %d %d %d %lf %d", memory, &job.width, &job.height, &job.spatial_radius,
+              &job.color_radius, &job.minRegion) != 6
+       || job.width <= 0 || job.height <= 0 || job.spatial_radius < 0 || job.color_radius <= 0 || job.minRegion < 0)
+        return "ERROR malformed request\n";
+    job.memory = memory;
+
+    if(!Submit(job))
+        return "BUSY\n";
+    pthread_mutex_lock(&lock);
+    while(!job.done)
+        pthread_cond_wait(&finished, &lock);
+    pthread_mutex_unlock(&lock);
+
+    if(!job.ok)
+        return "ERROR " + job.error + "\n";
+    sprintf(reply, "OK %d %.3f %.3f\n", job.regions, 1000 * (job.started - job.admitted), 1000 * (job.finished - job.started));
+    return reply;
+}
+
+/*! \brief Function Submit admits a job to the queue of the workers
+*
+*  \param job job, it must live until it is done
+*  \return false if the queue is full
+*/
+bool MSDaemon::Submit(MSDaemonJob &job)
+{
+    pthread_mutex_lock(&lock);
+    requests++;
+    if((int)queue.size() >= capacity)
+    {
+        rejected++;
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    job.admitted = MS_DaemonClock();
+    queue.push_back(&job);
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+void *MSDaemon::WorkerMain(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+
+    worker->daemon->WorkerLoop(*worker);
+    return NULL;
+}
+
+/*! \brief Function WorkerLoop processes the admitted jobs in order until the daemon stops
+*
+*  \param worker state of the worker
+*/
+void MSDaemon::WorkerLoop(Worker &worker)
+{
+    pthread_mutex_lock(&lock);
+    while(true)
+    {
+        while(queue.empty() && !stopping)
+            pthread_cond_wait(&queued, &lock);
+        if(stopping)
+            break;
+        MSDaemonJob &job = *queue.front();
+        queue.pop_front();
+        pthread_mutex_unlock(&lock);
+
+        job.started = MS_DaemonClock();
+        Process(job, worker);
+        job.finished = MS_DaemonClock();
+
+        pthread_mutex_lock(&lock);
+        // failed jobs are counted apart, their early answer would lower the percentiles
+        if(job.ok)
+        {
+            const double latency = job.finished - job.admitted;
+            if(latencies.size() < MS_DAEMON_LATENCIES)
+                latencies.push_back(latency);
+            else
+                latencies[completed % MS_DAEMON_LATENCIES] = latency;
+            completed++;
+        }
+        failed += !job.ok;
+        job.done = true;
+        pthread_cond_broadcast(&finished);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*! \brief Function Process segments the image of a job in its shared memory
+*
+*  \param job job, ok and regions or error are set
+*  \param worker state of the worker, its buffers grow to the largest image
+*/
+void MSDaemon::Process(MSDaemonJob &job, Worker &worker)
+{
+    const int width = job.width, height = job.height;
+    const size_t pixels = (size_t)width * height, size = MS_DaemonJobSize(width, height);
+
+    const int fd = shm_open(job.memory.c_str(), O_RDWR, 0);
+    if(fd < 0)
+    {
+        job.error = "can not open " + job.memory;
+        return;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < size)
+    {
+        close(fd);
+        job.error = "shared memory too small for the image";
+        return;
+    }
+    uchar *data = (uchar *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        job.error = "can not map " + job.memory;
+        return;
+    }
+
+    if(worker.filtered.size() < 3 * pixels)
+        worker.filtered.resize(3 * pixels);
+    int *labels = (int *)(data + MS_DaemonLabelsOffset(width, height));
+    job.regions = worker.engine->Run(data, &worker.filtered[0], labels, NULL, width, height,
+                                     job.spatial_radius, job.color_radius, job.minRegion);
+
+    // the filtered image in RGB, as the filtered output of meanshift
+    const uchar *luv = &worker.filtered[0];
+    uchar *rgb = data + 3 * pixels;
+    CPU_Kernels().luv2rgb(luv, luv + pixels, luv + 2 * pixels, rgb, rgb + pixels, rgb + 2 * pixels, (int)pixels);
+    munmap(data, size);
+    job.ok = true;
+}
+
+/*! \brief Function Statistics answers the STATS request
+*
+*  \return "STATS requests n rejected n failed n p50 ms p90 ms p99 ms max ms", the percentiles of the
+*  latency of the latest successful jobs, 0 before the first one
+*/
+std::string MSDaemon::Statistics()
+{
+    pthread_mutex_lock(&lock);
+    std::vector<double> sorted = latencies;
+    const long total = requests, busy = rejected, errors = failed;
+    pthread_mutex_unlock(&lock);
+
+    std::sort(sorted.begin(), sorted.end());
+    const double fractions[] = { 0.5, 0.9, 0.99, 1.0 };
+    double percentile[4] = { 0, 0, 0, 0 };
+    for(int k = 0; k < 4 && !sorted.empty(); k++)
+    {
+        // nearest rank
+        size_t rank = (size_t)ceil(fractions[k] * sorted.size());
+        percentile[k] = 1000 * sorted[rank > 0 ? rank - 1 : 0];
+    }
+
+    char reply[256];
+    sprintf(reply, "STATS requests %ld rejected %ld failed %ld p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+            total, busy, errors, percentile[0], percentile[1], percentile[2], percentile[3]);
+    return reply;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSDAEMON_H
+#define MSDAEMON_H
+
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "ms.h"
+#include "msengine.h"
+
+#define MS_DAEMON_QUEUE 16          // default jobs admitted but not yet started
+#define MS_DAEMON_LATENCIES 4096    // latest latencies of the percentiles
+#define MS_DAEMON_LINE 512          // longest request line
+
+
+/*! \brief Function MS_DaemonLabelsOffset returns the offset of the labels in the shared memory of a job:
+*  the planar RGB input at 0, the planar RGB filtered image at 3 * width * height, then the labels
+*
+*  \param width width of the image
+*  \param height height of the image
+*  \return offset of the labels, aligned to 64 bytes
+*/
+inline size_t MS_DaemonLabelsOffset(int width, int height)
+{
+    return ((size_t)6 * width * height + 63) & ~(size_t)63;
+}
+
+/*! \brief Function MS_DaemonJobSize returns the smallest size of the shared memory of a job
+*
+*  \param width width of the image
+*  \param height height of the image
+*  \return bytes up to the end of the 32 bit labels
+*/
+inline size_t MS_DaemonJobSize(int width, int height)
+{
+    return MS_DaemonLabelsOffset(width, height) + (size_t)4 * width * height;
+}
+
+/*Structure MSDaemonJob is a segmentation requested by a client */
+struct MSDaemonJob
+{
+    std::string memory;     // name of the POSIX shared memory
+    int width, height;
+    int spatial_radius;
+    double color_radius;
+    int minRegion;
+
+    bool done;
+    bool ok;
+    std::string error;
+    int regions;            // number of regions, the labels are 0 to regions - 1
+    double admitted, started, finished;     // seconds of a monotonic clock
+
+    MSDaemonJob() : width(0), height(0), spatial_radius(0), color_radius(0), minRegion(0), done(false), ok(false),
+                    regions(0), admitted(0), started(0), finished(0) {}
+};
+
+/*Class MSDaemon serves segmentations to clients on a Unix domain socket, see msdaemon.cpp */
+class MSDaemon
+{
+public:
+    MSDaemon(int num_workers, int num_iters, const MSOptions &options, int capacity);
+    ~MSDaemon();
+
+    bool Listen(const char *path);
+    void Serve();
+
+private:
+    /*Structure Worker holds the warm state of a worker between jobs */
+    struct Worker
+    {
+        MSDaemon *daemon;
+        pthread_t thread;
+        ThreadPool *pool;           // workers of the parallel filter, NULL without threads
+        MeanShiftEngine *engine;    // scratch memory of the phases
+        std::vector<uchar> filtered;    // filtered L*u*v image, grown to the largest job
+    };
+
+    int num_iters;
+    MSOptions options;
+    int capacity;
+    int listener;
+    std::vector<Worker> workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;          // a job was admitted or the daemon stops
+    pthread_cond_t finished;        // a job is done
+    std::deque<MSDaemonJob*> queue;
+    bool stopping;
+    long requests, rejected, failed, completed;
+    std::vector<double> latencies;  // ring of the latencies of the latest MS_DAEMON_LATENCIES successful jobs
+
+    static void *WorkerMain(void *arg);
+    static void *ConnectionMain(void *arg);
+    void WorkerLoop(Worker &worker);
+    void Connection(int client);
+    bool Submit(MSDaemonJob &job);
+    void Process(MSDaemonJob &job, Worker &worker);
+    std::string Request(const char *line);
+    std::string Statistics();
+
+    // not copyable
+    MSDaemon(const MSDaemon &);
+    MSDaemon &operator=(const MSDaemon &);
+};
+
+
+#endif /* MSDAEMON_H */
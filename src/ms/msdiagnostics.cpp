@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ms.h"
+#include "mskernel.h"
+#include <stdio.h>
+#include <string>
+#include <sstream>
+
+
+/**
+ * @file msdiagnostics.cpp
+ * @brief Convergence diagnostics of the Meanshift filter
+ *
+ * With options.diagnostics the filter records for every pixel the number of iterations, the
+ * squared mean shift of the last iteration, the number of neighbours inside the color radius in
+ * the last iteration and whether the iteration limit was hit. The maps are written as 16 bit
+ * binary PGM images, which keep the full range of the values, and summarized as histograms.
+ * Only the full resolution level of a pyramid is recorded.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function MS_Saturate converts a count to the 16 bit value of a map
+*
+*  \param value non negative value
+*  \return value, at most 65535
+*/
+static inline unsigned short MS_Saturate(double value)
+{
+    return value >= 65535 ? 65535 : (unsigned short)value;
+}
+
+/*! \brief Function MS_Diagnose records the convergence of the pixel (i, j), ctx.diagnostics must be set
+*
+*  \param ctx filter settings
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param iters iterations of the pixel
+*  \param ms_shift squared mean shift of the last iteration
+*  \param num neighbours inside the color radius in the last iteration
+*  \param capped true if the pixel stopped at the iteration limit without converging
+*/
+void MS_Diagnose(const MSFilterContext &ctx, int i, int j, int iters, double ms_shift, int num, bool capped)
+{
+    MSDiagnostics *diagnostics = ctx.diagnostics;
+    const size_t k = (size_t)j * diagnostics->width + i;
+
+    diagnostics->iterations[k] = MS_Saturate(iters);
+    diagnostics->shift[k] = MS_Saturate(ms_shift * MS_DIAGNOSTICS_SHIFT_SCALE + 0.5);
+    diagnostics->support[k] = MS_Saturate(num);
+    diagnostics->capped[k] = capped ? 1 : 0;
+}
+
+/*! \brief Function MS_WriteMap writes a map as a 16 bit binary PGM image
+*
+*  \param filename name of the file
+*  \param map width * height values
+*  \param width width of the map
+*  \param height height of the map
+*  \return false if the file can not be written
+*/
+static bool MS_WriteMap(const std::string &filename, const std::vector<unsigned short> &map, int width, int height)
+{
+    FILE *file = fopen(filename.c_str(), "wb");
+
+    if(!file)
+        return false;
+
+    // PGM stores 16 bit samples most significant byte first
+    std::vector<unsigned char> row(2 * width);
+    bool ok = fprintf(file, "P5\n%d %d\n65535\n", width, height) > 0;
+    for(int y = 0; ok && y < height; y++)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            unsigned short value = map[(size_t)y * width + x];
+            row[2 * x] = (unsigned char)(value >> 8);
+            row[2 * x + 1] = (unsigned char)(value & 255);
+        }
+        ok = fwrite(&row[0], 1, row.size(), file) == row.size();
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+/*! \brief Function MS_WriteDiagnostics writes the maps as prefix_iterations.pgm, prefix_shift.pgm,
+*  prefix_support.pgm and prefix_capped.pgm, and their histograms as prefix_histogram.txt
+*
+*  \param diagnostics maps filled by the filter
+*  \param prefix path and beginning of the file names
+*  \return false if a file can not be written
+*/
+bool MS_WriteDiagnostics(const MSDiagnostics &diagnostics, const char *prefix)
+{
+    const std::string name = prefix;
+    const int width = diagnostics.width;
+    const int height = diagnostics.height;
+
+    bool ok = MS_WriteMap(name + "_iterations.pgm", diagnostics.iterations, width, height);
+    ok = MS_WriteMap(name + "_shift.pgm", diagnostics.shift, width, height) && ok;
+    ok = MS_WriteMap(name + "_support.pgm", diagnostics.support, width, height) && ok;
+    ok = MS_WriteMap(name + "_capped.pgm", diagnostics.capped, width, height) && ok;
+
+    FILE *file = fopen((name + "_histogram.txt").c_str(), "w");
+    if(!file)
+        return false;
+
+    std::ostringstream summary;
+    MS_DiagnosticsSummary(diagnostics, summary);
+    ok = fputs(summary.str().c_str(), file) >= 0 && ok;
+    return fclose(file) == 0 && ok;
+}
+
+/*! \brief Function MS_PrintHistogram prints the histogram of a map and the fraction of the pixels and
+*  of the iterations of every bin. Bins are single values, or powers of 2, 0, 1, 2-3, 4-7, ...
+*
+*  \param out stream
+*  \param title name of the map
+*  \param map values
+*  \param iterations iterations of every pixel
+*  \param linear true for bins of single values
+*/
+static void MS_PrintHistogram(std::ostream &out, const char *title, const std::vector<unsigned short> &map,
+                              const std::vector<unsigned short> &iterations, bool linear)
+{
+    std::vector<long> pixels(linear ? 65536 : 17), iters(pixels.size());
+    long total = 0;
+
+    for(size_t k = 0; k < map.size(); k++)
+    {
+        int bin = 0;
+        if(linear)
+            bin = map[k];
+        else
+            for(unsigned value = map[k]; value; value >>= 1)
+                bin++;
+        pixels[bin]++;
+        iters[bin] += iterations[k];
+        total += iterations[k];
+    }
+
+    out << title << ": from to pixels %pixels %iterations" << endl;
+    for(size_t bin = 0; bin < pixels.size(); bin++)
+    {
+        if(!pixels[bin])
+            continue;
+        long from = linear ? bin : bin ? 1L << (bin - 1) : 0;
+        long to = linear ? bin : bin ? (1L << bin) - 1 : 0;
+        out << "  " << from << " " << to << " " << pixels[bin] << " "
+            << 100.0 * pixels[bin] / map.size() << " " << (total ? 100.0 * iters[bin] / total : 0.0) << endl;
+    }
+}
+
+/*! \brief Function MS_DiagnosticsSummary prints the histograms of the maps. The share of the iterations
+*  of a bin shows where the filter spends its time.
+*
+*  \param diagnostics maps filled by the filter
+*  \param out stream
+*/
+void MS_DiagnosticsSummary(const MSDiagnostics &diagnostics, std::ostream &out)
+{
+    long iterations = 0, capped = 0;
+
+    for(size_t k = 0; k < diagnostics.iterations.size(); k++)
+    {
+        iterations += diagnostics.iterations[k];
+        capped += diagnostics.capped[k];
+    }
+
+    out << "pixels " << diagnostics.iterations.size() << ", iterations " << iterations << ", capped " << capped << endl;
+    MS_PrintHistogram(out, "iterations", diagnostics.iterations, diagnostics.iterations, true);
+    MS_PrintHistogram(out, "shift", diagnostics.shift, diagnostics.iterations, false);
+    MS_PrintHistogram(out, "support", diagnostics.support, diagnostics.iterations, false);
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+
+
+/**
+ * @file msdisc.cpp
+ * @brief Circular windows for the Meanshift filter
+ *
+ * The disc of radius R contains the offsets (dx, dy) with dx*dx + dy*dy <= R*R. Row dy of the
+ * disc spans dx = -w(dy) .. w(dy) with w(dy) = floor(sqrt(R*R - dy*dy)). For the radii 3 to 16
+ * the half widths are computed by the compiler and every row loop has a constant trip count;
+ * other radii and pixels whose disc is cut by the image edge use MS_WindowDisc.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+#define MS_DISC_MIN_RADIUS 3
+#define MS_DISC_MAX_RADIUS 16
+
+
+/*Template MSISqrt computes floor(sqrt(N)) at compile time by bisection of [LO, HI] */
+template<int N, int LO = 0, int HI = N>
+struct MSISqrt
+{
+    enum { MID = (LO + HI + 1) / 2 };
+    enum { value = MID * MID > N ? (int)MSISqrt<N, LO, MID - 1>::value : (int)MSISqrt<N, MID, HI>::value };
+};
+
+template<int N, int X>
+struct MSISqrt<N, X, X>
+{
+    enum { value = X };
+};
+
+
+/*! \brief Function MS_AddNeighbour adds one neighbour to the sums if its color is inside the color radius,
+*  with the same arithmetic as MS_AccumulateScalar.
+*
+*  \param L2, U2, V2 color of the neighbour
+*  \param ii, jj column of the neighbour and its row relative to the pixel
+*  \param L, U, V color of the window center
+*  \param color_radius_squared squared range radius
+*  \param s accumulated sums
+*/
+static inline void MS_AddNeighbour(float L2, float U2, float V2, int ii, int jj, float L, float U, float V,
+                                   double color_radius_squared, MSWindowSums &s)
+{
+    double dL = L2 - L;
+    double dU = U2 - U;
+    double dV = V2 - V;
+
+    if (dL * dL + dU * dU + dV * dV <= color_radius_squared)
+    {
+        s.mi += ii;
+        s.mj += jj;
+        s.mL += L2;
+        s.mU += U2;
+        s.mV += V2;
+        s.num++;
+    }
+}
+
+
+/*Template MSDiscRows sums the last N rows of the disc of radius R, row dy = R + 1 - N first */
+template<int R, int N, bool PACKED>
+struct MSDiscRows
+{
+    enum { DY = R + 1 - N };
+    enum { W = MSISqrt<R * R - DY * DY>::value };
+
+    static inline void Accumulate(const MSSource &src, int i, int j, float L, float U, float V,
+                                  double color_radius_squared, MSWindowSums &s)
+    {
+        const int jj = j + DY;
+
+        if(PACKED)
+        {
+            const uchar *p = src.packed + jj * src.stride + (i - W) * IMAGE_PACKED_BYTES;
+            for(int k = 0; k < 2 * W + 1; k++, p += IMAGE_PACKED_BYTES)
+                if(p[3])
+                    MS_AddNeighbour(p[0], p[1], p[2], i - W + k, DY, L, U, V, color_radius_squared, s);
+        }
+        else
+        {
+            const uchar *rowL = src.plane[0] + jj * src.stride + i - W;
+            const uchar *rowU = src.plane[1] + jj * src.stride + i - W;
+            const uchar *rowV = src.plane[2] + jj * src.stride + i - W;
+            for(int k = 0; k < 2 * W + 1; k++)
+                MS_AddNeighbour(rowL[k], rowU[k], rowV[k], i - W + k, DY, L, U, V, color_radius_squared, s);
+        }
+
+        MSDiscRows<R, N - 1, PACKED>::Accumulate(src, i, j, L, U, V, color_radius_squared, s);
+    }
+};
+
+template<int R, bool PACKED>
+struct MSDiscRows<R, 0, PACKED>
+{
+    static inline void Accumulate(const MSSource &, int, int, float, float, float, double, MSWindowSums &) {}
+};
+
+
+/*! \brief Function MS_DiscHalfWidths computes the half widths of the rows of a disc
+*
+*  \param spatial_radius radius of the disc
+*  \param halfwidth 2 * spatial_radius + 1 half widths, for the rows -spatial_radius .. spatial_radius
+*/
+void MS_DiscHalfWidths(int spatial_radius, int *halfwidth)
+{
+    for(int dy = -spatial_radius; dy <= spatial_radius; dy++)
+    {
+        int w = 0;
+        while((w + 1) * (w + 1) + dy * dy <= spatial_radius * spatial_radius)
+            w++;
+        halfwidth[dy + spatial_radius] = w;
+    }
+}
+
+/*! \brief Function MS_WindowDisc sums the disc around the pixel (i, j) row by row with ctx.accumulate.
+*  Rows are clamped to the image unless the packed image has a border as wide as the radius.
+*
+*  \param ctx filter settings, ctx.halfwidth must be set
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param L, U, V color of the window center
+*  \param sums accumulated sums
+*/
+void MS_WindowDisc(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums)
+{
+    const int R = ctx.spatial_radius;
+    const bool clamp = !ctx.src.packed || ctx.src.border < R;
+
+    sums->mi = sums->mj = sums->mL = sums->mU = sums->mV = 0;
+    sums->num = 0;
+
+    for(int dy = -R; dy <= R; dy++)
+    {
+        int jj = j + dy;
+        int ifrom = i - ctx.halfwidth[dy + R], ito = i + ctx.halfwidth[dy + R] + 1;
+
+        if(clamp)
+        {
+            if(jj < 0 || jj >= ctx.height)
+                continue;
+            ifrom = ifrom < 0 ? 0 : ifrom;
+            ito = ito > ctx.width ? ctx.width : ito;
+        }
+
+        MSWindowSums row;
+        ctx.accumulate(MS_ShiftRows(ctx.src, j), ifrom, ito, dy, dy + 1, L, U, V, ctx.color_radius_squared, &row);
+        sums->mi += row.mi;
+        sums->mj += row.mj;
+        sums->mL += row.mL;
+        sums->mU += row.mU;
+        sums->mV += row.mV;
+        sums->num += row.num;
+    }
+}
+
+/*! \brief Function MS_WindowDiscFixed sums the disc of radius R around the pixel (i, j) with unrolled rows.
+*  Pixels whose disc leaves the readable image go to MS_WindowDisc.
+*
+*  \param ctx filter settings
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param L, U, V color of the window center
+*  \param sums accumulated sums
+*/
+template<int R, bool PACKED>
+static void MS_WindowDiscFixed(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums)
+{
+    bool inside = (PACKED && ctx.src.border >= R) || (i >= R && j >= R && i + R < ctx.width && j + R < ctx.height);
+
+    if(!inside)
+    {
+        MS_WindowDisc(ctx, i, j, L, U, V, sums);
+        return;
+    }
+
+    MSWindowSums s;
+    s.mi = s.mj = s.mL = s.mU = s.mV = 0;
+    s.num = 0;
+    MSDiscRows<R, 2 * R + 1, PACKED>::Accumulate(ctx.src, i, j, L, U, V, ctx.color_radius_squared, s);
+    *sums = s;
+}
+
+
+#define MS_DISC_ENTRY(R) { MS_WindowDiscFixed<R, false>, MS_WindowDiscFixed<R, true> }
+
+// Specialized windows, indexed by radius - MS_DISC_MIN_RADIUS and layout
+static const MSWindowFunc ms_disc_windows[][2] =
+{
+    MS_DISC_ENTRY(3), MS_DISC_ENTRY(4), MS_DISC_ENTRY(5), MS_DISC_ENTRY(6),
+    MS_DISC_ENTRY(7), MS_DISC_ENTRY(8), MS_DISC_ENTRY(9), MS_DISC_ENTRY(10),
+    MS_DISC_ENTRY(11), MS_DISC_ENTRY(12), MS_DISC_ENTRY(13), MS_DISC_ENTRY(14),
+    MS_DISC_ENTRY(15), MS_DISC_ENTRY(16)
+};
+
+/*! \brief Function MS_SelectDiscWindow returns the disc window for the radius.
+*  The specialized windows compute with the scalar reference arithmetic; with a vectorized
+*  accumulation the disc is summed row by row by MS_WindowDisc.
+*
+*  \param spatial_radius radius of the disc
+*  \param packed true for the packed L u v X layout
+*  \param scalar true if the scalar accumulation is selected
+*  \return window function
+*/
+MSWindowFunc MS_SelectDiscWindow(int spatial_radius, bool packed, bool scalar)
+{
+    if(scalar && spatial_radius >= MS_DISC_MIN_RADIUS && spatial_radius <= MS_DISC_MAX_RADIUS)
+        return ms_disc_windows[spatial_radius - MS_DISC_MIN_RADIUS][packed ? 1 : 0];
+    return MS_WindowDisc;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "msengine.h"
+
+
+/**
+ * @file msengine.cpp
+ * @brief Mean shift phases with persistent scratch memory
+ *
+ * MeanShift allocates the L*u*v copy of the filter, the filtered copy, the modes and point counts
+ * of the clusters, the stacks of the flood fill, the region adjacency lists of every pass of the
+ * transitive closure and the segmented image, and frees them again. MeanShiftEngine keeps them in
+ * buffers which grow to the largest image and takes the images and the labels from the caller:
+ * the reference filter works in place in the output, the double-buffered filter reads the L*u*v
+ * input directly, and the labels are a row-major buffer of the caller. What remains allocated per
+ * call are the small tables of the filter, the copies its tiled variants make for in-place use,
+ * and the colors of the regions.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+/*! \brief Function MS_EngineReserve grows a buffer to at least count entries, its contents are not kept
+*
+*  \param buffer buffer
+*  \param count number of entries
+*  \return first entry
+*/
+template <class T> static T *MS_EngineReserve(std::vector<T> &buffer, size_t count)
+{
+    if(buffer.size() < count)
+    {
+        buffer.clear();
+        buffer.resize(count);
+    }
+    return &buffer[0];
+}
+
+
+/*! \brief Constructor of MeanShiftEngine
+*
+*  \param options settings of the filter, also of the colors and the regions of Run
+*  \param num_iters initial number of iterations
+*/
+MeanShiftEngine::MeanShiftEngine(const MSOptions &options, int num_iters)
+    : options(options), num_iters(num_iters), clusters(0)
+{
+}
+
+/*! \brief Function Filter filters an image as MS_Filter into a buffer of the caller
+*
+*  \param image planar RGB image, or L*u*v with options.luv; it is not changed
+*  \param filtered_luv filtered image in L*u*v, 3 * width * height bytes, can be image with options.luv
+*  \param width width of the image
+*  \param height height of the image
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*/
+void MeanShiftEngine::Filter(const uchar *image, uchar *filtered_luv, int width, int height, int spatial_radius, double color_radius)
+{
+    const size_t size = (size_t)width * height;
+    // the reference filter works in place, the output holds the L*u*v image; the double-buffered
+    // filter reads an L*u*v input directly unless it is also the output, its tiles would read
+    // neighbours already filtered by other threads
+    const bool in_place = options.num_threads <= 0;
+    uchar *source_luv;
+    if(options.luv && !in_place && image != filtered_luv)
+        source_luv = (uchar *)image;
+    else
+    {
+        source_luv = in_place ? filtered_luv : MS_EngineReserve(luv, 3 * size);
+        if(options.luv)
+        {
+            if(source_luv != image)
+                memcpy(source_luv, image, 3 * size);
+        }
+        else
+        {
+            // black stays zero
+            memset(source_luv, 0, 3 * size);
+            CPU_Kernels().rgb2luv(image, image + size, image + 2 * size, source_luv, source_luv + size, source_luv + 2 * size, (int)size);
+        }
+    }
+
+    AlignedImage planar;
+    if(options.packed)
+    {
+        // laid out again in the same memory unless a larger image arrives
+        if(!packed.IsPacked() || packed.Width() != width || packed.Height() != height || packed.Border() != spatial_radius)
+            packed.Reshape(width, height, 3, IMAGE_PACKED, spatial_radius);
+        packed.CopyFromPlanar(source_luv);
+    }
+    else
+        planar.Wrap(source_luv, width, height, 3);
+    AlignedImage &source = options.packed ? packed : planar;
+
+    if(in_place)
+    {
+        MS_Filter(source, source, spatial_radius, color_radius, num_iters, options);
+        if(options.packed)
+            packed.CopyToPlanar(filtered_luv);
+        return;
+    }
+
+    AlignedImage destination;
+    destination.Wrap(filtered_luv, width, height, 3);
+    MS_Filter(source, destination, spatial_radius, color_radius, num_iters, options);
+}
+
+/*! \brief Function Segment segments a filtered image as MS_Segment
+*
+*  \param filtered_luv filtered image in L*u*v
+*  \param labels label of every pixel, width * height in row-major order
+*  \param width width of the image
+*  \param height height of the image
+*  \param color_radius range radius
+*  \param minRegion minimal region for merging
+*  \return number of regions, the labels are 0 to that number - 1
+*/
+int MeanShiftEngine::Segment(const uchar *filtered_luv, int *labels, int width, int height, double color_radius, int minRegion)
+{
+    Cluster(filtered_luv, labels, width, height, color_radius);
+    return Merge(labels, width, height, color_radius, minRegion);
+}
+
+/*! \brief Function Cluster labels the connected pixels of similar color as MS_Cluster, the first half of Segment
+*
+*  \param filtered_luv filtered image in L*u*v
+*  \param labels label of every pixel, width * height in row-major order
+*  \param width width of the image
+*  \param height height of the image
+*  \param color_radius range radius
+*  \return number of clusters, the labels are 0 to that number - 1
+*/
+int MeanShiftEngine::Cluster(const uchar *filtered_luv, int *labels, int width, int height, double color_radius)
+{
+    const size_t size = (size_t)width * height;
+    int **label_rows = MS_EngineReserve(rows, height);
+    float *modes = MS_EngineReserve(mode, 3 * size);
+    int *points = MS_EngineReserve(mode_points, size);
+
+    for(int y = 0; y < height; y++)
+        label_rows[y] = labels + (size_t)y * width;
+    memset(points, 0, size * sizeof(int));
+
+    clusters = MS_Cluster((uchar *)filtered_luv, width, height, label_rows, points, modes, color_radius, stack);
+    return clusters;
+}
+
+/*! \brief Function Merge merges the clusters of the last Cluster as TransitiveClosure, the second half of Segment
+*
+*  \param labels labels of the last Cluster, or a copy of them; they are replaced by the labels of the regions
+*  \param width width of the image
+*  \param height height of the image
+*  \param color_radius range radius
+*  \param minRegion minimal region for merging
+*  \return number of regions, the labels are 0 to that number - 1
+*/
+int MeanShiftEngine::Merge(int *labels, int width, int height, double color_radius, int minRegion)
+{
+    int **label_rows = MS_EngineReserve(rows, height);
+
+    for(int y = 0; y < height; y++)
+        label_rows[y] = labels + (size_t)y * width;
+    return TransitiveClosure(width, height, label_rows, &mode_points[0], &mode[0], color_radius, clusters, minRegion, closure);
+}
+
+/*! \brief Function Run filters and segments an image as MeanShift
+*
+*  \param image planar RGB image, or L*u*v with options.luv; it is not changed
+*  \param filtered_luv filtered image in L*u*v, 3 * width * height bytes
+*  \param labels label of every pixel, width * height in row-major order
+*  \param segmented segmented RGB image colored as by MeanShift, 3 * width * height bytes, or NULL
+*  \param width width of the image
+*  \param height height of the image
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param minRegion minimal region for merging
+*  \return number of regions; options.regions is filled if it is not NULL
+*/
+int MeanShiftEngine::Run(const uchar *image, uchar *filtered_luv, int *labels, uchar *segmented, int width, int height,
+                         int spatial_radius, double color_radius, int minRegion)
+{
+    Filter(image, filtered_luv, width, height, spatial_radius, color_radius);
+    const int regions = Segment(filtered_luv, labels, width, height, color_radius, minRegion);
+
+    // as many colors as MeanShift draws, the clusters before the merging, so that rand() continues alike
+    const std::vector<int> color = options.color_seed ? GenerateRandomNumbers(clusters, options.color_seed) : GenerateRandomNumbers(clusters);
+    const size_t size = (size_t)width * height;
+    if(segmented)
+        for(size_t k = 0; k < size; k++)
+        {
+            segmented[k] = (uchar)(color[labels[k]] & 255);
+            segmented[size + k] = (uchar)((color[labels[k]] >> 8) & 255);
+            segmented[2 * size + k] = (uchar)((color[labels[k]] >> 16) & 255);
+        }
+    if(options.regions)
+    {
+        options.regions->count = regions;
+        options.regions->colors.resize(3 * regions);
+        for(int k = 0; k < regions; k++)
+            for(int c = 0; c < 3; c++)
+                options.regions->colors[3 * k + c] = (uchar)((color[k] >> (8 * c)) & 255);
+    }
+    return regions;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSENGINE_H
+#define MSENGINE_H
+
+
+#include <vector>
+#include "ms.h"
+#include "../ra/TransitiveClosure.h"
+
+
+/*Class MeanShiftEngine runs the phases of MeanShift on buffers of the caller. The scratch memory of
+  the phases is kept between the calls and only grows when a larger image arrives, so a sequence
+  of images costs no allocations and no new pages once the largest one was seen. The results are
+  the ones of MeanShift with the same options. An engine is used by one thread at a time. */
+class MeanShiftEngine
+{
+public:
+    MeanShiftEngine(const MSOptions &options = MSOptions(), int num_iters = 100);
+
+    MSOptions &Options() { return options; }
+    const MSOptions &Options() const { return options; }
+
+    void Filter(const uchar *image, uchar *filtered_luv, int width, int height, int spatial_radius, double color_radius);
+    int Segment(const uchar *filtered_luv, int *labels, int width, int height, double color_radius, int minRegion);
+    int Cluster(const uchar *filtered_luv, int *labels, int width, int height, double color_radius);
+    int Merge(int *labels, int width, int height, double color_radius, int minRegion);
+    int Run(const uchar *image, uchar *filtered_luv, int *labels, uchar *segmented, int width, int height,
+            int spatial_radius, double color_radius, int minRegion);
+
+private:
+    MSOptions options;
+    int num_iters;
+    int clusters;                   // regions of the last segmentation before they were merged
+
+    std::vector<uchar> luv;         // L*u*v image of the double-buffered filter
+    AlignedImage packed;            // packed copy of the image, reallocated only for a larger image
+    std::vector<float> mode;        // mode of every cluster, 3 per pixel
+    std::vector<int> mode_points;   // points of every cluster
+    std::vector<MSPoint> stack;     // flood fill of the clustering
+    std::vector<int*> rows;         // rows of the labels of the caller
+    TransitiveClosureArena closure;
+
+    // not copyable
+    MeanShiftEngine(const MeanShiftEngine &);
+    MeanShiftEngine &operator=(const MeanShiftEngine &);
+};
+
+
+#endif /* MSENGINE_H */
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+#include <cmath>
+#include <algorithm>
+
+
+/**
+ * @file mshistogram.cpp
+ * @brief Sliding window histogram for the first iteration of the Meanshift filter
+ *
+ * As in the median filter of Huang, the histogram of the window is updated when the window moves
+ * one pixel along a row: one column of the window leaves it and one enters, so an update costs
+ * 2 * (2 * spatial_radius + 1) pixels instead of (2 * spatial_radius + 1)^2. The first iteration
+ * of a pixel sums the bins whose mean color lies inside the color radius, which costs the same
+ * for every spatial radius. Pixels of a bin are taken or rejected together, so the first
+ * iteration is an approximation of the exact window sum.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function MS_HistogramAdd adds the pixel (x, y) to the histogram, or removes it
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*  \param x x coordinate of the pixel
+*  \param y y coordinate of the pixel
+*  \param sign 1 to add the pixel, -1 to remove it
+*/
+static inline void MS_HistogramAdd(const MSFilterContext &ctx, MSHistogram *hist, int x, int y, int sign)
+{
+    int L, U, V;
+
+    if(ctx.src.packed)
+    {
+        const uchar *p = ctx.src.packed + y * ctx.src.stride + x * IMAGE_PACKED_BYTES;
+        L = p[0];
+        U = p[1];
+        V = p[2];
+    }
+    else
+    {
+        L = ctx.src.plane[0][y * ctx.src.stride + x];
+        U = ctx.src.plane[1][y * ctx.src.stride + x];
+        V = ctx.src.plane[2][y * ctx.src.stride + x];
+    }
+
+    MSIntSums &b = hist->bins[((L >> MS_HIST_SHIFT) * MS_HIST_LEVELS + (U >> MS_HIST_SHIFT)) * MS_HIST_LEVELS + (V >> MS_HIST_SHIFT)];
+    b.mi += sign * x;
+    b.mj += sign * y;
+    b.mL += sign * L;
+    b.mU += sign * U;
+    b.mV += sign * V;
+    b.num += sign;
+}
+
+/*! \brief Function MS_HistogramColumn adds or removes the pixel x = i + offset * halfwidth + shift of every row of the window of (i, j)
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param offset -1 for the left column, 1 for the right column of a row
+*  \param shift added to the column
+*  \param sign 1 to add the pixels, -1 to remove them
+*/
+static void MS_HistogramColumn(const MSFilterContext &ctx, MSHistogram *hist, int i, int j, int offset, int shift, int sign)
+{
+    const int R = ctx.spatial_radius;
+
+    for(int dy = -R; dy <= R; dy++)
+    {
+        int y = j + dy;
+        int x = i + offset * (ctx.halfwidth ? ctx.halfwidth[dy + R] : R) + shift;
+
+        if(y >= 0 && y < ctx.height && x >= 0 && x < ctx.width)
+            MS_HistogramAdd(ctx, hist, x, y, sign);
+    }
+}
+
+/*! \brief Function MS_HistogramWindow adds or removes all pixels of the window of (i, j)
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param sign 1 to add the pixels, -1 to remove them
+*/
+static void MS_HistogramWindow(const MSFilterContext &ctx, MSHistogram *hist, int i, int j, int sign)
+{
+    const int R = ctx.spatial_radius;
+
+    for(int dy = -R; dy <= R; dy++)
+    {
+        int y = j + dy;
+        int w = ctx.halfwidth ? ctx.halfwidth[dy + R] : R;
+
+        if(y < 0 || y >= ctx.height)
+            continue;
+        for(int x = std::max(0, i - w); x <= std::min(ctx.width - 1, i + w); x++)
+            MS_HistogramAdd(ctx, hist, x, y, sign);
+    }
+}
+
+/*! \brief Function MS_HistogramStart fills an empty histogram with the window of the pixel (i, j),
+*  the bins are allocated by the first call
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*/
+void MS_HistogramStart(const MSFilterContext &ctx, MSHistogram *hist, int i, int j)
+{
+    if(hist->bins.empty())
+    {
+        MSIntSums zero = {0, 0, 0, 0, 0, 0};
+        hist->bins.assign(MS_HIST_LEVELS * MS_HIST_LEVELS * MS_HIST_LEVELS, zero);
+    }
+
+    MS_HistogramWindow(ctx, hist, i, j, 1);
+    hist->i = i;
+    hist->j = j;
+}
+
+/*! \brief Function MS_HistogramNext moves the histogram to the window of the next pixel of the row
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*/
+void MS_HistogramNext(const MSFilterContext &ctx, MSHistogram *hist)
+{
+    MS_HistogramColumn(ctx, hist, hist->i, hist->j, -1, 0, -1);
+    MS_HistogramColumn(ctx, hist, hist->i, hist->j, 1, 1, 1);
+    hist->i++;
+}
+
+/*! \brief Function MS_HistogramClear removes the window from the histogram, which is empty afterwards
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*/
+void MS_HistogramClear(const MSFilterContext &ctx, MSHistogram *hist)
+{
+    MS_HistogramWindow(ctx, hist, hist->i, hist->j, -1);
+}
+
+/*! \brief Function MS_HistogramQuery sums the bins of the histogram whose mean color lies inside the color radius of (L, U, V).
+*  Only the bins overlapping the cube around the color radius are visited.
+*
+*  \param ctx filter settings
+*  \param hist histogram
+*  \param L, U, V color of the window center
+*  \param sums accumulated sums
+*/
+void MS_HistogramQuery(const MSFilterContext &ctx, const MSHistogram *hist, float L, float U, float V, MSIntSums *sums)
+{
+    const double r = sqrt(ctx.color_radius_squared);
+    const int Lfrom = std::max(0, (int)floor(L - r)) >> MS_HIST_SHIFT, Lto = std::min(255, (int)(L + r)) >> MS_HIST_SHIFT;
+    const int Ufrom = std::max(0, (int)floor(U - r)) >> MS_HIST_SHIFT, Uto = std::min(255, (int)(U + r)) >> MS_HIST_SHIFT;
+    const int Vfrom = std::max(0, (int)floor(V - r)) >> MS_HIST_SHIFT, Vto = std::min(255, (int)(V + r)) >> MS_HIST_SHIFT;
+
+    sums->mi = sums->mj = sums->mL = sums->mU = sums->mV = 0;
+    sums->num = 0;
+
+    for(int l = Lfrom; l <= Lto; l++)
+        for(int u = Ufrom; u <= Uto; u++)
+        {
+            const MSIntSums *b = &hist->bins[(l * MS_HIST_LEVELS + u) * MS_HIST_LEVELS];
+
+            for(int v = Vfrom; v <= Vto; v++)
+            {
+                const int n = b[v].num;
+                if(n == 0)
+                    continue;
+
+                // the mean color of the bin is inside the radius if |sum - n * center|^2 <= n^2 * r^2
+                double dL = b[v].mL - n * (double)L;
+                double dU = b[v].mU - n * (double)U;
+                double dV = b[v].mV - n * (double)V;
+                if(dL * dL + dU * dU + dV * dV > (double)n * n * ctx.color_radius_squared)
+                    continue;
+
+                sums->mi += b[v].mi;
+                sums->mj += b[v].mj;
+                sums->mL += b[v].mL;
+                sums->mU += b[v].mU;
+                sums->mV += b[v].mV;
+                sums->num += n;
+            }
+        }
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+#include <cmath>
+
+
+/**
+ * @file msint.cpp
+ * @brief Integer version of the Meanshift filter
+ *
+ * The color center is kept with MS_INT_SHIFT fractional bits, so a channel difference fits in
+ * 16 bits and the squared color distance in 32 bits, where it is compared with the squared
+ * range radius scaled by 2^(2 * MS_INT_SHIFT). The sums of a window are 32 bit integers and
+ * the division by the number of neighbours is a multiplication with a reciprocal from a table.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function MS_IntColorRadius scales the squared range radius for the integer filter
+*
+*  \param color_radius range radius
+*  \return squared range radius with 2 * MS_INT_SHIFT fractional bits
+*/
+int MS_IntColorRadius(double color_radius)
+{
+    double r = color_radius * color_radius * (1 << (2 * MS_INT_SHIFT));
+
+    // no distance is larger, and the scaled radius must fit into an int
+    if(r >= MS_INT_MAX_DISTANCE)
+        return MS_INT_MAX_DISTANCE;
+    return (int)floor(r);
+}
+
+/*! \brief Function MS_IntReciprocals fills the table of reciprocals ceil(2^32 / num).
+*  (sum * reciprocal) / 2^32 exceeds sum / num by less than sum / 2^32, so the truncated quotient
+*  is exact unless sum / num lies just below an integer.
+*
+*  \param max_num largest number of neighbours
+*  \param reciprocal max_num + 1 reciprocals, reciprocal[0] is 0
+*/
+void MS_IntReciprocals(int max_num, uint64_t *reciprocal)
+{
+    const uint64_t one = (uint64_t)1 << 32;
+
+    reciprocal[0] = 0;
+    for(int num = 1; num <= max_num; num++)
+        reciprocal[num] = (one + num - 1) / num;
+}
+
+
+/*! \brief Function MS_AccumulateIntScalar sums the neighbours of the window whose color lies inside the color radius
+*
+*  This is the reference for the vectorized versions in ms_avx2.cpp and ms_avx512.cpp.
+*
+*  \param src planar image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center with MS_INT_SHIFT fractional bits
+*  \param color_radius_int squared range radius with 2 * MS_INT_SHIFT fractional bits
+*  \param sums accumulated sums
+*/
+void MS_AccumulateIntScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                            int L, int U, int V, int color_radius_int, MSIntSums *sums)
+{
+    int mi = 0;
+    int mj = 0;
+    int mL = 0;
+    int mU = 0;
+    int mV = 0;
+    int num = 0;
+
+    for (int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *rowL = src.plane[0] + jj * src.stride;
+        const uchar *rowU = src.plane[1] + jj * src.stride;
+        const uchar *rowV = src.plane[2] + jj * src.stride;
+
+        for (int ii = ifrom; ii < ito; ii++)
+        {
+            short dL = (short)((rowL[ii] << MS_INT_SHIFT) - L);
+            short dU = (short)((rowU[ii] << MS_INT_SHIFT) - U);
+            short dV = (short)((rowV[ii] << MS_INT_SHIFT) - V);
+
+            if (dL * dL + dU * dU + dV * dV <= color_radius_int)
+            {
+                mi += ii;
+                mj += jj;
+                mL += rowL[ii];
+                mU += rowU[ii];
+                mV += rowV[ii];
+                num++;
+            }
+        }
+    }
+
+    sums->mi = mi;
+    sums->mj = mj;
+    sums->mL = mL;
+    sums->mU = mU;
+    sums->mV = mV;
+    sums->num = num;
+}
+
+/*! \brief Function MS_AccumulatePackedIntScalar is MS_AccumulateIntScalar for the packed L u v X layout,
+*  neighbours in the border of the image have X == 0 and are skipped
+*
+*  \param src packed image in L*u*v colorspace
+*  \param ifrom, ito horizontal range of the window
+*  \param jfrom, jto vertical range of the window
+*  \param L, U, V color of the window center with MS_INT_SHIFT fractional bits
+*  \param color_radius_int squared range radius with 2 * MS_INT_SHIFT fractional bits
+*  \param sums accumulated sums
+*/
+void MS_AccumulatePackedIntScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                                  int L, int U, int V, int color_radius_int, MSIntSums *sums)
+{
+    int mi = 0;
+    int mj = 0;
+    int mL = 0;
+    int mU = 0;
+    int mV = 0;
+    int num = 0;
+
+    for (int jj = jfrom; jj < jto; jj++)
+    {
+        const uchar *p = src.packed + jj * src.stride + ifrom * IMAGE_PACKED_BYTES;
+
+        for (int ii = ifrom; ii < ito; ii++, p += IMAGE_PACKED_BYTES)
+        {
+            short dL = (short)((p[0] << MS_INT_SHIFT) - L);
+            short dU = (short)((p[1] << MS_INT_SHIFT) - U);
+            short dV = (short)((p[2] << MS_INT_SHIFT) - V);
+
+            if (p[3] && dL * dL + dU * dU + dV * dV <= color_radius_int)
+            {
+                mi += ii;
+                mj += jj;
+                mL += p[0];
+                mU += p[1];
+                mV += p[2];
+                num++;
+            }
+        }
+    }
+
+    sums->mi = mi;
+    sums->mj = mj;
+    sums->mL = mL;
+    sums->mU = mU;
+    sums->mV = mV;
+    sums->num = num;
+}
+
+
+/*! \brief Function MS_WindowInt sums the window of the pixel (i, j), the square window or the disc
+*  when ctx.halfwidth is set. Windows are clamped to the image as in MS_WindowSquare and MS_WindowDisc.
+*
+*  \param ctx filter settings
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param L, U, V color of the window center with MS_INT_SHIFT fractional bits
+*  \param sums accumulated sums
+*/
+static void MS_WindowInt(const MSFilterContext &ctx, int i, int j, int L, int U, int V, MSIntSums *sums)
+{
+    const int R = ctx.spatial_radius;
+    const bool clamp = !ctx.src.packed || ctx.src.border < R;
+
+    if(!ctx.halfwidth)
+    {
+        int ifrom = i - R, ito = i + R + 1;
+        int jfrom = j - R, jto = j + R + 1;
+
+        if(clamp)
+        {
+            ifrom = ifrom < 0 ? 0 : ifrom;
+            ito = ito > ctx.width ? ctx.width : ito;
+            jfrom = jfrom < 0 ? 0 : jfrom;
+            jto = jto > ctx.height ? ctx.height : jto;
+        }
+
+        ctx.accumulate_int(ctx.src, ifrom, ito, jfrom, jto, L, U, V, ctx.color_radius_int, sums);
+        return;
+    }
+
+    sums->mi = sums->mj = sums->mL = sums->mU = sums->mV = 0;
+    sums->num = 0;
+
+    for(int dy = -R; dy <= R; dy++)
+    {
+        int jj = j + dy;
+        int ifrom = i - ctx.halfwidth[dy + R], ito = i + ctx.halfwidth[dy + R] + 1;
+
+        if(clamp)
+        {
+            if(jj < 0 || jj >= ctx.height)
+                continue;
+            ifrom = ifrom < 0 ? 0 : ifrom;
+            ito = ito > ctx.width ? ctx.width : ito;
+        }
+
+        MSIntSums row;
+        ctx.accumulate_int(ctx.src, ifrom, ito, jj, jj + 1, L, U, V, ctx.color_radius_int, &row);
+        sums->mi += row.mi;
+        sums->mj += row.mj;
+        sums->mL += row.mL;
+        sums->mU += row.mU;
+        sums->mV += row.mV;
+        sums->num += row.num;
+    }
+}
+
+/*! \brief Function MS_FilterPixelInt is the integer version of the Meanshift iterations for the pixel (i, j)
+*
+*  The mean shift is measured with 2 * MS_INT_SHIFT fractional bits and the iterations stop when
+*  it is at most 1, as in the floating point filter.
+*
+*  \param ctx filter settings
+*  \param worker mode table and histogram of the thread
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param luv converted L, u and v value
+*/
+void MS_FilterPixelInt(const MSFilterContext &ctx, MSWorker &worker, int i, int j, uchar *luv)
+{
+    MSReuse *reuse = worker.reuse;
+
+    if(reuse && MS_ReuseLookup(reuse, i, j, luv))
+    {
+        if(ctx.diagnostics)
+            MS_Diagnose(ctx, i, j, 0, 0, 0, false);
+        return;
+    }
+
+    const MSSource &src = ctx.src;
+    const int one = 1 << (2 * MS_INT_SHIFT);
+    int ic = i;
+    int jc = j + ctx.row_offset;   // in the rows of the whole image
+    int L, U, V;
+
+    if(src.packed)
+    {
+        const uchar *p = src.packed + j * src.stride + i * IMAGE_PACKED_BYTES;
+        L = p[0] << MS_INT_SHIFT;
+        U = p[1] << MS_INT_SHIFT;
+        V = p[2] << MS_INT_SHIFT;
+    }
+    else
+    {
+        L = src.plane[0][j * src.stride + i] << MS_INT_SHIFT;
+        U = src.plane[1][j * src.stride + i] << MS_INT_SHIFT;
+        V = src.plane[2][j * src.stride + i] << MS_INT_SHIFT;
+    }
+    if(ctx.start)
+    {
+        L = ctx.start->Get(i, j, 1) << MS_INT_SHIFT;
+        U = ctx.start->Get(i, j, 2) << MS_INT_SHIFT;
+        V = ctx.start->Get(i, j, 3) << MS_INT_SHIFT;
+    }
+
+    int ms_shift = 5 * one; // initial value of mean shift
+    int iters;
+    int num = 0; // support of the last window
+
+    for (iters = 0; ms_shift > one && iters < ctx.num_iters; iters++)
+    {
+        MSIntSums sums;
+        const float scale = 1.f / (1 << MS_INT_SHIFT);
+        sums.num = 0;
+        if(worker.histogram && iters < ctx.histogram_iters)
+            MS_HistogramQuery(ctx, worker.histogram, L * scale, U * scale, V * scale, &sums);
+        if(sums.num == 0)
+            MS_WindowInt(ctx, i, j, L, U, V, &sums);
+
+        // the center is too far from every neighbour, it can not move
+        if(sums.num == 0)
+            break;
+        num = sums.num;
+
+        const uint64_t r = ctx.reciprocal[sums.num];
+        int icOld = ic;
+        int jcOld = jc;
+        int LOld = L;
+        int UOld = U;
+        int VOld = V;
+
+        L = (int)((sums.mL * r) >> (32 - MS_INT_SHIFT));
+        U = (int)((sums.mU * r) >> (32 - MS_INT_SHIFT));
+        V = (int)((sums.mV * r) >> (32 - MS_INT_SHIFT));
+        ic = (int)((sums.mi * r + ((uint64_t)1 << 31)) >> 32);
+        jc = (int)(((sums.mj + sums.num * ctx.row_offset) * r + ((uint64_t)1 << 31)) >> 32);
+        int di = ic - icOld;
+        int dj = jc - jcOld;
+        int dL = L - LOld;
+        int dU = U - UOld;
+        int dV = V - VOld;
+
+        // calculate mean shift vector
+        ms_shift = (di * di + dj * dj) * one + dL * dL + dU * dU + dV * dV;
+
+        if(reuse && MS_ReuseStep(ctx, reuse, i, j, ic, jc - ctx.row_offset, L * scale, U * scale, V * scale, luv))
+        {
+            MS_ReuseFinish(reuse, i, j, luv);
+            worker.iterations += iters + 1;
+            if(ctx.diagnostics)
+                MS_Diagnose(ctx, i, j, iters + 1, (double)ms_shift / one, num, false);
+            return;
+        }
+    }
+
+    luv[0] = (uchar)(L >> MS_INT_SHIFT);
+    luv[1] = (uchar)(U >> MS_INT_SHIFT);
+    luv[2] = (uchar)(V >> MS_INT_SHIFT);
+
+    worker.iterations += iters;
+    if(ms_shift > one)
+        worker.capped++;
+    if(ctx.diagnostics)
+        MS_Diagnose(ctx, i, j, iters, (double)ms_shift / one, num, ms_shift > one);
+
+    if(reuse)
+        MS_ReuseFinish(reuse, i, j, luv);
+}
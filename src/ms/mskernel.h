@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MSKERNEL_H
+#define MSKERNEL_H
+
+
+#include "../image/image.h"
+#include <stdint.h>
+#include <vector>
+
+
+/*Structure MSWindowSums holds the sums over the neighbours inside the color radius */
+struct MSWindowSums
+{
+    float mi;
+    float mj;       // rows relative to the row of the pixel, the same in a band and in the whole image
+    float mL;
+    float mU;
+    float mV;
+    int num;
+    float weight;   // sum of the weights, set by the weighted kernels only
+};
+
+/*Structure MSSource describes the L*u*v image the filter reads the neighbours from */
+struct MSSource
+{
+    const uchar *plane[3];  // planar layout: pixel (0, 0) of the L, u and v planes
+    const uchar *packed;    // packed layout: pixel (0, 0) of the L u v X pixels, NULL for planar layout
+    int stride;             // distance between rows in bytes
+    int border;             // number of readable pixels around the image
+};
+
+/*! \brief Function MS_ShiftRows returns the source with row 0 moved to the given row
+*
+*  \param src source
+*  \param rows row which becomes row 0
+*  \return shifted source, it is read with rows relative to that row
+*/
+static inline MSSource MS_ShiftRows(const MSSource &src, int rows)
+{
+    MSSource shifted = src;
+
+    if(src.packed)
+        shifted.packed += (ptrdiff_t)rows * src.stride;
+    else
+        for(int c = 0; c < 3; c++)
+            shifted.plane[c] += (ptrdiff_t)rows * src.stride;
+    return shifted;
+}
+
+/*Type MSAccumulateFunc accumulates the window [ifrom, ito) x [jfrom, jto) around the color (L, U, V) */
+typedef void (*MSAccumulateFunc)(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                                 float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+
+void MS_AccumulateScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                         float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+void MS_AccumulateAVX2(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                       float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+void MS_AccumulateAVX512(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                         float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+
+// Packed layout: neighbours with X == 0 lie in the border and are skipped
+void MS_AccumulatePackedScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                               float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+void MS_AccumulatePackedAVX2(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                             float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+void MS_AccumulatePackedAVX512(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                               float L, float U, float V, double color_radius_squared, MSWindowSums *sums);
+
+#define MS_RADIUS_TOLERANCE (1.0 / (1 << 18))  // relative distance to the color radius of the lanes the vectorized versions decide in double precision
+
+/*! \brief Function MS_ExactLanes decides the lanes close to the color radius as MS_AccumulateScalar does.
+*  A single precision squared distance differs from the double precision one by less than
+*  4 * 2^-24 of it, so only lanes within MS_RADIUS_TOLERANCE of the radius can be classified differently.
+*
+*  \param mask lanes whose single precision distance is inside the color radius
+*  \param near lanes whose single precision distance is close to the color radius
+*  \param dL, dU, dV single precision channel differences of the lanes
+*  \param color_radius_squared squared range radius
+*  \return mask with the lanes of near decided in double precision
+*/
+static inline unsigned MS_ExactLanes(unsigned mask, unsigned near, const float *dL, const float *dU, const float *dV,
+                                     double color_radius_squared)
+{
+    for(; near; near &= near - 1)
+    {
+        int l = __builtin_ctz(near);
+        double d = (double)dL[l] * dL[l] + (double)dU[l] * dU[l] + (double)dV[l] * dV[l];
+
+        if(d <= color_radius_squared)
+            mask |= 1u << l;
+        else
+            mask &= ~(1u << l);
+    }
+    return mask;
+}
+
+/*Structure MSIntSums holds the sums of the integer filter */
+struct MSIntSums
+{
+    int mi;
+    int mj;
+    int mL;
+    int mU;
+    int mV;
+    int num;
+};
+
+#define MS_INT_SHIFT 6          // fractional bits of the color center of the integer filter
+#define MS_INT_MAX_DISTANCE (3 * (255 << MS_INT_SHIFT) * (255 << MS_INT_SHIFT))
+
+/*Type MSAccumulateIntFunc accumulates the window [ifrom, ito) x [jfrom, jto) around the color (L, U, V)
+  given with MS_INT_SHIFT fractional bits; the squared distance is compared with color_radius_int */
+typedef void (*MSAccumulateIntFunc)(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                                    int L, int U, int V, int color_radius_int, MSIntSums *sums);
+
+void MS_AccumulateIntScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                            int L, int U, int V, int color_radius_int, MSIntSums *sums);
+void MS_AccumulatePackedIntScalar(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                                  int L, int U, int V, int color_radius_int, MSIntSums *sums);
+void MS_AccumulateIntAVX2(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                          int L, int U, int V, int color_radius_int, MSIntSums *sums);
+void MS_AccumulateIntAVX512(const MSSource &src, int ifrom, int ito, int jfrom, int jto,
+                            int L, int U, int V, int color_radius_int, MSIntSums *sums);
+
+struct MSFilterContext;
+struct MSDiagnostics;
+
+/*Type MSWindowFunc sums the window of the pixel (i, j) around the color (L, U, V) */
+typedef void (*MSWindowFunc)(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums);
+
+/*Enumeration MSModeState is the state of a pixel in the mode table of the trajectory reuse */
+enum MSModeState
+{
+    MS_MODE_FREE,       // not visited yet
+    MS_MODE_ASSIGNED,   // the mode of the pixel is known
+    MS_MODE_PATH        // close to the trajectory which is iterated
+};
+
+/*Structure MSReuse holds the mode table of the trajectory reuse for the pixels of a region,
+  regions filtered at the same time must not overlap */
+struct MSReuse
+{
+    uchar *table;               // state of every pixel of the image
+    uchar *mode;                // L, u and v value of the assigned mode of every pixel
+    int width;                  // width of the image
+    int x0, y0, x1, y1;         // region [x0, x1) x [y0, y1) whose pixels may be assigned
+    int reach;                  // pixels around the spatial center of an iteration which are examined
+    std::vector<int> path;      // pixels close to the trajectory which is iterated
+    int reused;                 // pixels of the region resolved by reuse
+};
+
+bool MS_ReuseLookup(MSReuse *reuse, int i, int j, uchar *luv);
+bool MS_ReuseStep(const MSFilterContext &ctx, MSReuse *reuse, int i, int j, int ic, int jc,
+                  float L, float U, float V, uchar *luv);
+void MS_ReuseFinish(MSReuse *reuse, int i, int j, const uchar *luv);
+
+#define MS_HIST_SHIFT 3         // a histogram bin spans 2^MS_HIST_SHIFT values of a channel
+#define MS_HIST_LEVELS (256 >> MS_HIST_SHIFT)
+
+/*Structure MSHistogram is the quantized L*u*v histogram of the window of a pixel, every bin holds the
+  sums of its pixels. It slides along a row of the image, adding and removing one column of the window. */
+struct MSHistogram
+{
+    std::vector<MSIntSums> bins;    // MS_HIST_LEVELS^3 bins, index ((L * MS_HIST_LEVELS) + u) * MS_HIST_LEVELS + v
+    int i, j;                       // pixel whose window the histogram holds
+};
+
+void MS_HistogramStart(const MSFilterContext &ctx, MSHistogram *hist, int i, int j);
+void MS_HistogramNext(const MSFilterContext &ctx, MSHistogram *hist);
+void MS_HistogramClear(const MSFilterContext &ctx, MSHistogram *hist);
+void MS_HistogramQuery(const MSFilterContext &ctx, const MSHistogram *hist, float L, float U, float V, MSIntSums *sums);
+
+/*Structure MSWorker holds the state of the thread which filters a region */
+struct MSWorker
+{
+    MSReuse *reuse;             // mode table, NULL when the trajectories are not reused
+    MSHistogram *histogram;     // histogram of the window of the pixel, NULL when it is not used
+    long iterations;            // iterations of the pixels filtered by the worker
+    int capped;                 // pixels which stopped without converging
+};
+
+/*Type MSPixelFunc runs the Meanshift iterations of the pixel (i, j) and returns its L, u and v value */
+typedef void (*MSPixelFunc)(const MSFilterContext &ctx, MSWorker &worker, int i, int j, uchar *luv);
+
+/*Type MSWindowBatchFunc sums the windows of the n pixels (i[k], j[k]) around the colors (L[k], U[k], V[k]) */
+typedef void (*MSWindowBatchFunc)(const MSFilterContext &ctx, int n, const int *i, const int *j,
+                                  const float *L, const float *U, const float *V, MSWindowSums *sums);
+
+#define MS_RANGE_TABLE_SIZE 1024    // steps of the range weights between distance 0 and the color radius
+
+/*Structure MSKernelTables holds the weights of a weighted kernel */
+struct MSKernelTables
+{
+    const float *spatial;   // (2 * spatial_radius + 1)^2 weights, indexed by (dy + spatial_radius) * (2 * spatial_radius + 1) + dx + spatial_radius
+    const float *range;     // MS_RANGE_TABLE_SIZE + 1 weights, indexed by squared color distance * range_scale
+    double range_scale;     // MS_RANGE_TABLE_SIZE / color_radius^2
+};
+
+/*Structure MSFilterContext holds the settings the filter needs for every pixel */
+struct MSFilterContext
+{
+    MSSource src;
+    int width, height;
+    int spatial_radius;
+    double color_radius_squared;
+    int num_iters;
+    MSAccumulateFunc accumulate;    // sums a rectangle of the image
+    MSWindowFunc window;            // sums the window of a pixel
+    const int *halfwidth;           // disc window: half widths of the rows -spatial_radius .. spatial_radius
+    MSPixelFunc pixel;              // iterations of a pixel, floating point or integer
+    int histogram_iters;            // iterations computed from the histogram of the worker, if it has one
+    const MSKernelTables *kernel;   // weights of a weighted kernel, NULL for the flat kernel
+    const AlignedImage *start;      // initial color centers, planar, NULL to start at the color of the pixel
+    bool morton;                    // visit the pixels of a region in Z-order
+    MSWindowBatchFunc window_batch; // lockstep filter: sums the windows of the live pixels, NULL for the pixel by pixel filter
+    MSDiagnostics *diagnostics;     // convergence maps filled per pixel, NULL if not requested
+    int row_offset;                 // row of the whole image at row 0, spatial centers are in the rows of the whole image
+
+    // integer filter
+    MSAccumulateIntFunc accumulate_int;
+    int color_radius_int;           // squared range radius with 2 * MS_INT_SHIFT fractional bits
+    const uint64_t *reciprocal;     // reciprocal[num] = ceil(2^32 / num)
+};
+
+void MS_WindowSquare(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums);
+void MS_WindowDisc(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums);
+void MS_DiscHalfWidths(int spatial_radius, int *halfwidth);
+MSWindowFunc MS_SelectDiscWindow(int spatial_radius, bool packed, bool scalar);
+
+MSWindowFunc MS_SelectKernel(int spatial, int range, int spatial_radius, double color_radius, bool packed,
+                             MSKernelTables *tables, std::vector<float> &spatial_table, std::vector<float> &range_table);
+
+void MS_PyramidDownsample(const AlignedImage &fine, AlignedImage *coarse);
+void MS_PyramidStart(const AlignedImage &luv, const AlignedImage &coarse, double color_radius, AlignedImage *start);
+
+void MS_WindowBatch(const MSFilterContext &ctx, int n, const int *i, const int *j,
+                    const float *L, const float *U, const float *V, MSWindowSums *sums);
+void MS_WindowBatchPackedAVX512(const MSFilterContext &ctx, int n, const int *i, const int *j,
+                                const float *L, const float *U, const float *V, MSWindowSums *sums);
+void MS_FilterRegionLockstep(const MSFilterContext &ctx, MSWorker &worker, int x0, int y0, int x1, int y1, AlignedImage *dst);
+
+void MS_Diagnose(const MSFilterContext &ctx, int i, int j, int iters, double ms_shift, int num, bool capped);
+
+void MS_FilterPixelInt(const MSFilterContext &ctx, MSWorker &worker, int i, int j, uchar *luv);
+int MS_IntColorRadius(double color_radius);
+void MS_IntReciprocals(int max_num, uint64_t *reciprocal);
+
+
+#endif /* MSKERNEL_H */
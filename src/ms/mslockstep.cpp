@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+
+
+/**
+ * @file mslockstep.cpp
+ * @brief Lockstep filter of the Meanshift filter
+ *
+ * Instead of iterating one pixel until it converges, all pixels of a region iterate together.
+ * The live trajectories are kept as a structure of arrays; a pass sums the windows of all of them
+ * with ctx.window_batch, moves their color centers, and compacts the converged pixels out of the
+ * arrays. Every pass so works on unconverged pixels only, and a vectorized window_batch processes
+ * one pixel per lane. The iterations of every pixel are those of MS_FilterPixel, so the result
+ * is the one of the double-buffered filter.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*Structure MSActiveSet holds the live trajectories of a region as a structure of arrays */
+struct MSActiveSet
+{
+    std::vector<int> i, j;              // pixel
+    std::vector<int> ic, jc;            // spatial center
+    std::vector<float> L, U, V;         // color center
+    std::vector<MSWindowSums> sums;     // window sums of the pass
+    int size;                           // number of live trajectories
+
+    MSActiveSet(int n) : i(n), j(n), ic(n), jc(n), L(n), U(n), V(n), sums(n), size(0) {}
+};
+
+
+/*! \brief Function MS_WindowBatch sums the windows of n pixels one by one with ctx.window
+*
+*  \param ctx filter settings
+*  \param n number of pixels
+*  \param i, j coordinates of the pixels
+*  \param L, U, V colors of the window centers
+*  \param sums accumulated sums of every pixel
+*/
+void MS_WindowBatch(const MSFilterContext &ctx, int n, const int *i, const int *j,
+                    const float *L, const float *U, const float *V, MSWindowSums *sums)
+{
+    for(int k = 0; k < n; k++)
+        ctx.window(ctx, i[k], j[k], L[k], U[k], V[k], &sums[k]);
+}
+
+/*! \brief Function MS_FilterRegionLockstep filters the pixels of a region with lockstep passes over the live pixels
+*
+*  \param ctx filter settings, ctx.window_batch must be set
+*  \param worker statistics of the thread
+*  \param x0, y0, x1, y1 region [x0, x1) x [y0, y1)
+*  \param dst output image, must not be the image the neighbours are read from
+*/
+void MS_FilterRegionLockstep(const MSFilterContext &ctx, MSWorker &worker, int x0, int y0, int x1, int y1, AlignedImage *dst)
+{
+    const MSSource &src = ctx.src;
+    MSActiveSet set((x1 - x0) * (y1 - y0));
+
+    for(int j = y0; j < y1; j++)
+        for(int i = x0; i < x1; i++)
+        {
+            int k = set.size++;
+            set.i[k] = set.ic[k] = i;
+            set.j[k] = j;
+            set.jc[k] = j + ctx.row_offset;
+
+            if(ctx.start)
+            {
+                set.L[k] = ctx.start->Get(i, j, 1);
+                set.U[k] = ctx.start->Get(i, j, 2);
+                set.V[k] = ctx.start->Get(i, j, 3);
+            }
+            else if(src.packed)
+            {
+                const uchar *p = src.packed + j * src.stride + i * IMAGE_PACKED_BYTES;
+                set.L[k] = p[0];
+                set.U[k] = p[1];
+                set.V[k] = p[2];
+            }
+            else
+            {
+                set.L[k] = src.plane[0][j * src.stride + i];
+                set.U[k] = src.plane[1][j * src.stride + i];
+                set.V[k] = src.plane[2][j * src.stride + i];
+            }
+
+            // no iteration, the pixel keeps its initial color
+            if(ctx.num_iters <= 0)
+            {
+                dst->Set(i, j, 1, (uchar)set.L[k]);
+                dst->Set(i, j, 2, (uchar)set.U[k]);
+                dst->Set(i, j, 3, (uchar)set.V[k]);
+                if(ctx.diagnostics)
+                    MS_Diagnose(ctx, i, j, 0, 5, 0, true);
+                set.size--;
+            }
+        }
+
+    for(int pass = 0; set.size > 0; pass++)
+    {
+        ctx.window_batch(ctx, set.size, &set.i[0], &set.j[0], &set.L[0], &set.U[0], &set.V[0], &set.sums[0]);
+
+        int live = 0;
+        for(int k = 0; k < set.size; k++)
+        {
+            const MSWindowSums &sums = set.sums[k];
+
+            // the arithmetic of MS_FilterPixel
+            const float count = ctx.kernel ? sums.weight : sums.num;
+            float num_ = 1.f / count;
+            float L = sums.mL * num_;
+            float U = sums.mU * num_;
+            float V = sums.mV * num_;
+            int ic = (int) (sums.mi * num_ + 0.5);
+            int jc = (int) ((sums.mj + count * (set.j[k] + ctx.row_offset)) * num_ + 0.5);
+            int di = ic - set.ic[k];
+            int dj = jc - set.jc[k];
+            double dL = L - set.L[k];
+            double dU = U - set.U[k];
+            double dV = V - set.V[k];
+            double ms_shift = di * di + dj * dj + dL * dL + dU * dU + dV * dV;
+
+            if(ms_shift <= 1 || pass + 1 >= ctx.num_iters)
+            {
+                dst->Set(set.i[k], set.j[k], 1, (uchar)L);
+                dst->Set(set.i[k], set.j[k], 2, (uchar)U);
+                dst->Set(set.i[k], set.j[k], 3, (uchar)V);
+                worker.iterations += pass + 1;
+                if(ms_shift > 1)
+                    worker.capped++;
+                if(ctx.diagnostics)
+                    MS_Diagnose(ctx, set.i[k], set.j[k], pass + 1, ms_shift, sums.num, ms_shift > 1);
+                continue;
+            }
+
+            // compaction, the order of the live pixels is kept
+            set.i[live] = set.i[k];
+            set.j[live] = set.j[k];
+            set.ic[live] = ic;
+            set.jc[live] = jc;
+            set.L[live] = L;
+            set.U[live] = U;
+            set.V[live] = V;
+            live++;
+        }
+        set.size = live;
+    }
+}
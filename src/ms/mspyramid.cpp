@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+
+
+/**
+ * @file mspyramid.cpp
+ * @brief Coarse-to-fine pyramid of the Meanshift filter
+ *
+ * A coarser level is the image downsampled by 2, every pixel the mean of 2 x 2 pixels. After the
+ * coarser level is filtered, every pixel of the finer level starts its iterations at one of the
+ * modes of the 4 nearest coarse pixels: the mode closest to the color of the pixel. A pixel whose
+ * color is farther than the color radius from all 4 modes, a detail lost by the downsampling,
+ * starts at its own color as without pyramid. The window of a pixel is fixed at the pixel, so
+ * only the color center is initialized.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Function MS_PyramidDownsample downsamples an image by 2, a coarse pixel is the rounded mean of
+*  the fine pixels it covers
+*
+*  \param fine image in L*u*v colorspace
+*  \param coarse downsampled image of size ((width + 1) / 2, (height + 1) / 2), any layout
+*/
+void MS_PyramidDownsample(const AlignedImage &fine, AlignedImage *coarse)
+{
+    for(int y = 0; y < coarse->Height(); y++)
+    {
+        int y0 = 2 * y, y1 = 2 * y + 1 < fine.Height() ? 2 * y + 1 : 2 * y;
+
+        for(int x = 0; x < coarse->Width(); x++)
+        {
+            int x0 = 2 * x, x1 = 2 * x + 1 < fine.Width() ? 2 * x + 1 : 2 * x;
+
+            for(int c = 1; c <= 3; c++)
+            {
+                int sum = fine.Get(x0, y0, c) + fine.Get(x1, y0, c) + fine.Get(x0, y1, c) + fine.Get(x1, y1, c);
+                coarse->Set(x, y, c, (uchar)((sum + 2) / 4));
+            }
+        }
+    }
+}
+
+/*! \brief Function MS_PyramidStart computes the initial color centers of a level from the modes of the coarser level
+*
+*  \param luv image of the level in L*u*v colorspace
+*  \param coarse filtered coarser level
+*  \param color_radius range radius
+*  \param start initial color centers, of the size of luv
+*/
+void MS_PyramidStart(const AlignedImage &luv, const AlignedImage &coarse, double color_radius, AlignedImage *start)
+{
+    const double color_radius_squared = color_radius * color_radius;
+
+    for(int y = 0; y < luv.Height(); y++)
+    {
+        // the 2 coarse rows nearest to the fine row
+        int cy0 = (y - 1) / 2 > 0 ? (y - 1) / 2 : 0;
+        int cy1 = (y + 1) / 2 < coarse.Height() ? (y + 1) / 2 : coarse.Height() - 1;
+
+        for(int x = 0; x < luv.Width(); x++)
+        {
+            int cx0 = (x - 1) / 2 > 0 ? (x - 1) / 2 : 0;
+            int cx1 = (x + 1) / 2 < coarse.Width() ? (x + 1) / 2 : coarse.Width() - 1;
+            const int L = luv.Get(x, y, 1);
+            const int U = luv.Get(x, y, 2);
+            const int V = luv.Get(x, y, 3);
+            int bestL = L, bestU = U, bestV = V;
+            double best = color_radius_squared;
+
+            for(int cy = cy0; cy <= cy1; cy++)
+                for(int cx = cx0; cx <= cx1; cx++)
+                {
+                    int mL = coarse.Get(cx, cy, 1);
+                    int mU = coarse.Get(cx, cy, 2);
+                    int mV = coarse.Get(cx, cy, 3);
+                    double d2 = (double)(mL - L) * (mL - L) + (mU - U) * (mU - U) + (mV - V) * (mV - V);
+
+                    if(d2 <= best)
+                    {
+                        best = d2;
+                        bestL = mL;
+                        bestU = mU;
+                        bestV = mV;
+                    }
+                }
+
+            start->Set(x, y, 1, (uchar)bestL);
+            start->Set(x, y, 2, (uchar)bestU);
+            start->Set(x, y, 3, (uchar)bestV);
+        }
+    }
+}
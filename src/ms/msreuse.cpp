@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+#include <string.h>
+
+
+/**
+ * @file msreuse.cpp
+ * @brief Trajectory reuse of the Meanshift filter
+ *
+ * As in the speed-up levels of EDISON, the pixels which the trajectory of a pixel passes close to,
+ * in space and in color, are assigned the mode the trajectory converges to and are not iterated
+ * themselves. A trajectory which comes close to a pixel with an assigned mode stops and takes
+ * that mode. With the medium level the pixel at the spatial center of every iteration is
+ * examined, with the high level the 3 x 3 pixels around it.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+#define MS_REUSE_THRESHOLD 0.5  // squared color distance of a pixel close to a trajectory, relative to the squared color radius
+
+
+/*! \brief Function MS_ReuseLookup copies the assigned mode of the pixel (i, j)
+*
+*  \param reuse mode table
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param luv L, u and v value of the mode
+*  \return true if the pixel has a mode
+*/
+bool MS_ReuseLookup(MSReuse *reuse, int i, int j, uchar *luv)
+{
+    int p = j * reuse->width + i;
+
+    if(reuse->table[p] != MS_MODE_ASSIGNED)
+        return false;
+
+    memcpy(luv, reuse->mode + 3 * p, 3);
+    reuse->reused++;
+    return true;
+}
+
+/*! \brief Function MS_ReuseStep examines the pixels at the spatial center (ic, jc) of an iteration.
+*  Free pixels whose color is close to the color center are put on the trajectory.
+*
+*  \param ctx filter settings
+*  \param reuse mode table
+*  \param i x coordinate of the pixel which is iterated
+*  \param j y coordinate of the pixel which is iterated
+*  \param ic, jc spatial center of the iteration
+*  \param L, U, V color center of the iteration
+*  \param luv L, u and v value of the mode if the trajectory reached an assigned pixel
+*  \return true if the trajectory reached an assigned pixel
+*/
+bool MS_ReuseStep(const MSFilterContext &ctx, MSReuse *reuse, int i, int j, int ic, int jc,
+                  float L, float U, float V, uchar *luv)
+{
+    const int r = reuse->reach;
+    const double threshold = MS_REUSE_THRESHOLD * ctx.color_radius_squared;
+
+    for(int y = jc - r; y <= jc + r; y++)
+        for(int x = ic - r; x <= ic + r; x++)
+        {
+            if(x < reuse->x0 || x >= reuse->x1 || y < reuse->y0 || y >= reuse->y1 || (x == i && y == j))
+                continue;
+
+            int p = y * reuse->width + x;
+            if(reuse->table[p] == MS_MODE_PATH)
+                continue;
+
+            double dL, dU, dV;
+            if(ctx.src.packed)
+            {
+                const uchar *q = ctx.src.packed + y * ctx.src.stride + x * IMAGE_PACKED_BYTES;
+                dL = q[0] - L;
+                dU = q[1] - U;
+                dV = q[2] - V;
+            }
+            else
+            {
+                dL = ctx.src.plane[0][y * ctx.src.stride + x] - L;
+                dU = ctx.src.plane[1][y * ctx.src.stride + x] - U;
+                dV = ctx.src.plane[2][y * ctx.src.stride + x] - V;
+            }
+            if(dL * dL + dU * dU + dV * dV >= threshold)
+                continue;
+
+            if(reuse->table[p] == MS_MODE_ASSIGNED)
+            {
+                memcpy(luv, reuse->mode + 3 * p, 3);
+                return true;
+            }
+
+            reuse->table[p] = MS_MODE_PATH;
+            reuse->path.push_back(p);
+        }
+
+    return false;
+}
+
+/*! \brief Function MS_ReuseFinish assigns the mode of the pixel (i, j) to the pixel and to its trajectory
+*
+*  \param reuse mode table
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param luv L, u and v value of the mode
+*/
+void MS_ReuseFinish(MSReuse *reuse, int i, int j, const uchar *luv)
+{
+    reuse->path.push_back(j * reuse->width + i);
+
+    for(size_t k = 0; k < reuse->path.size(); k++)
+    {
+        int p = reuse->path[k];
+        reuse->table[p] = MS_MODE_ASSIGNED;
+        memcpy(reuse->mode + 3 * p, luv, 3);
+    }
+    reuse->path.clear();
+}
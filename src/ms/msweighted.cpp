@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mskernel.h"
+#include <cmath>
+
+
+/**
+ * @file msweighted.cpp
+ * @brief Weighted kernels of the Meanshift filter
+ *
+ * A neighbour at the offset (dx, dy) with the squared color distance d2 <= color_radius^2 has
+ * the weight ks(t) * kr(s), with t = (dx^2 + dy^2) / spatial_radius^2 and s = d2 / color_radius^2.
+ * The profiles ks and kr are policies: flat (1), Epanechnikov (1 - t) or truncated Gaussian
+ * (exp(-2 t), a standard deviation of half the radius), all zero for t > 1. The weights are read
+ * from tables: the spatial weight by offset and the range weight by s quantized to
+ * MS_RANGE_TABLE_SIZE steps. A flat policy uses no table, and the flat spatial kernel keeps the
+ * shape of the window. Flat in space and range is not a weighted kernel, the filter uses
+ * the accumulation functions for it.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*Policy MSProfileFlat gives every neighbour inside the radius the same weight */
+struct MSProfileFlat
+{
+    enum { FLAT = 1 };
+    static float Profile(double t) { return t <= 1 ? 1.f : 0.f; }
+};
+
+/*Policy MSProfileEpanechnikov weights a neighbour with 1 - t */
+struct MSProfileEpanechnikov
+{
+    enum { FLAT = 0 };
+    static float Profile(double t) { return t <= 1 ? (float)(1 - t) : 0.f; }
+};
+
+/*Policy MSProfileGaussian weights a neighbour with exp(-2 t), truncated at the radius */
+struct MSProfileGaussian
+{
+    enum { FLAT = 0 };
+    static float Profile(double t) { return t <= 1 ? (float)exp(-2 * t) : 0.f; }
+};
+
+
+/*! \brief Function MS_AddWeighted adds a neighbour inside the color radius to the sums with its weight
+*
+*  \param L2, U2, V2 color of the neighbour
+*  \param ii, jj column of the neighbour and its row relative to the pixel
+*  \param L, U, V color of the window center
+*  \param spatial_weight spatial weight of the neighbour
+*  \param ctx filter settings
+*  \param s accumulated sums
+*/
+template<class RANGE>
+static inline void MS_AddWeighted(float L2, float U2, float V2, int ii, int jj, float L, float U, float V,
+                                  float spatial_weight, const MSFilterContext &ctx, MSWindowSums &s)
+{
+    double dL = L2 - L;
+    double dU = U2 - U;
+    double dV = V2 - V;
+    double d2 = dL * dL + dU * dU + dV * dV;
+
+    if (d2 <= ctx.color_radius_squared)
+    {
+        float w = spatial_weight;
+        if(!RANGE::FLAT)
+            w *= ctx.kernel->range[(int)(d2 * ctx.kernel->range_scale)];
+
+        s.mi += w * ii;
+        s.mj += w * jj;
+        s.mL += w * L2;
+        s.mU += w * U2;
+        s.mV += w * V2;
+        s.weight += w;
+        s.num++;
+    }
+}
+
+/*! \brief Function MS_WindowWeighted sums the window of the pixel (i, j) with the weights of the kernels SPATIAL and RANGE.
+*  The window is the square, or the disc when ctx.halfwidth is set, clamped as in MS_WindowDisc.
+*
+*  \param ctx filter settings, ctx.kernel must be set
+*  \param i x coordinate of the pixel
+*  \param j y coordinate of the pixel
+*  \param L, U, V color of the window center
+*  \param sums accumulated sums
+*/
+template<class SPATIAL, class RANGE, bool PACKED>
+static void MS_WindowWeighted(const MSFilterContext &ctx, int i, int j, float L, float U, float V, MSWindowSums *sums)
+{
+    const int R = ctx.spatial_radius;
+    const bool clamp = !PACKED || ctx.src.border < R;
+    MSWindowSums s;
+
+    s.mi = s.mj = s.mL = s.mU = s.mV = s.weight = 0;
+    s.num = 0;
+
+    for(int dy = -R; dy <= R; dy++)
+    {
+        int jj = j + dy;
+        int w = ctx.halfwidth ? ctx.halfwidth[dy + R] : R;
+        int ifrom = i - w, ito = i + w + 1;
+
+        if(clamp)
+        {
+            if(jj < 0 || jj >= ctx.height)
+                continue;
+            ifrom = ifrom < 0 ? 0 : ifrom;
+            ito = ito > ctx.width ? ctx.width : ito;
+        }
+
+        // spatial weights of the row, indexed by dx
+        const float *spatial = ctx.kernel->spatial + (dy + R) * (2 * R + 1) + R;
+
+        if(PACKED)
+        {
+            const uchar *p = ctx.src.packed + jj * ctx.src.stride + ifrom * IMAGE_PACKED_BYTES;
+            for(int ii = ifrom; ii < ito; ii++, p += IMAGE_PACKED_BYTES)
+                if(p[3])
+                    MS_AddWeighted<RANGE>(p[0], p[1], p[2], ii, dy, L, U, V, SPATIAL::FLAT ? 1.f : spatial[ii - i], ctx, s);
+        }
+        else
+        {
+            const uchar *rowL = ctx.src.plane[0] + jj * ctx.src.stride;
+            const uchar *rowU = ctx.src.plane[1] + jj * ctx.src.stride;
+            const uchar *rowV = ctx.src.plane[2] + jj * ctx.src.stride;
+            for(int ii = ifrom; ii < ito; ii++)
+                MS_AddWeighted<RANGE>(rowL[ii], rowU[ii], rowV[ii], ii, dy, L, U, V, SPATIAL::FLAT ? 1.f : spatial[ii - i], ctx, s);
+        }
+    }
+
+    *sums = s;
+}
+
+
+/*Structure MSKernelEntry describes the instantiations of a pair of kernels */
+struct MSKernelEntry
+{
+    MSWindowFunc window[2];         // planar and packed layout
+    float (*spatial)(double);
+    float (*range)(double);
+};
+
+#define MS_KERNEL_ENTRY(S, R) \
+    { { MS_WindowWeighted<S, R, false>, MS_WindowWeighted<S, R, true> }, S::Profile, R::Profile }
+
+// Weighted kernels, indexed by spatial and range kernel
+static const MSKernelEntry ms_kernels[3][3] =
+{
+    { MS_KERNEL_ENTRY(MSProfileFlat, MSProfileFlat),
+      MS_KERNEL_ENTRY(MSProfileFlat, MSProfileEpanechnikov),
+      MS_KERNEL_ENTRY(MSProfileFlat, MSProfileGaussian) },
+    { MS_KERNEL_ENTRY(MSProfileEpanechnikov, MSProfileFlat),
+      MS_KERNEL_ENTRY(MSProfileEpanechnikov, MSProfileEpanechnikov),
+      MS_KERNEL_ENTRY(MSProfileEpanechnikov, MSProfileGaussian) },
+    { MS_KERNEL_ENTRY(MSProfileGaussian, MSProfileFlat),
+      MS_KERNEL_ENTRY(MSProfileGaussian, MSProfileEpanechnikov),
+      MS_KERNEL_ENTRY(MSProfileGaussian, MSProfileGaussian) }
+};
+
+/*! \brief Function MS_SelectKernel fills the weight tables of a pair of kernels and returns its window function
+*
+*  \param spatial spatial kernel, 0 flat, 1 Epanechnikov, 2 Gaussian
+*  \param range range kernel, 0 flat, 1 Epanechnikov, 2 Gaussian
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param packed true for the packed L u v X layout
+*  \param tables weight tables
+*  \param spatial_table storage of the spatial weights
+*  \param range_table storage of the range weights
+*  \return window function
+*/
+MSWindowFunc MS_SelectKernel(int spatial, int range, int spatial_radius, double color_radius, bool packed,
+                             MSKernelTables *tables, std::vector<float> &spatial_table, std::vector<float> &range_table)
+{
+    const MSKernelEntry &entry = ms_kernels[spatial][range];
+    const int R = spatial_radius;
+
+    spatial_table.resize((2 * R + 1) * (2 * R + 1));
+    for(int dy = -R; dy <= R; dy++)
+        for(int dx = -R; dx <= R; dx++)
+            spatial_table[(dy + R) * (2 * R + 1) + dx + R] = R > 0 ? entry.spatial((double)(dx * dx + dy * dy) / (R * R)) : 1.f;
+
+    // d2 == color_radius^2 gives the last entry
+    range_table.resize(MS_RANGE_TABLE_SIZE + 1);
+    for(int k = 0; k <= MS_RANGE_TABLE_SIZE; k++)
+        range_table[k] = entry.range((double)k / MS_RANGE_TABLE_SIZE);
+
+    tables->spatial = &spatial_table[0];
+    tables->range = &range_table[0];
+    tables->range_scale = color_radius > 0 ? MS_RANGE_TABLE_SIZE / (color_radius * color_radius) : 0;
+    return entry.window[packed ? 1 : 0];
+}
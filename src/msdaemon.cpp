@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <cstdlib>
+#include <signal.h>
+#include <unistd.h>
+#include "ms/ms.h"
+#include "ms/msdaemon.h"
+
+using namespace std;
+
+
+
+/**
+ * @file msdaemon.cpp
+ * @brief Main program of the Meanshift segmentation daemon
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+static const char *socket_path = NULL; // removed when the daemon is stopped
+
+/*! \brief Function Stop removes the socket and ends the daemon on SIGINT and SIGTERM
+*
+*  \param signal_number signal
+*/
+static void Stop(int)
+{
+    if (socket_path)
+        unlink(socket_path);
+    _exit(0);
+}
+
+/*! \brief Function Usage tells the user how to run the program
+*
+*  \param name name of the executable
+*/
+static void Usage(const char *name)
+{
+    std::cerr << "Meanshift segmentation daemon" << std::endl;
+    std::cerr << "Usage: " << name << " [-w workers] [-q queue] [-t threads] [-s simd] [-p] [-c] [-i] [-u speedup] [-g histogram] [-k kernel] [-l levels] [-a] [-o order] socket" << std::endl;
+    std::cerr << "  -w workers  jobs segmented at once, 1 by default" << std::endl;
+    std::cerr << "  -q queue    jobs admitted but not yet started, more are answered BUSY; " << MS_DAEMON_QUEUE << " by default" << std::endl;
+    std::cerr << "  -t threads  every worker filters with the double-buffered parallel filter on a pool of the given number of threads" << std::endl;
+    std::cerr << "  -s simd     instruction set of the kernels: auto (default), scalar, avx2 or avx512, same result" << std::endl;
+    std::cerr << "  -p          filter a packed copy of the image with one 4 byte access per neighbour" << std::endl;
+    std::cerr << "  -c          use a circular window of radius spatial_radius instead of the square window" << std::endl;
+    std::cerr << "  -i          filter with fixed-point integer arithmetic" << std::endl;
+    std::cerr << "  -u speedup  reuse the trajectories of other pixels: none (default), medium or high" << std::endl;
+    std::cerr << "  -g histogram  iterations computed from a sliding histogram of the window: none (default), first or all" << std::endl;
+    std::cerr << "  -k kernel   kernels of the filter, spatial:range or one for both: flat (default), epanechnikov or gaussian" << std::endl;
+    std::cerr << "  -l levels   start from the modes of a pyramid with the given number of coarser levels, at most 4" << std::endl;
+    std::cerr << "  -a          iterate the pixels of a tile in lockstep and remove the converged ones after every iteration" << std::endl;
+    std::cerr << "  -o order    order of the pixels: rows (default), tiles or morton, tiles are sized for the L2 cache" << std::endl;
+    std::cerr << "Requests, one line each: SEGMENT shm_name width height spatial_radius color_radius minRegion, or STATS" << std::endl;
+    std::cerr << "The shared memory holds the planar RGB image, the filtered image is written after it and the 32 bit" << std::endl;
+    std::cerr << "labels at the next multiple of 64 bytes" << std::endl;
+    std::cerr << "Example: " << name << " -w 2 /tmp/meanshift.sock" << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    // initial value
+    int num_iters = 100; // Initial number of iterations for Meanshift
+    MSOptions options;   // Optional settings of the filter
+    int num_workers = 1; // Jobs segmented at once
+    int capacity = MS_DAEMON_QUEUE; // Jobs waiting for a worker
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:q:t:s:pciu:g:k:l:ao:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            num_workers = atoi(optarg); // Jobs segmented at once
+            break;
+        case 'q':
+            capacity = atoi(optarg); // Admission queue
+            break;
+        case 't':
+            options.num_threads = atoi(optarg); // Number of threads of the parallel filter
+            break;
+        case 's':
+            if (!MS_ParseSimd(optarg, &options.simd)) // Instruction set of the filter
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            options.packed = true; // Filter the packed L u v X layout
+            break;
+        case 'c':
+            options.disc = true; // Circular window
+            break;
+        case 'i':
+            options.integer = true; // Integer filter
+            break;
+        case 'u':
+            if (!MS_ParseSpeedUp(optarg, &options.speedup)) // Trajectory reuse
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'g':
+            if (!MS_ParseHistogram(optarg, &options.histogram)) // Sliding window histogram
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            if (!MS_ParseKernel(optarg, &options.spatial_kernel, &options.range_kernel)) // Weighted kernels
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            options.pyramid = atoi(optarg); // Levels of the pyramid
+            break;
+        case 'a':
+            options.lockstep = true; // Lockstep filter
+            break;
+        case 'o':
+            if (!MS_ParseTraversal(optarg, &options.traversal)) // Order of the pixels
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        // Tell the user how to run the program
+        Usage(argv[0]);
+        return 1;
+    }
+
+    if (options.simd != MS_SIMD_AUTO)
+        CPU_Select(MS_SimdIsa(options.simd)); // also for the color conversion and the relabeling
+
+    MSDaemon daemon(num_workers, num_iters, options, capacity);
+    if (!daemon.Listen(argv[optind]))
+    {
+        std::cerr << "Can not listen on " << argv[optind] << std::endl;
+        return 1;
+    }
+    socket_path = argv[optind];
+    signal(SIGINT, Stop);
+    signal(SIGTERM, Stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    daemon.Serve();
+    std::cerr << "Can not accept clients on " << argv[optind] << std::endl;
+    unlink(argv[optind]);
+    return 1;
+}
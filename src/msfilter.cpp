@@ -19,8 +19,11 @@ Mean shift algorithm represent a general non-parametric mode finding procedure.
 
 #include <stdio.h>
 #include <cstdlib>
+#include <unistd.h>
 #include "ms/ms.h"
 #include "io_png/io_png.h"
+#include "io_file/ImageFile.h"
+#include "perf/CacheCounter.h"
 
 using namespace std;
 
@@ -34,39 +37,271 @@ using namespace std;
  */
 
 
+/*! \brief Function Usage tells the user how to run the program
+*
+*  \param name name of the executable
+*/
+static void Usage(const char *name)
+{
+    std::cerr << "Meanshift filtering" << std::endl;
+    std::cerr << "Usage: " << name << " [-t threads] [-s simd] [-p] [-c] [-i] [-u speedup] [-g histogram] [-k kernel] [-l levels] [-a] [-o order] [-v] [-d prefix] [-b rows] [-z compression] [-f filter] input_image spatial_radius color_radius output_filename" << std::endl;
+    std::cerr << "  -t threads  filter with the double-buffered parallel filter on the given number of threads" << std::endl;
+    std::cerr << "  -s simd     instruction set of the kernels: auto (default), scalar, avx2 or avx512, same result" << std::endl;
+    std::cerr << "              without -s the environment variable MEANSHIFT_ISA selects it" << std::endl;
+    std::cerr << "  -p          filter a packed copy of the image with one 4 byte access per neighbour" << std::endl;
+    std::cerr << "  -c          use a circular window of radius spatial_radius instead of the square window" << std::endl;
+    std::cerr << "  -i          filter with fixed-point integer arithmetic" << std::endl;
+    std::cerr << "  -u speedup  reuse the trajectories of other pixels: none (default), medium or high" << std::endl;
+    std::cerr << "  -g histogram  iterations computed from a sliding histogram of the window: none (default), first or all" << std::endl;
+    std::cerr << "  -k kernel   kernels of the filter, spatial:range or one for both: flat (default), epanechnikov or gaussian" << std::endl;
+    std::cerr << "  -l levels   start from the modes of a pyramid with the given number of coarser levels, at most 4" << std::endl;
+    std::cerr << "  -a          iterate the pixels of a tile in lockstep and remove the converged ones after every iteration" << std::endl;
+    std::cerr << "  -o order    order of the pixels: rows (default), tiles or morton, tiles are sized for the L2 cache" << std::endl;
+    std::cerr << "  -v          print the iteration statistics and the cache misses of the filter" << std::endl;
+    std::cerr << "  -d prefix   write 16 bit maps of the iterations, mean shift, support and capped pixels and their" << std::endl;
+    std::cerr << "              histograms to prefix_iterations.pgm, ..., prefix_histogram.txt" << std::endl;
+    std::cerr << "  -b rows     filter out of core in bands of the given number of rows, 0 for the default of 256" << std::endl;
+    std::cerr << "  -z compression  compression of PNG outputs: default, fast, store or a zlib level 0 to 9; with -t" << std::endl;
+    std::cerr << "              threads they are deflated in strips on the threads" << std::endl;
+    std::cerr << "  -f filter   row filter of PNG outputs: none, sub, up, average, paeth or all (default)" << std::endl;
+    std::cerr << "Images are PNG, binary PPM or PAM, or raw planar .rgb or .luv; outputs take the format of their extension" << std::endl;
+    std::cerr << "Example: " << name << " input.png 7 6.5 output.png" << std::endl;
+    std::cerr << "Example on 8 threads: " << name << " -t 8 input.png 7 6.5 output.png" << std::endl;
+}
+
+
+/*! \brief Function FilterBands filters the rows of a source out of core into a file, see MS_FilterBands
+*
+*  \param source RGB rows of the input image
+*  \param filename output file, PNG, PPM, PAM or raw planar RGB by its extension
+*  \param spatial_radius spatial radius
+*  \param color_radius range radius
+*  \param num_iters maximal number of iterations
+*  \param options settings of the filter
+*  \param band_height rows of a band
+*  \param png compression of a PNG output
+*  \param counter measures the cache misses of the filter
+*  \return false if the file can not be written or the filter fails
+*/
+static bool FilterBands(MSRowSource &source, const char *filename, int spatial_radius, double color_radius, int num_iters,
+                        const MSOptions &options, int band_height, const io_png_options *png, CacheCounter &counter)
+{
+    bool ok;
+
+    counter.Start();
+    if (ImageFileFormatOf(filename) == IMAGE_FILE_PNG)
+    {
+        MSPngWriter sink(filename, source.Width(), source.Height(), png);
+        ok = sink.IsOpen() && MS_FilterBands(source, sink, spatial_radius, color_radius, num_iters, options, band_height);
+        ok = sink.Close() && ok;
+    }
+    else
+    {
+        MSMappedWriter sink(filename, source.Width(), source.Height());
+        ok = sink.IsOpen() && MS_FilterBands(source, sink, spatial_radius, color_radius, num_iters, options, band_height);
+        ok = sink.Close() && ok;
+    }
+    counter.Stop();
+    return ok;
+}
+
+
 int main(int argc, char* argv[])
 {
     // initial value
     int num_iters = 100; // Initial number of iterations for Meanshift
+    MSOptions options;   // Optional settings of the filter
+    MSFilterStats stats; // Statistics of the filter
+    bool verbose = false; // Print the iteration statistics
+    MSDiagnostics diagnostics; // Convergence maps of the pixels
+    const char *diagnostics_prefix = NULL;
+    io_png_options png;  // Compression of the PNG outputs
+    io_png_options_preset(&png, IO_PNG_PRESET_DEFAULT);
+    int band_height = -1; // Rows of a band of the out-of-core filter, -1 filters the whole image
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:pciu:g:k:l:ao:vd:b:z:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            options.num_threads = atoi(optarg); // Number of threads of the parallel filter
+            break;
+        case 's':
+            if (!MS_ParseSimd(optarg, &options.simd)) // Instruction set of the filter
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            options.packed = true; // Filter the packed L u v X layout
+            break;
+        case 'c':
+            options.disc = true; // Circular window
+            break;
+        case 'i':
+            options.integer = true; // Integer filter
+            break;
+        case 'u':
+            if (!MS_ParseSpeedUp(optarg, &options.speedup)) // Trajectory reuse
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'g':
+            if (!MS_ParseHistogram(optarg, &options.histogram)) // Sliding window histogram
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            if (!MS_ParseKernel(optarg, &options.spatial_kernel, &options.range_kernel)) // Weighted kernels
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'l':
+            options.pyramid = atoi(optarg); // Levels of the pyramid
+            break;
+        case 'a':
+            options.lockstep = true; // Lockstep filter
+            break;
+        case 'o':
+            if (!MS_ParseTraversal(optarg, &options.traversal)) // Order of the pixels
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'd':
+            diagnostics_prefix = optarg; // Convergence diagnostics
+            options.diagnostics = &diagnostics;
+            break;
+        case 'b':
+            band_height = atoi(optarg); // Out-of-core filter
+            break;
+        case 'z':
+            if (!ParsePngCompression(optarg, &png)) // Compression of the PNG outputs
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (!ParsePngFilter(optarg, &png)) // Row filter of the PNG outputs
+            {
+                Usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
 
-     if (argc < 5)
+     if (argc - optind < 4)
     {
         // Tell the user how to run the program
-        std::cerr << "Meanshift filtering" << std::endl;
-        std::cerr << "Usage: " << argv[0] << " input_image spatial_radius color_radius output_filename" << std::endl;
-        std::cerr << "Example: " << argv[0] << " input.png 7 6.5 output.png" << std::endl;
+        Usage(argv[0]);
        return 1;
     }
+
+    if (band_height >= 0 && (diagnostics_prefix || options.pyramid > 0))
+    {
+        // the pyramid and the diagnostics need the whole image
+        std::cerr << "The band filter can not be combined with -d or -l" << std::endl;
+        return 1;
+    }
+
+    char **args = argv + optind; // positional arguments
+    options.stats = &stats;
+    if (options.simd != MS_SIMD_AUTO)
+        CPU_Select(MS_SimdIsa(options.simd)); // also for the color conversion and the relabeling
   
-    size_t width, height;
-    // Read image to be segmented or filtered
-    uchar * image = io_png_read_u8_rgb(argv[1], &width, &height);
-    const int spatial_radius = atoi(argv[2]); // Spatial radius for Meanshift algorithm
-    const double color_radius = atof(argv[3]); // Range radius for Meanshift algorithm
-  //  const int minRegion = atoi(argv[4]); // Minimal region for merging
+    const int spatial_radius = atoi(args[1]); // Spatial radius for Meanshift algorithm
+    const double color_radius = atof(args[2]); // Range radius for Meanshift algorithm
  
-    const string filename_filter = argv[4];  // Filename for filtered image
+    const string filename_filter = args[3];  // Filename for filtered image
+    CacheCounter counter; // Cache misses of the filter
     // Filter phase in L*u*v color space
-    uchar *filtered = MS_Filter(image, width, height, spatial_radius, color_radius, num_iters);
-    // Convert image to RGB and save
-    uchar *rgb = ConvertLUV2RGB(filtered, width, height, 3);
-    io_png_write_u8(filename_filter.c_str(), rgb, width, height, 3);
-
-    delete [] filtered;
-    delete [] rgb;
-
-    free (image);
+    InputImage input;
+    const bool stream = band_height >= 0;
+    if (stream)
+    {
+        // the bands are read, filtered and written as they come, the image is never in memory: PNG
+        // is decoded and encoded row by row, the other files are mapped
+        if (ImageFileFormatOf(filename_filter.c_str()) == IMAGE_FILE_RAW_LUV)
+        {
+            std::cerr << "The band filter writes RGB images" << std::endl;
+            return 1;
+        }
+        bool ok;
+        if (IsPngFile(args[0]))
+        {
+            MSPngReader source(args[0]);
+            ok = source.IsOpen() && FilterBands(source, filename_filter.c_str(), spatial_radius, color_radius, num_iters,
+                                                options, band_height, &png, counter);
+        }
+        else
+        {
+            MSMappedReader source(args[0]);
+            ok = source.IsOpen() && FilterBands(source, filename_filter.c_str(), spatial_radius, color_radius, num_iters,
+                                                options, band_height, &png, counter);
+        }
+        if (!ok)
+        {
+            std::cerr << "Can not filter " << args[0] << " to " << filename_filter << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        // Read image to be filtered, PNG, PPM, PAM or raw planar RGB or L*u*v, converted to L*u*v as
+        // it is decoded
+        if (!input.Open(args[0], true))
+        {
+            std::cerr << "Can not read " << args[0] << std::endl;
+            return 1;
+        }
+        counter.Start();
+        MS_FilterLUV(input.Planar(), input.Width(), input.Height(), spatial_radius, color_radius, num_iters, options);
+        counter.Stop();
+    }
 
+    if (options.speedup != MS_SPEEDUP_NONE)
+        cout << "Pixels resolved by trajectory reuse: " << stats.reused << " of " << stats.pixels
+             << " (" << 100.0 * stats.reused / stats.pixels << "%)" << endl;
+    if (verbose)
+        cout << "Instruction set: " << CPU_IsaName(MS_SimdIsa(options.simd)) << endl;
+    if (verbose)
+        cout << "Iterations: " << stats.iterations << ", " << (double)stats.iterations / stats.pixels
+             << " per pixel" << (stats.levels > 1 ? " with all levels" : "") << ", " << stats.capped << " pixels stopped at the limit of " << num_iters << endl;
+    if (verbose && stats.levels > 1)
+        for (int l = stats.levels - 1; l >= 0; l--)
+            cout << "Iterations at level " << l << ": " << stats.level_iterations[l] << endl;
+    if (verbose)
+    {
+        if (counter.Available())
+            cout << "Cache misses: " << counter.Misses() << endl;
+        else
+            cout << "Cache misses: not available" << endl;
+    }
+    if (diagnostics_prefix && !MS_WriteDiagnostics(diagnostics, diagnostics_prefix))
+        std::cerr << "Can not write the diagnostics " << diagnostics_prefix << "_*" << std::endl;
+    // Save, converted to RGB unless the file is L*u*v
+    if (!stream && !WriteImage(filename_filter.c_str(), input.Planar(), input.Width(), input.Height(), input.IsLUV(), &png, options.num_threads))
+    {
+        std::cerr << "Can not write " << filename_filter << std::endl;
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Pipeline.h"
+
+
+/**
+ * @file Pipeline.cpp
+ * @brief Items passed through stages on a thread pool
+ *
+ * Every worker of the pool runs one task, a loop which takes the next (stage, item) pair that may
+ * start, executes it and queues the item for its next stage. An item may start a stage only if
+ * the queue of the next stage plus the items already executing the stage stay within the
+ * capacity; the last stage is never held back. So at most about capacity items wait between two
+ * stages, and the stages of different items overlap: while one item is computed, the next one is
+ * decoded and the previous one encoded.
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Constructor of Pipeline
+*
+*  \param pool pool whose workers run the stages
+*  \param num_stages number of stages of every item
+*  \param capacity items which may wait for a stage, values smaller than 1 are treated as 1
+*/
+Pipeline::Pipeline(ThreadPool &pool, int num_stages, int capacity)
+    : pool(pool), num_stages(num_stages), capacity(capacity < 1 ? 1 : capacity), current(NULL),
+      num_items(0), admitted(0), finished(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&changed, NULL);
+}
+
+Pipeline::~Pipeline()
+{
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&lock);
+}
+
+/*! \brief Function Run passes items 0 .. num_items-1 through the stages and returns when all of them
+*  are finished or dropped. Items are admitted in order.
+*
+*  \param stages work of the stages
+*  \param num_items number of items
+*/
+void Pipeline::Run(PipelineStages &stages, int num_items)
+{
+    current = &stages;
+    this->num_items = num_items;
+    admitted = 0;
+    finished = 0;
+    waiting.assign(num_stages, std::deque<int>());
+    running.assign(num_stages, 0);
+
+    pool.Run(*this, pool.Size());
+    current = NULL;
+}
+
+/*! \brief Function CanStart tells if an item may start a stage, the lock is held
+*
+*  \param stage stage
+*  \return false if the queue of the next stage would exceed the capacity
+*/
+bool Pipeline::CanStart(int stage) const
+{
+    if(stage == num_stages - 1)
+        return true;
+    return (int)waiting[stage + 1].size() + running[stage] < capacity;
+}
+
+/*! \brief Function Execute is the loop of a worker, it returns when every item is finished
+*
+*  \param worker index of the worker
+*/
+void Pipeline::Execute(int, int worker)
+{
+    pthread_mutex_lock(&lock);
+    while(finished < num_items)
+    {
+        // the latest stage first, new items last
+        int stage = -1, item = -1;
+        for(int s = num_stages - 1; s > 0 && stage < 0; s--)
+            if(!waiting[s].empty() && CanStart(s))
+            {
+                stage = s;
+                item = waiting[s].front();
+                waiting[s].pop_front();
+            }
+        if(stage < 0 && admitted < num_items && CanStart(0))
+        {
+            stage = 0;
+            item = admitted++;
+        }
+        if(stage < 0)
+        {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+
+        running[stage]++;
+        pthread_mutex_unlock(&lock);
+        bool ok = current->Execute(stage, item, worker);
+        pthread_mutex_lock(&lock);
+        running[stage]--;
+        if(ok && stage + 1 < num_stages)
+            waiting[stage + 1].push_back(item);
+        else
+            finished++;
+        pthread_cond_broadcast(&changed);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "ThreadPool.h"
+
+
+/*Class PipelineStages is the work of a Pipeline, every item passes the stages in order */
+class PipelineStages
+{
+public:
+    virtual ~PipelineStages() {}
+
+    // Execute stage number stage of item number item on the worker with index worker, false drops the item
+    virtual bool Execute(int stage, int item, int worker) = 0;
+};
+
+
+/*Class Pipeline runs numbered items through a sequence of stages on the workers of a ThreadPool.
+  Between two stages the items wait in queues of a bounded capacity, so a stage does not run ahead
+  of the next one, and a worker prefers the latest stage an item is ready for. */
+class Pipeline : private ParallelTask
+{
+public:
+    Pipeline(ThreadPool &pool, int num_stages, int capacity);
+    ~Pipeline();
+
+    void Run(PipelineStages &stages, int num_items);
+
+private:
+    ThreadPool &pool;
+    int num_stages;
+    int capacity;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    PipelineStages *current;
+    int num_items;
+    int admitted;       // items which entered the first stage
+    int finished;       // items which left the last stage or were dropped
+    std::vector<std::deque<int> > waiting;  // items waiting for every stage, the first is unused
+    std::vector<int> running;               // items executing every stage
+
+    void Execute(int task, int worker);
+    bool CanStart(int stage) const;
+
+    // not copyable
+    Pipeline(const Pipeline &);
+    Pipeline &operator=(const Pipeline &);
+};
+
+
+#endif /* PIPELINE_H */
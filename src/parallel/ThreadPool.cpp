@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ThreadPool.h"
+
+
+/**
+ * @file ThreadPool.cpp
+ * @brief Work-stealing thread pool used by the parallel filter
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Constructor of ThreadPool starts num_threads - 1 worker threads,
+*  the thread calling Run() is used as worker 0.
+*
+*  \param num_threads number of workers, values smaller than 1 are treated as 1
+*/
+ThreadPool::ThreadPool(int num_threads)
+    : num_workers(num_threads < 1 ? 1 : num_threads), current(NULL), pending(0), generation(0), stopping(false)
+{
+    pthread_mutex_init(&run_lock, NULL);
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&start_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+
+    for(int w = 0; w < num_workers; w++)
+    {
+        WorkerQueue *queue = new WorkerQueue;
+        pthread_mutex_init(&queue->lock, NULL);
+        queues.push_back(queue);
+    }
+
+    starts.resize(num_workers);
+    threads.resize(num_workers);
+    for(int w = 1; w < num_workers; w++)
+    {
+        starts[w].pool = this;
+        starts[w].worker = w;
+        pthread_create(&threads[w], NULL, WorkerMain, &starts[w]);
+    }
+}
+
+/*! \brief Destructor of ThreadPool stops and joins the worker threads
+*/
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&lock);
+
+    for(int w = 1; w < num_workers; w++)
+        pthread_join(threads[w], NULL);
+
+    for(int w = 0; w < num_workers; w++)
+    {
+        pthread_mutex_destroy(&queues[w]->lock);
+        delete queues[w];
+    }
+
+    pthread_cond_destroy(&done_cond);
+    pthread_cond_destroy(&start_cond);
+    pthread_mutex_destroy(&lock);
+    pthread_mutex_destroy(&run_lock);
+}
+
+/*! \brief Function Run executes tasks 0 .. num_tasks-1 and returns when all of them are finished.
+*
+*  Tasks are dealt to the workers in contiguous blocks, so neighbouring tasks stay on the same
+*  worker. A worker whose deque runs empty steals from the back of the other deques, which
+*  balances tasks with very different costs. Run() must not be called from inside a task.
+*
+*  \param task task to execute
+*  \param num_tasks number of tasks
+*/
+void ThreadPool::Run(ParallelTask &task, int num_tasks)
+{
+    if(num_tasks <= 0)
+        return;
+
+    pthread_mutex_lock(&run_lock);
+
+    pthread_mutex_lock(&lock);
+    current = &task;
+    pending = num_tasks;
+
+    int base = num_tasks / num_workers, rest = num_tasks % num_workers;
+    for(int w = 0; w < num_workers; w++)
+    {
+        int from = w * base + (w < rest ? w : rest);
+        int to = from + base + (w < rest ? 1 : 0);
+
+        pthread_mutex_lock(&queues[w]->lock);
+        for(int t = from; t < to; t++)
+            queues[w]->tasks.push_back(t);
+        pthread_mutex_unlock(&queues[w]->lock);
+    }
+
+    generation++;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&lock);
+
+    // The calling thread works as worker 0
+    DrainTasks(0);
+
+    pthread_mutex_lock(&lock);
+    while(pending > 0)
+        pthread_cond_wait(&done_cond, &lock);
+    current = NULL;
+    pthread_mutex_unlock(&lock);
+
+    pthread_mutex_unlock(&run_lock);
+}
+
+/*! \brief Function WorkerMain is the entry point of the worker threads
+*
+*  \param arg WorkerStart of the thread
+*/
+void *ThreadPool::WorkerMain(void *arg)
+{
+    WorkerStart *start = (WorkerStart*)arg;
+    start->pool->WorkerLoop(start->worker);
+    return NULL;
+}
+
+/*! \brief Function WorkerLoop waits for a new Run() and drains the task deques
+*
+*  \param worker index of the worker
+*/
+void ThreadPool::WorkerLoop(int worker)
+{
+    unsigned seen = 0;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&lock);
+        while(!stopping && seen == generation)
+            pthread_cond_wait(&start_cond, &lock);
+        if(stopping)
+        {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        seen = generation;
+        pthread_mutex_unlock(&lock);
+
+        DrainTasks(worker);
+    }
+}
+
+/*! \brief Function DrainTasks executes tasks until no deque has work left
+*
+*  \param worker index of the worker
+*/
+void ThreadPool::DrainTasks(int worker)
+{
+    int task;
+
+    while(TakeTask(worker, &task))
+    {
+        current->Execute(task, worker);
+
+        pthread_mutex_lock(&lock);
+        if(--pending == 0)
+            pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/*! \brief Function TakeTask pops a task from the own deque or steals one from another worker
+*
+*  \param worker index of the worker
+*  \param task taken task
+*  \return true if a task was taken
+*/
+bool ThreadPool::TakeTask(int worker, int *task)
+{
+    for(int k = 0; k < num_workers; k++)
+    {
+        int victim = (worker + k) % num_workers;
+        WorkerQueue *queue = queues[victim];
+        bool found = false;
+
+        pthread_mutex_lock(&queue->lock);
+        if(!queue->tasks.empty())
+        {
+            // own tasks are taken in order, stolen tasks from the opposite end
+            if(k == 0)
+            {
+                *task = queue->tasks.front();
+                queue->tasks.pop_front();
+            }
+            else
+            {
+                *task = queue->tasks.back();
+                queue->tasks.pop_back();
+            }
+            found = true;
+        }
+        pthread_mutex_unlock(&queue->lock);
+
+        if(found)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+
+/*Class ParallelTask is the unit of work executed by the ThreadPool */
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() {}
+
+    // Execute task number task on the worker with index worker
+    virtual void Execute(int task, int worker) = 0;
+};
+
+
+/*Class ThreadPool runs numbered tasks on persistent worker threads with work stealing */
+class ThreadPool
+{
+public:
+    ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    int Size() const { return num_workers; }
+    void Run(ParallelTask &task, int num_tasks);
+
+private:
+    /*Structure WorkerQueue is the task deque owned by one worker */
+    struct WorkerQueue
+    {
+        pthread_mutex_t lock;
+        std::deque<int> tasks;
+    };
+
+    /*Structure WorkerStart passes the pool and worker index to a new thread */
+    struct WorkerStart
+    {
+        ThreadPool *pool;
+        int worker;
+    };
+
+    static void *WorkerMain(void *arg);
+    void WorkerLoop(int worker);
+    void DrainTasks(int worker);
+    bool TakeTask(int worker, int *task);
+
+    int num_workers;
+    std::vector<WorkerQueue*> queues;
+    std::vector<pthread_t> threads;
+    std::vector<WorkerStart> starts;
+
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    ParallelTask *current;
+    int pending;
+    unsigned generation;
+    bool stopping;
+
+    // not copyable
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+};
+
+
+#endif /* THREADPOOL_H */
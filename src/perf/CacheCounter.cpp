@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "CacheCounter.h"
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+/**
+ * @file CacheCounter.cpp
+ * @brief Cache miss counter based on perf_event_open
+ *
+ * @author Damir Demirović <damir.demirovic@untz.ba>
+ */
+
+
+
+/*! \brief Constructor CacheCounter opens the counter of the cache misses of user code, disabled.
+*  Threads started later inherit it.
+*/
+CacheCounter::CacheCounter() : fd(-1), misses(-1)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*! \brief Destructor ~CacheCounter closes the counter
+*/
+CacheCounter::~CacheCounter()
+{
+    if(fd >= 0)
+        close(fd);
+}
+
+/*! \brief Function Start resets and enables the counter
+*/
+void CacheCounter::Start()
+{
+    if(fd < 0)
+        return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/*! \brief Function Stop disables the counter and reads the misses since Start
+*/
+void CacheCounter::Stop()
+{
+    uint64_t count;
+
+    if(fd < 0)
+        return;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if(read(fd, &count, sizeof(count)) == (ssize_t)sizeof(count))
+        misses = (long)count;
+}
+
+/*! \brief Function Misses returns the cache misses between Start and Stop
+*
+*  \return number of misses, -1 if the counter is not available
+*/
+long CacheCounter::Misses() const
+{
+    return misses;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2019, Damir Demirović <damir.demirovic@untz.ba>
+ * All rights reserved.
+ *
+ * This program is free software: you can use, modify and/or
+ * redistribute it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later
+ * version. You should have received a copy of this license along
+ * this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHECOUNTER_H
+#define CACHECOUNTER_H
+
+
+/*Class CacheCounter counts the cache misses of the process and of the threads it starts while
+  the counter runs, with the hardware performance counters of Linux. Where they are not available
+  the counter reports -1. */
+class CacheCounter
+{
+public:
+    CacheCounter();
+    ~CacheCounter();
+
+    bool Available() const { return fd >= 0; }
+    void Start();
+    void Stop();
+
+    // Last level cache misses between Start and Stop, -1 if the counter is not available
+    long Misses() const;
+
+private:
+    int fd;
+    long misses;
+
+    // not copyable
+    CacheCounter(const CacheCounter &);
+    CacheCounter &operator=(const CacheCounter &);
+};
+
+
+#endif /* CACHECOUNTER_H */
@@ -35,9 +35,32 @@ Implemented by Chris M. Christoudias, Bogdan Georgescu
 
 
 #include "TransitiveClosure.h"
+#include "../cpu/cpu.h"
+
+/*Grows a buffer of the arena to at least count entries, its contents are not kept */
+template <class T> static T *TransitiveClosure_Reserve(std::vector<T> &buffer, size_t count)
+{
+	if(buffer.size() < count)
+	{
+		buffer.clear();
+		buffer.resize(count);
+	}
+	return &buffer[0];
+}
 
 void TransitiveClosure(int width, int height,  int **labels, int* modePointCounts, float *mode,double color_radius,int oldRegionCount, int minRegion){
 
+	TransitiveClosureArena arena;
+	TransitiveClosure(width, height, labels, modePointCounts, mode, color_radius, oldRegionCount, minRegion, arena);
+
+	delete []mode;
+	delete []modePointCounts;
+}
+
+// As above, with the buffers of the arena instead of new ones; mode and modePointCounts are not
+// deleted. Returns the number of regions, the labels are 0 to that number - 1.
+int TransitiveClosure(int width, int height,  int **labels, int* modePointCounts, float *mode,double color_radius,int oldRegionCount, int minRegion, TransitiveClosureArena &arena){
+
    
   double color_radius2=color_radius*color_radius;
   int regionCount = oldRegionCount;
@@ -45,7 +68,7 @@ void TransitiveClosure(int width, int height,  int **labels, int* modePointCount
 		for(int counter = 0, deltaRegionCount = 1; counter<5 && deltaRegionCount>0; counter++)
 		{
 			// 1.Build RAM using classifiction structure
-			RAList *raList = new RAList [regionCount], *raPool = new RAList [10*regionCount];	//10 is hard coded!
+			RAList *raList = TransitiveClosure_Reserve(arena.list, regionCount), *raPool = TransitiveClosure_Reserve(arena.pool, 10*regionCount);	//10 is hard coded!
 			for(int i = 0; i < regionCount; i++)
 			{
 				raList[i].label = i;
@@ -122,10 +145,10 @@ void TransitiveClosure(int width, int height,  int **labels, int* modePointCount
 					raList[i].label	= iCanEl;
 				}
 				// 4. Traverse joint sets, relabeling image.
-				int *modePointCounts_buffer = new int[regionCount];
+				int *modePointCounts_buffer = TransitiveClosure_Reserve(arena.counts, regionCount);
 				memset(modePointCounts_buffer, 0, regionCount*sizeof(int));
-				float *mode_buffer = new float[regionCount*3];
-				int	*label_buffer = new int[regionCount];
+				float *mode_buffer = TransitiveClosure_Reserve(arena.modes, regionCount*3);
+				int	*label_buffer = TransitiveClosure_Reserve(arena.labels, regionCount);
 
 				for(int i=0;i<regionCount; i++)
 				{
@@ -155,18 +178,14 @@ void TransitiveClosure(int width, int height,  int **labels, int* modePointCount
 						modePointCounts[label]	= modePointCounts_buffer[iCanEl];
 					}
 				}
+				// complete label_buffer to the new label of every old region, the canonical
+				// elements have theirs, and relabel the rows with the kernel of the processor
+				for(int i = 0; i < regionCount; i++)
+					if(raList[i].label != i)
+						label_buffer[i]	= label_buffer[raList[i].label];
 				regionCount = label+1;
 				for(int i = 0; i < height; i++)
-					for(int j = 0; j < width; j++)
-						labels[i][j]	= label_buffer[raList[labels[i][j]].label];
-
-				delete [] mode_buffer;
-				delete [] modePointCounts_buffer;
-				delete [] label_buffer;
-
-				//Destroy RAM
-				delete[] raList;
-				delete[] raPool;
+					CPU_Kernels().relabel(labels[i], width, label_buffer);
 
 				deltaRegionCount = oldRegionCount - regionCount;
 				oldRegionCount = regionCount;
@@ -176,15 +195,15 @@ void TransitiveClosure(int width, int height,  int **labels, int* modePointCount
 		
 		// Prune
 		{
-			int *modePointCounts_buffer = new int[regionCount];
-			float *mode_buffer = new float[regionCount*3];
-			int	*label_buffer = new int [regionCount];
+			int *modePointCounts_buffer = TransitiveClosure_Reserve(arena.counts, regionCount);
+			float *mode_buffer = TransitiveClosure_Reserve(arena.modes, regionCount*3);
+			int	*label_buffer = TransitiveClosure_Reserve(arena.labels, regionCount);
 			int minRegionCount;
 
 			do{
 				minRegionCount = 0;
 				// Build RAM again
-				RAList *raList = new RAList [regionCount], *raPool = new RAList [10*regionCount];	//10 is hard coded!
+				RAList *raList = TransitiveClosure_Reserve(arena.list, regionCount), *raPool = TransitiveClosure_Reserve(arena.pool, 10*regionCount);	//10 is hard coded!
 				for(int i = 0; i < regionCount; i++)
 				{
 					raList[i].label = i;
@@ -296,25 +315,17 @@ void TransitiveClosure(int width, int height,  int **labels, int* modePointCount
 								modePointCounts[label]	= modePointCounts_buffer[iCanEl];
 							}
 						}
+						for(int i = 0; i < regionCount; i++)
+							if(raList[i].label != i)
+								label_buffer[i]	= label_buffer[raList[i].label];
 						regionCount = label+1;
 						for(int i = 0; i < height; i++)
-							for(int j = 0; j < width; j++)
-								labels[i][j]	= label_buffer[raList[labels[i][j]].label];
+							CPU_Kernels().relabel(labels[i], width, label_buffer);
 
-						//Destroy RAM
-						delete[] raList;
-						delete[] raPool;
 						//std::cout<<"Mean Shift(Prune):"<<regionCount<<std::endl;
 			}while(minRegionCount > 0);
-
-			delete [] mode_buffer;
-			delete [] modePointCounts_buffer;
-			delete [] label_buffer;
 		}
 
-		
-		delete []mode;
-		delete []modePointCounts;
-		
+		return regionCount;
 }
 
@@ -37,9 +37,21 @@ Implemented by Chris M. Christoudias, Bogdan Georgescu
 #define TRANSITIVECLOSURE_H
 
 #include <string.h>
+#include <vector>
 #include "RAList.h"
 #include "../image/image.h"
 
+/*Structure TransitiveClosureArena holds the buffers of TransitiveClosure, kept between calls and grown to the largest number of regions */
+struct TransitiveClosureArena
+{
+	std::vector<RAList> list;		// adjacency list of every region
+	std::vector<RAList> pool;		// free nodes of the lists, 10 per region
+	std::vector<int> counts;		// points of the merged regions
+	std::vector<float> modes;		// modes of the merged regions
+	std::vector<int> labels;		// new label of every region
+};
+
 void TransitiveClosure(int width, int height, int **labels, int* modePointCounts, float *mode,double color_radius,int oldRegionCount,int minRegion);
+int TransitiveClosure(int width, int height, int **labels, int* modePointCounts, float *mode,double color_radius,int oldRegionCount,int minRegion, TransitiveClosureArena &arena);
 
 #endif /* TRANSITIVECLOSURE_H */